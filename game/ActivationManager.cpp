@@ -0,0 +1,80 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#include <Urho3D/Graphics/Camera.h>
+#include <Urho3D/Graphics/Light.h>
+#include <Urho3D/Graphics/Octree.h>
+#include <Urho3D/Graphics/OctreeQuery.h>
+#include <Urho3D/Scene/Scene.h>
+
+#include "ActivationManager.h"
+#include "BatchedAnimation.h"
+
+#include <Urho3D/DebugNew.h>
+
+using namespace Urho3D;
+
+ActivationManager::ActivationManager(Context* context)
+    : Object(context)
+{
+}
+
+void ActivationManager::SetScene(Scene* scene, Camera* camera, BatchedAnimation* animation)
+{
+    scene_ = scene;
+    camera_ = camera;
+    animation_ = animation;
+}
+
+void ActivationManager::Update(float timeStep)
+{
+    sinceCheck_ += timeStep;
+    if (sinceCheck_ < interval_)
+        return;
+    sinceCheck_ = 0.0f;
+    Check();
+}
+
+void ActivationManager::Check()
+{
+    auto* octree = scene_ ? scene_->GetComponent<Octree>() : nullptr;
+    if (!octree || !camera_ || !animation_)
+        return;
+
+    // The enabled lights whose volume touches the view frustum, cut off at the radius
+    const Frustum frustum = camera_->GetSplitFrustum(camera_->GetNearClip(), Min(camera_->GetFarClip(), radius_));
+    drawables_.Clear();
+    FrustumOctreeQuery query(drawables_, frustum, DRAWABLE_LIGHT);
+    octree->GetDrawables(query);
+    visible_.clear();
+    for (Drawable* drawable : drawables_)
+        visible_.insert(drawable->GetNode());
+
+    numInactive_ = 0;
+    scene_->GetNodesWithTag(nodes_, tag_);
+    for (Node* node : nodes_)
+    {
+        auto* light = node->GetComponent<Light>();
+        if (!light)
+            continue;
+
+        bool active;
+        if (light->IsEnabled())
+        {
+            active = visible_.count(node) != 0;
+        }
+        else
+        {
+            // Where the light would be now had it not been paused
+            active = frustum.IsInsideFast(Sphere(animation_->GetPosition(node), light->GetRange())) != OUTSIDE;
+        }
+
+        if (active != light->IsEnabled())
+        {
+            light->SetEnabled(active);
+            animation_->SetPaused(node, !active);
+        }
+        if (!active)
+            ++numInactive_;
+    }
+}
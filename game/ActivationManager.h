@@ -0,0 +1,64 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#pragma once
+
+#include <Urho3D/Container/Ptr.h>
+#include <Urho3D/Core/Object.h>
+#include <unordered_set>
+
+namespace Urho3D
+{
+class Camera;
+class Drawable;
+class Node;
+class Scene;
+} // namespace Urho3D
+
+class BatchedAnimation;
+
+/// Pauses the animation of the lights with a tag and disables them while they can not affect the view: when their
+/// light volume is outside the camera frustum cut off at an activation radius. Checks run at a throttled rate. Enabled
+/// lights are found with an octree query; disabled ones are out of the octree, so the position they would have now is
+/// evaluated and tested instead. Animation time keeps running while a light is paused, so a resumed light is back in
+/// step with the others. Main thread only.
+class ActivationManager : public Urho3D::Object
+{
+    URHO3D_OBJECT(ActivationManager, Urho3D::Object);
+
+public:
+    /// Construct.
+    explicit ActivationManager(Urho3D::Context* context);
+
+    /// Set the scene, the camera whose view activates lights and the animation to pause.
+    void SetScene(Urho3D::Scene* scene, Urho3D::Camera* camera, BatchedAnimation* animation);
+    /// Set the tag of the managed light nodes.
+    void SetTag(const Urho3D::String& tag) { tag_ = tag; }
+    /// Set the distance from the camera beyond which lights are deactivated.
+    void SetRadius(float radius) { radius_ = radius; }
+    /// Set the time between checks in seconds.
+    void SetInterval(float interval) { interval_ = interval; }
+
+    /// Run a check if the interval has elapsed.
+    void Update(float timeStep);
+
+    /// Return the number of managed lights that were inactive at the last check.
+    unsigned GetNumInactive() const { return numInactive_; }
+
+private:
+    /// Activate or deactivate each managed light.
+    void Check();
+
+    Urho3D::WeakPtr<Urho3D::Scene> scene_{};
+    Urho3D::WeakPtr<Urho3D::Camera> camera_{};
+    Urho3D::WeakPtr<BatchedAnimation> animation_{};
+    Urho3D::String tag_{};
+    float radius_{80.0f};
+    float interval_{0.1f};
+    float sinceCheck_{0.0f};
+    unsigned numInactive_{0};
+    /// Scratch buffers. Kept to avoid allocating every check.
+    Urho3D::PODVector<Urho3D::Node*> nodes_{};
+    Urho3D::PODVector<Urho3D::Drawable*> drawables_{};
+    std::unordered_set<Urho3D::Node*> visible_{};
+};
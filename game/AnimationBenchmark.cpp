@@ -0,0 +1,132 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Graphics/Light.h>
+#include <Urho3D/Graphics/Octree.h>
+#include <Urho3D/Scene/ObjectAnimation.h>
+#include <Urho3D/Scene/Scene.h>
+#include <Urho3D/Scene/ValueAnimation.h>
+
+#include "AnimationBenchmark.h"
+#include "BatchedAnimation.h"
+
+#include <cstdio>
+#include <random>
+
+#include <Urho3D/DebugNew.h>
+
+using namespace Urho3D;
+
+namespace
+{
+
+const float FRAME_TIME = 1.0f / 60.0f;
+
+/// Return keys like those of a disco light: a closed random spline path and eight colours.
+AnimationKeys MakeLightKeys(std::mt19937& random)
+{
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    AnimationKeys keys;
+    keys.tension_ = 0.7f;
+    float time = 0.0f;
+    for (unsigned k = 0; k < 21; ++k)
+    {
+        keys.positionTimes_.push_back(time);
+        keys.positions_.push_back(k < 20 ? Vector3(-60.0f + dist(random) * 120.0f, 3.0f, -60.0f + dist(random) * 120.0f)
+                                         : keys.positions_.front());
+        time += dist(random) * 3.0f + 0.5f;
+    }
+    const Color colors[] = {Color::WHITE, Color::GRAY, Color::RED,     Color::GREEN,
+                            Color::BLUE,  Color::CYAN, Color::MAGENTA, Color::YELLOW};
+    for (unsigned k = 0; k < 8; ++k)
+    {
+        keys.colorTimes_.push_back(k ? (float)k + dist(random) * 0.5f : 0.0f);
+        keys.colors_.push_back(colors[k]);
+    }
+    return keys;
+}
+
+/// Return an ObjectAnimation playing the same keys.
+SharedPtr<ObjectAnimation> MakeObjectAnimation(Context* context, const AnimationKeys& keys)
+{
+    SharedPtr<ObjectAnimation> objectAnimation(new ObjectAnimation(context));
+
+    SharedPtr<ValueAnimation> positionAnimation(new ValueAnimation(context));
+    positionAnimation->SetInterpolationMethod(IM_SPLINE);
+    positionAnimation->SetSplineTension(keys.tension_);
+    for (unsigned k = 0; k < keys.positionTimes_.size(); ++k)
+        positionAnimation->SetKeyFrame(keys.positionTimes_[k], keys.positions_[k]);
+    objectAnimation->AddAttributeAnimation("Position", positionAnimation);
+
+    SharedPtr<ValueAnimation> colorAnimation(new ValueAnimation(context));
+    for (unsigned k = 0; k < keys.colorTimes_.size(); ++k)
+        colorAnimation->SetKeyFrame(keys.colorTimes_[k], keys.colors_[k]);
+    objectAnimation->AddAttributeAnimation("@Light/Color", colorAnimation);
+
+    return objectAnimation;
+}
+
+Node* CreateLightNode(Scene* scene)
+{
+    Node* node = scene->CreateChild("PointLight");
+    auto* light = node->CreateComponent<Light>();
+    light->SetLightType(LIGHT_POINT);
+    light->SetRange(10.0f);
+    return node;
+}
+
+} // namespace
+
+AnimationBenchmark::AnimationBenchmark(Context* context)
+    : Object(context)
+{
+}
+
+std::string AnimationBenchmark::Run(const std::vector<unsigned>& nodeCounts, unsigned numFrames)
+{
+    // A fixed seed, so that runs are comparable
+    std::mt19937 random(1);
+
+    std::string report = "{\"frames\": " + std::to_string(numFrames) + ", \"results\": [";
+    for (unsigned i = 0; i < nodeCounts.size(); ++i)
+    {
+        const unsigned numNodes = nodeCounts[i];
+        std::vector<AnimationKeys> keys;
+        for (unsigned j = 0; j < numNodes; ++j)
+            keys.push_back(MakeLightKeys(random));
+
+        SharedPtr<Scene> objectScene(new Scene(context_));
+        objectScene->CreateComponent<Octree>();
+        for (const AnimationKeys& nodeKeys : keys)
+            CreateLightNode(objectScene)->SetObjectAnimation(MakeObjectAnimation(context_, nodeKeys));
+
+        SharedPtr<Scene> batchedScene(new Scene(context_));
+        batchedScene->CreateComponent<Octree>();
+        auto* animation = batchedScene->CreateComponent<BatchedAnimation>();
+        for (const AnimationKeys& nodeKeys : keys)
+            animation->Add(CreateLightNode(batchedScene), nodeKeys);
+
+        const double objectUs = MeasureUpdate(objectScene, numFrames);
+        const double batchedUs = MeasureUpdate(batchedScene, numFrames);
+
+        char result[256];
+        snprintf(result, sizeof(result),
+                 "%s{\"nodes\": %u, \"objectAnimationUs\": %.1f, \"batchedAnimationUs\": %.1f, \"speedup\": %.2f}",
+                 i ? ", " : "", numNodes, objectUs, batchedUs, batchedUs > 0.0 ? objectUs / batchedUs : 0.0);
+        report += result;
+    }
+    report += "]}";
+    return report;
+}
+
+double AnimationBenchmark::MeasureUpdate(Scene* scene, unsigned numFrames)
+{
+    // The first update inserts the lights into the octree, leave it out
+    scene->Update(FRAME_TIME);
+
+    HiresTimer timer;
+    for (unsigned i = 0; i < numFrames; ++i)
+        scene->Update(FRAME_TIME);
+    return numFrames ? timer.GetUSec(false) / (double)numFrames : 0.0;
+}
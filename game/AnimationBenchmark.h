@@ -0,0 +1,34 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#pragma once
+
+#include <Urho3D/Core/Object.h>
+#include <string>
+#include <vector>
+
+namespace Urho3D
+{
+class Scene;
+}
+
+/// Compares the per-frame cost of animating procedural lights with one ObjectAnimation per node against
+/// BatchedAnimation. Used by the --headless --animation-benchmark mode. Main thread only.
+///
+/// For each node count, two scenes get the same random spline paths and colour sequences, one through ObjectAnimation
+/// and ValueAnimation, one through a BatchedAnimation component, and are updated for a number of frames.
+class AnimationBenchmark : public Urho3D::Object
+{
+    URHO3D_OBJECT(AnimationBenchmark, Urho3D::Object);
+
+public:
+    /// Construct.
+    explicit AnimationBenchmark(Urho3D::Context* context);
+
+    /// Run the benchmark for each node count and return the report as JSON.
+    std::string Run(const std::vector<unsigned>& nodeCounts, unsigned numFrames);
+
+private:
+    /// Return the average time of a scene update in microseconds.
+    double MeasureUpdate(Urho3D::Scene* scene, unsigned numFrames);
+};
@@ -0,0 +1,420 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Core/WorkQueue.h>
+#include <Urho3D/Graphics/Light.h>
+#include <Urho3D/Scene/Scene.h>
+#include <Urho3D/Scene/SceneEvents.h>
+
+#include "BatchedAnimation.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef URHO3D_SSE
+#include <xmmintrin.h>
+#endif
+
+#include <Urho3D/DebugNew.h>
+
+using namespace Urho3D;
+
+namespace
+{
+
+/// Fewest channel members worth a work item of their own.
+const unsigned MIN_MEMBERS_PER_ITEM = 2048;
+
+/// Return whether key times can be looped over: at least two, starting at zero and increasing.
+bool IsValidTrack(const std::vector<float>& times, size_t numValues)
+{
+    if (times.size() < 2 || times.size() != numValues || times.front() != 0.0f)
+        return false;
+    for (size_t i = 1; i < times.size(); ++i)
+    {
+        if (times[i] <= times[i - 1])
+            return false;
+    }
+    return true;
+}
+
+/// Advance a segment index of a track looping over its last key time to the segment containing a time, and return the
+/// position within that segment from 0 to 1. The index only moves forward, except when the loop wraps around.
+float FindSegment(const float* times, unsigned last, double time, unsigned& k)
+{
+    const auto localTime = (float)std::fmod(time, (double)times[last]);
+    if (localTime < times[k])
+        k = 0;
+    while (k + 1 < last && times[k + 1] <= localTime)
+        ++k;
+    return Clamp((localTime - times[k]) / (times[k + 1] - times[k]), 0.0f, 1.0f);
+}
+
+/// Return the cardinal spline tangent at a key. A closed track shares the tangent across the seam, an open one stops at
+/// its ends.
+template <class T> T GetCardinalTangent(const T* values, unsigned numKeys, unsigned k, bool closed, float tension)
+{
+    if (k > 0 && k + 1 < numKeys)
+        return (values[k + 1] - values[k - 1]) * tension;
+    return closed && numKeys > 2 ? (values[1] - values[numKeys - 2]) * tension : T();
+}
+
+/// Hermite basis: p0 * (2t^3 - 3t^2 + 1) + p1 * (3t^2 - 2t^3) + m0 * (t^3 - 2t^2 + t) + m1 * (t^3 - t^2).
+template <class T> T Hermite(const T& p0, const T& p1, const T& m0, const T& m1, float t)
+{
+    const float tt = t * t;
+    const float ttt = tt * t;
+    const float h2 = 3.0f * tt - 2.0f * ttt;
+    const float h4 = ttt - tt;
+    return p0 * (1.0f - h2) + p1 * h2 + m0 * (h4 - tt + t) + m1 * h4;
+}
+
+} // namespace
+
+BatchedAnimation::BatchedAnimation(Context* context)
+    : Component(context)
+{
+}
+
+void BatchedAnimation::RegisterObject(Context* context)
+{
+    context->RegisterFactory<BatchedAnimation>();
+}
+
+void BatchedAnimation::Add(Node* node, const AnimationKeys& keys)
+{
+    if (!node)
+        return;
+
+    Entry entry;
+    entry.node_ = node;
+    entry.light_ = node->GetComponent<Light>();
+    entry.keys_ = keys;
+    if (IsValidTrack(keys.positionTimes_, keys.positions_.size()))
+        entry.channels_ |= CHANNEL_POSITION;
+    if (IsValidTrack(keys.yawTimes_, keys.yaws_.size()))
+        entry.channels_ |= CHANNEL_YAW;
+    if (entry.light_ && IsValidTrack(keys.colorTimes_, keys.colors_.size()))
+        entry.channels_ |= CHANNEL_COLOR;
+
+    auto it = entryIndices_.find(node);
+    if (it != entryIndices_.end())
+    {
+        entry.paused_ = entries_[it->second].paused_;
+        entries_[it->second] = std::move(entry);
+        dirty_ = true;
+        return;
+    }
+
+    const auto index = (unsigned)entries_.size();
+    entries_.push_back(std::move(entry));
+    entryIndices_[node] = index;
+    if (!dirty_)
+        AddToChannels(index);
+}
+
+void BatchedAnimation::Stop(Node* node, unsigned channels)
+{
+    auto it = entryIndices_.find(node);
+    if (it == entryIndices_.end())
+        return;
+
+    Entry& entry = entries_[it->second];
+    if (entry.channels_ & channels)
+    {
+        entry.channels_ &= ~channels;
+        dirty_ = true;
+    }
+}
+
+void BatchedAnimation::SetPaused(Node* node, bool paused)
+{
+    auto it = entryIndices_.find(node);
+    if (it == entryIndices_.end())
+        return;
+
+    Entry& entry = entries_[it->second];
+    if (entry.paused_ != paused)
+    {
+        entry.paused_ = paused;
+        dirty_ = true;
+    }
+}
+
+bool BatchedAnimation::IsPaused(Node* node) const
+{
+    auto it = entryIndices_.find(node);
+    return it != entryIndices_.end() && entries_[it->second].paused_;
+}
+
+Vector3 BatchedAnimation::GetPosition(Node* node) const
+{
+    auto it = entryIndices_.find(node);
+    const Entry* entry = it != entryIndices_.end() ? &entries_[it->second] : nullptr;
+    if (!entry || !entry->paused_ || !(entry->channels_ & CHANNEL_POSITION))
+        return node ? node->GetPosition() : Vector3::ZERO;
+
+    // The same spline as Channel::Evaluate(), for one node
+    const AnimationKeys& keys = entry->keys_;
+    const Vector3* values = keys.positions_.data();
+    const auto numKeys = (unsigned)keys.positions_.size();
+    unsigned k = 0;
+    const float t = FindSegment(keys.positionTimes_.data(), numKeys - 1, time_, k);
+    const bool closed = values[0] == values[numKeys - 1];
+    return Hermite(values[k], values[k + 1], GetCardinalTangent(values, numKeys, k, closed, keys.tension_),
+                   GetCardinalTangent(values, numKeys, k + 1, closed, keys.tension_), t);
+}
+
+void BatchedAnimation::Update(float timeStep)
+{
+    HiresTimer timer;
+
+    // Drop the nodes removed from the scene
+    for (const Entry& entry : entries_)
+    {
+        if (entry.node_.Expired() || !entry.node_->GetScene())
+        {
+            dirty_ = true;
+            break;
+        }
+    }
+    if (dirty_)
+        Rebuild();
+
+    time_ += timeStep;
+    Evaluate(position_);
+    Evaluate(yaw_);
+    Evaluate(color_);
+
+    for (unsigned i = 0; i < position_.entries_.size(); ++i)
+    {
+        entries_[position_.entries_[i]].node_->SetPosition(
+            Vector3(position_.start_[0][i], position_.start_[1][i], position_.start_[2][i]));
+    }
+    for (unsigned i = 0; i < yaw_.entries_.size(); ++i)
+        entries_[yaw_.entries_[i]].node_->SetRotation(Quaternion(yaw_.start_[0][i], Vector3::UP));
+    for (unsigned i = 0; i < color_.entries_.size(); ++i)
+    {
+        entries_[color_.entries_[i]].light_->SetColor(
+            Color(color_.start_[0][i], color_.start_[1][i], color_.start_[2][i]));
+    }
+    updateMs_ = timer.GetUSec(false) / 1000.0f;
+}
+
+void BatchedAnimation::OnSceneSet(Scene* scene)
+{
+    if (scene)
+        SubscribeToEvent(scene, E_SCENEUPDATE, URHO3D_HANDLER(BatchedAnimation, HandleSceneUpdate));
+    else
+        UnsubscribeFromEvent(E_SCENEUPDATE);
+}
+
+void BatchedAnimation::HandleSceneUpdate(StringHash eventType, VariantMap& eventData)
+{
+    using namespace SceneUpdate;
+
+    if (IsEnabledEffective())
+        Update(eventData[P_TIMESTEP].GetFloat());
+}
+
+void BatchedAnimation::AddToChannels(unsigned entry)
+{
+    const Entry& source = entries_[entry];
+    const AnimationKeys& keys = source.keys_;
+    if (source.channels_ & CHANNEL_POSITION)
+        position_.AddMember(entry, keys.positionTimes_, keys.positions_[0].Data(), 3, keys.tension_);
+    if (source.channels_ & CHANNEL_YAW)
+        yaw_.AddMember(entry, keys.yawTimes_, keys.yaws_.data(), 1, 0.0f);
+    if (source.channels_ & CHANNEL_COLOR)
+        color_.AddMember(entry, keys.colorTimes_, keys.colors_[0].Data(), 4, 0.0f);
+}
+
+void BatchedAnimation::Rebuild()
+{
+    entries_.erase(std::remove_if(entries_.begin(), entries_.end(),
+                                  [](const Entry& entry)
+                                  { return entry.node_.Expired() || !entry.node_->GetScene() || !entry.channels_; }),
+                   entries_.end());
+
+    entryIndices_.clear();
+    position_.Clear();
+    yaw_.Clear();
+    color_.Clear();
+    numPaused_ = 0;
+    for (unsigned i = 0; i < entries_.size(); ++i)
+    {
+        entryIndices_[entries_[i].node_.Get()] = i;
+        // Paused entries keep their keys but leave the channel arrays. The segment cursors restart from the first
+        // key, which the next evaluation walks forward from
+        if (entries_[i].paused_)
+            ++numPaused_;
+        else
+            AddToChannels(i);
+    }
+    dirty_ = false;
+}
+
+void BatchedAnimation::Evaluate(Channel& channel)
+{
+    const auto numMembers = (unsigned)channel.entries_.size();
+    auto* queue = GetSubsystem<WorkQueue>();
+    const unsigned numItems =
+        queue ? Min(queue->GetNumThreads() + 1, numMembers / MIN_MEMBERS_PER_ITEM) : 0;
+    if (numItems < 2)
+    {
+        channel.Evaluate(time_, 0, numMembers);
+        return;
+    }
+
+    // Members are independent, so each item takes a contiguous range; the main thread works on them too while waiting
+    const unsigned membersPerItem = (numMembers + numItems - 1) / numItems;
+    ranges_.resize(numItems);
+    for (unsigned i = 0; i < numItems; ++i)
+    {
+        ranges_[i] = Range{&channel, time_, i * membersPerItem, Min((i + 1) * membersPerItem, numMembers)};
+        SharedPtr<WorkItem> item = queue->GetFreeItem();
+        item->priority_ = M_MAX_UNSIGNED;
+        item->workFunction_ = EvaluateWork;
+        item->aux_ = &ranges_[i];
+        queue->AddWorkItem(item);
+    }
+    queue->Complete(M_MAX_UNSIGNED);
+}
+
+void BatchedAnimation::EvaluateWork(const WorkItem* item, unsigned threadIndex)
+{
+    const auto* range = static_cast<const Range*>(item->aux_);
+    range->channel_->Evaluate(range->time_, range->begin_, range->end_);
+}
+
+void BatchedAnimation::Channel::AddMember(unsigned entry, const std::vector<float>& times, const float* values,
+                                          unsigned stride, float tension)
+{
+    const auto first = (unsigned)times_.size();
+    const auto numKeys = (unsigned)times.size();
+    entries_.push_back(entry);
+    firstKey_.push_back(first);
+    numKeys_.push_back(numKeys);
+    cursor_.push_back(0);
+
+    times_.insert(times_.end(), times.begin(), times.end());
+    for (unsigned c = 0; c < numComponents_; ++c)
+    {
+        for (unsigned k = 0; k < numKeys; ++k)
+            values_[c].push_back(values[k * stride + c]);
+    }
+
+    if (spline_)
+    {
+        // A path is closed when every component ends where it starts
+        bool closed = true;
+        for (unsigned c = 0; c < numComponents_; ++c)
+            closed = closed && values_[c][first] == values_[c][first + numKeys - 1];
+        for (unsigned c = 0; c < numComponents_; ++c)
+        {
+            const float* v = &values_[c][first];
+            tangents_[c].resize(first + numKeys);
+            for (unsigned k = 0; k < numKeys; ++k)
+                tangents_[c][first + k] = GetCardinalTangent(v, numKeys, k, closed, tension);
+        }
+    }
+
+    const auto numMembers = (unsigned)entries_.size();
+    t_.resize(numMembers);
+    for (unsigned c = 0; c < numComponents_; ++c)
+    {
+        start_[c].resize(numMembers);
+        end_[c].resize(numMembers);
+        if (spline_)
+        {
+            startTangent_[c].resize(numMembers);
+            endTangent_[c].resize(numMembers);
+        }
+    }
+}
+
+void BatchedAnimation::Channel::Clear()
+{
+    entries_.clear();
+    firstKey_.clear();
+    numKeys_.clear();
+    cursor_.clear();
+    times_.clear();
+    for (unsigned c = 0; c < 3; ++c)
+    {
+        values_[c].clear();
+        tangents_[c].clear();
+    }
+}
+
+void BatchedAnimation::Channel::Evaluate(double time, unsigned begin, unsigned end)
+{
+    // Find the current segments. Time only moves forward, so a cursor advances by a few keys at most per update
+    // except when its loop wraps around
+    for (unsigned i = begin; i < end; ++i)
+    {
+        const unsigned first = firstKey_[i];
+        unsigned k = cursor_[i];
+        t_[i] = FindSegment(&times_[first], numKeys_[i] - 1, time, k);
+        cursor_[i] = k;
+
+        const unsigned a = first + k;
+        const unsigned b = a + 1;
+        for (unsigned c = 0; c < numComponents_; ++c)
+        {
+            start_[c][i] = values_[c][a];
+            end_[c][i] = values_[c][b];
+        }
+        if (spline_)
+        {
+            for (unsigned c = 0; c < numComponents_; ++c)
+            {
+                startTangent_[c][i] = tangents_[c][a];
+                endTangent_[c][i] = tangents_[c][b];
+            }
+        }
+    }
+
+    const float* t = t_.data();
+    for (unsigned c = 0; c < numComponents_; ++c)
+    {
+        float* p0 = start_[c].data();
+        const float* p1 = end_[c].data();
+        unsigned i = begin;
+        if (spline_)
+        {
+            // Hermite(), four members at a time where SSE is available
+            const float* m0 = startTangent_[c].data();
+            const float* m1 = endTangent_[c].data();
+#ifdef URHO3D_SSE
+            const __m128 one = _mm_set1_ps(1.0f);
+            const __m128 two = _mm_set1_ps(2.0f);
+            const __m128 three = _mm_set1_ps(3.0f);
+            for (; i + 4 <= end; i += 4)
+            {
+                const __m128 tv = _mm_loadu_ps(t + i);
+                const __m128 tt = _mm_mul_ps(tv, tv);
+                const __m128 ttt = _mm_mul_ps(tt, tv);
+                const __m128 h2 = _mm_sub_ps(_mm_mul_ps(three, tt), _mm_mul_ps(two, ttt));
+                const __m128 h1 = _mm_sub_ps(one, h2);
+                const __m128 h4 = _mm_sub_ps(ttt, tt);
+                const __m128 h3 = _mm_add_ps(_mm_sub_ps(h4, tt), tv);
+                __m128 result = _mm_mul_ps(h1, _mm_loadu_ps(p0 + i));
+                result = _mm_add_ps(result, _mm_mul_ps(h2, _mm_loadu_ps(p1 + i)));
+                result = _mm_add_ps(result, _mm_mul_ps(h3, _mm_loadu_ps(m0 + i)));
+                result = _mm_add_ps(result, _mm_mul_ps(h4, _mm_loadu_ps(m1 + i)));
+                _mm_storeu_ps(p0 + i, result);
+            }
+#endif
+            for (; i < end; ++i)
+                p0[i] = Hermite(p0[i], p1[i], m0[i], m1[i], t[i]);
+        }
+        else
+        {
+            for (; i < end; ++i)
+                p0[i] += (p1[i] - p0[i]) * t[i];
+        }
+    }
+}
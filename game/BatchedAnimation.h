@@ -0,0 +1,165 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#pragma once
+
+#include <Urho3D/Container/Ptr.h>
+#include <Urho3D/Math/Color.h>
+#include <Urho3D/Math/Vector3.h>
+#include <Urho3D/Scene/Component.h>
+#include <unordered_map>
+#include <vector>
+
+namespace Urho3D
+{
+class Light;
+struct WorkItem;
+} // namespace Urho3D
+
+/// Channels of a node animated by BatchedAnimation.
+enum AnimationChannel : unsigned
+{
+    /// Position along a closed cardinal spline.
+    CHANNEL_POSITION = 1,
+    /// Rotation about the Y axis in degrees, linearly interpolated.
+    CHANNEL_YAW = 2,
+    /// Colour of the node's light, linearly interpolated.
+    CHANNEL_COLOR = 4,
+};
+
+/// Key frames of one node. Each channel with at least two keys is animated and loops over its own duration; key
+/// times start at zero and increase.
+struct AnimationKeys
+{
+    std::vector<float> positionTimes_{};
+    std::vector<Urho3D::Vector3> positions_{};
+    /// Tension of the position spline.
+    float tension_{0.5f};
+    std::vector<float> yawTimes_{};
+    std::vector<float> yaws_{};
+    std::vector<float> colorTimes_{};
+    std::vector<Urho3D::Color> colors_{};
+};
+
+/// Animates many scene nodes in batches, replacing one ObjectAnimation per node. The key frames of every channel are
+/// kept in contiguous arrays of all nodes. Each scene update finds the current segment of each node, gathering the
+/// segment end points into scratch arrays, interpolates all of them in branch-free loops (with SSE where available),
+/// and writes the results directly to node transforms and light colours, without attribute reflection. Large batches
+/// are split across the WorkQueue threads. Nodes removed from the scene are dropped.
+class BatchedAnimation : public Urho3D::Component
+{
+    URHO3D_OBJECT(BatchedAnimation, Urho3D::Component);
+
+public:
+    /// Construct.
+    explicit BatchedAnimation(Urho3D::Context* context);
+    /// Register object factory.
+    static void RegisterObject(Urho3D::Context* context);
+
+    /// Start animating a node, replacing its previous animation.
+    void Add(Urho3D::Node* node, const AnimationKeys& keys);
+    /// Stop animating channels of a node, so that values set on them are kept.
+    void Stop(Urho3D::Node* node, unsigned channels);
+    /// Pause or resume a node. A paused node is not evaluated; animation time runs on regardless, so a resumed node
+    /// continues where it would have been had it not been paused.
+    void SetPaused(Urho3D::Node* node, bool paused);
+    /// Advance the animation and write the results to the nodes. Called on scene update.
+    void Update(float timeStep);
+
+    /// Return the number of animated nodes.
+    unsigned GetNumNodes() const { return (unsigned)entries_.size(); }
+    /// Return the number of paused nodes.
+    unsigned GetNumPaused() const { return numPaused_; }
+    /// Return whether a node is paused.
+    bool IsPaused(Urho3D::Node* node) const;
+    /// Return the position of a node at the current animation time. Evaluated on the spot for a paused node, whose
+    /// transform is not updated.
+    Urho3D::Vector3 GetPosition(Urho3D::Node* node) const;
+    /// Return the time the last update took in milliseconds.
+    float GetUpdateMs() const { return updateMs_; }
+
+protected:
+    /// Handle scene being assigned.
+    void OnSceneSet(Urho3D::Scene* scene) override;
+
+private:
+    /// Key frames and evaluation scratch of one channel for all nodes animating it.
+    struct Channel
+    {
+        /// Number of value components: 3 for positions and colours, 1 for yaw.
+        unsigned numComponents_{0};
+        /// Whether values are interpolated along a spline rather than linearly.
+        bool spline_{false};
+
+        /// Entry animated by each member.
+        std::vector<unsigned> entries_{};
+        /// First key, number of keys and current segment of each member.
+        std::vector<unsigned> firstKey_{};
+        std::vector<unsigned> numKeys_{};
+        std::vector<unsigned> cursor_{};
+
+        std::vector<float> times_{};
+        std::vector<float> values_[3]{};
+        std::vector<float> tangents_[3]{};
+
+        /// Per member: position within the current segment, its end points and tangents. The interpolated value
+        /// overwrites the start point.
+        std::vector<float> t_{};
+        std::vector<float> start_[3]{};
+        std::vector<float> end_[3]{};
+        std::vector<float> startTangent_[3]{};
+        std::vector<float> endTangent_[3]{};
+
+        /// Append a member. Tension is used by splines only.
+        void AddMember(unsigned entry, const std::vector<float>& times, const float* values, unsigned stride,
+                       float tension);
+        void Clear();
+        /// Find the segments and interpolate the members in a range.
+        void Evaluate(double time, unsigned begin, unsigned end);
+    };
+
+    /// Range of channel members evaluated by one work item.
+    struct Range
+    {
+        Channel* channel_;
+        double time_;
+        unsigned begin_;
+        unsigned end_;
+    };
+
+    struct Entry
+    {
+        Urho3D::WeakPtr<Urho3D::Node> node_{};
+        Urho3D::Light* light_{nullptr};
+        /// Channels still animated.
+        unsigned channels_{0};
+        /// Whether evaluation is paused.
+        bool paused_{false};
+        AnimationKeys keys_{};
+    };
+
+    /// Handle the scene update event.
+    void HandleSceneUpdate(Urho3D::StringHash eventType, Urho3D::VariantMap& eventData);
+    /// Add the channels of an entry to the channel arrays.
+    void AddToChannels(unsigned entry);
+    /// Rebuild the channel arrays after entries were removed, paused or resumed, or channels stopped.
+    void Rebuild();
+    /// Evaluate a channel, on the WorkQueue threads when it has enough members.
+    void Evaluate(Channel& channel);
+    /// Work function evaluating a Range.
+    static void EvaluateWork(const Urho3D::WorkItem* item, unsigned threadIndex);
+
+    std::vector<Entry> entries_{};
+    std::unordered_map<Urho3D::Node*, unsigned> entryIndices_{};
+    Channel position_{3, true};
+    Channel yaw_{1, false};
+    Channel color_{3, false};
+    /// Ranges handed to the work items of the current evaluation.
+    std::vector<Range> ranges_{};
+    /// Whether the channel arrays must be rebuilt before the next evaluation.
+    bool dirty_{false};
+    /// Animation time in seconds. Double, so that it keeps sub-frame precision over long sessions.
+    double time_{0.0};
+    unsigned numPaused_{0};
+    float updateMs_{0.0f};
+};
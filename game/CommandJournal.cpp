@@ -0,0 +1,480 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#include <Urho3D/IO/Log.h>
+
+#include "CommandJournal.h"
+
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <Urho3D/DebugNew.h>
+
+using namespace Urho3D;
+
+namespace
+{
+
+const char JOURNAL_MAGIC[4] = {'M', 'R', 'J', '1'};
+const char SNAPSHOT_MAGIC[4] = {'M', 'R', 'S', '1'};
+const uint32_t JOURNAL_VERSION = 1;
+/// Version 1 snapshots hold only whether each target is on; version 2 adds the parameters set on the targets.
+const uint32_t SNAPSHOT_VERSION = 2;
+
+/// Interval at which the I/O thread writes out appended records when the ring is not filling up.
+const std::chrono::milliseconds FLUSH_INTERVAL(10);
+/// Records written between snapshots.
+const uint64_t SNAPSHOT_INTERVAL = 65536;
+/// The journal is restarted after a snapshot once it holds this many records.
+const uint64_t ROTATE_RECORDS = 1u << 20;
+/// Records read at once during recovery.
+const size_t RECOVERY_CHUNK = 4096;
+
+struct JournalHeader
+{
+    char magic_[4];
+    uint32_t version_;
+    uint32_t recordSize_;
+    uint32_t reserved_;
+    uint64_t firstSequence_;
+};
+
+struct SnapshotHeader
+{
+    char magic_[4];
+    uint32_t version_;
+    uint32_t numTargets_;
+    uint32_t checksum_;
+    uint64_t sequence_;
+};
+
+/// FNV-1a.
+uint32_t ComputeChecksum(const void* data, size_t size, uint32_t hash = 2166136261u)
+{
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i)
+        hash = (hash ^ bytes[i]) * 16777619u;
+    return hash;
+}
+
+uint32_t ComputeChecksum(const CommandJournal::State& state)
+{
+    uint32_t hash = ComputeChecksum(state.targetOn_, sizeof(state.targetOn_));
+    hash = ComputeChecksum(state.paramsSet_, sizeof(state.paramsSet_), hash);
+    return ComputeChecksum(state.params_, sizeof(state.params_), hash);
+}
+
+uint32_t ComputeChecksum(const CommandJournal::Record& record)
+{
+    CommandJournal::Record copy = record;
+    copy.checksum_ = 0;
+    return ComputeChecksum(&copy, sizeof(copy));
+}
+
+void SyncFile(FILE* file)
+{
+    fflush(file);
+#ifdef _WIN32
+    _commit(_fileno(file));
+#elif defined(__linux__)
+    fdatasync(fileno(file));
+#else
+    fsync(fileno(file));
+#endif
+}
+
+int SeekFile(FILE* file, uint64_t offset)
+{
+#ifdef _WIN32
+    return _fseeki64(file, (long long)offset, SEEK_SET);
+#else
+    return fseeko(file, (off_t)offset, SEEK_SET);
+#endif
+}
+
+uint64_t GetFileSize(FILE* file)
+{
+#ifdef _WIN32
+    _fseeki64(file, 0, SEEK_END);
+    return (uint64_t)_ftelli64(file);
+#else
+    fseeko(file, 0, SEEK_END);
+    return (uint64_t)ftello(file);
+#endif
+}
+
+bool TruncateFile(const std::string& path, uint64_t size)
+{
+    FILE* file = fopen(path.c_str(), "r+b");
+    if (!file)
+        return false;
+#ifdef _WIN32
+    const bool success = _chsize_s(_fileno(file), (long long)size) == 0;
+#else
+    const bool success = ftruncate(fileno(file), (off_t)size) == 0;
+#endif
+    fclose(file);
+    return success;
+}
+
+/// Atomically replace a file with another.
+bool ReplaceFile(const std::string& from, const std::string& to)
+{
+#ifdef _WIN32
+    return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+/// Update a state with an operation on a target.
+void ApplyToState(CommandJournal::State& state, unsigned op, unsigned target, const float* params)
+{
+    if (target >= MAX_COMMAND_TARGETS)
+        return;
+    if (op == CMD_LIGHTON || op == CMD_LIGHTOFF)
+    {
+        // Turning a target on or off recreates or removes its nodes, which drops the parameters set on them
+        state.targetOn_[target] = op == CMD_LIGHTON;
+        memset(state.paramsSet_[target], 0, sizeof(state.paramsSet_[target]));
+    }
+    else if (op < MAX_COMMAND_OPS && state.targetOn_[target])
+    {
+        state.paramsSet_[target][op] = 1;
+        memcpy(state.params_[target][op], params, sizeof(state.params_[target][op]));
+    }
+}
+
+} // namespace
+
+uint32_t CommandJournal::State::GetLayoutHash()
+{
+    const uint32_t sizes[] = {VERSION, (uint32_t)sizeof(State), MAX_COMMAND_TARGETS, MAX_COMMAND_OPS,
+                              MAX_COMMAND_PARAMS};
+    uint32_t hash = ComputeChecksum(sizes, sizeof(sizes));
+    for (const char* name : COMMAND_TARGET_NAMES)
+        hash = ComputeChecksum(name, strlen(name) + 1, hash);
+    for (const char* name : COMMAND_OP_NAMES)
+        hash = ComputeChecksum(name, strlen(name) + 1, hash);
+    return hash;
+}
+
+void CommandJournal::State::Apply(const Record& record)
+{
+    sequence_ = record.sequence_;
+    ApplyToState(*this, record.op_, record.target_, record.payload_);
+}
+
+void CommandJournal::State::Apply(const RoomCommand& command)
+{
+    ApplyToState(*this, command.op_, command.target_, command.params_);
+}
+
+CommandJournal::~CommandJournal()
+{
+    Close();
+}
+
+bool CommandJournal::Open(const std::string& directory, State& recovered)
+{
+    journalPath_ = directory + "journal.bin";
+    snapshotPath_ = directory + "snapshot.bin";
+
+    const auto start = std::chrono::steady_clock::now();
+    Recover(recovered);
+    const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    URHO3D_LOGINFOF("Recovered command journal up to #%llu in %.3f ms", (unsigned long long)recovered.sequence_,
+                    elapsed);
+
+    sequence_ = recovered.sequence_;
+    writtenState_ = recovered;
+
+    // Keep appending to the existing journal when it continues where the recovered state ends
+    file_ = nullptr;
+    if (FILE* existing = fopen(journalPath_.c_str(), "rb"))
+    {
+        JournalHeader header{};
+        if (fread(&header, sizeof(header), 1, existing) == 1 && !memcmp(header.magic_, JOURNAL_MAGIC, 4) &&
+            header.version_ == JOURNAL_VERSION && header.recordSize_ == sizeof(Record))
+        {
+            numJournalRecords_ = (GetFileSize(existing) - sizeof(header)) / sizeof(Record);
+            if (header.firstSequence_ + numJournalRecords_ == sequence_ + 1)
+                file_ = fopen(journalPath_.c_str(), "ab");
+        }
+        fclose(existing);
+    }
+    if (!file_)
+    {
+        numJournalRecords_ = 0;
+        file_ = CreateJournalFile(journalPath_, sequence_ + 1);
+    }
+    if (!file_)
+    {
+        URHO3D_LOGERROR("Could not open command journal " + String(journalPath_.c_str()));
+        return false;
+    }
+
+    ring_ = std::make_unique<SpscRing<Record, RING_CAPACITY>>();
+    stopping_ = false;
+    writerThread_ = std::thread([this]() { WriterLoop(); });
+    return true;
+}
+
+void CommandJournal::Append(const RoomCommand& command)
+{
+    if (!ring_)
+        return;
+
+    Record record{};
+    record.sequence_ = ++sequence_;
+    record.timeUs_ = std::chrono::duration_cast<std::chrono::microseconds>(
+                         std::chrono::system_clock::now().time_since_epoch())
+                         .count();
+    record.op_ = command.op_;
+    record.target_ = command.target_;
+    memcpy(record.payload_, command.params_, sizeof(record.payload_));
+    record.checksum_ = ComputeChecksum(record);
+
+    // The ring only fills up if the disk stalls for a long time; never drop an applied command
+    while (!ring_->TryPush(record))
+    {
+        wakeCondition_.notify_one();
+        std::this_thread::yield();
+    }
+    if (ring_->Size() >= RING_CAPACITY / 2)
+        wakeCondition_.notify_one();
+}
+
+void CommandJournal::Close()
+{
+    if (!writerThread_.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex_);
+        stopping_ = true;
+    }
+    wakeCondition_.notify_one();
+    writerThread_.join();
+
+    if (file_)
+        fclose(file_);
+    file_ = nullptr;
+    ring_.reset();
+}
+
+void CommandJournal::Recover(State& state)
+{
+    state = State();
+
+    if (FILE* file = fopen(snapshotPath_.c_str(), "rb"))
+    {
+        SnapshotHeader header{};
+        State snapshot;
+        bool valid = fread(&header, sizeof(header), 1, file) == 1 && !memcmp(header.magic_, SNAPSHOT_MAGIC, 4) &&
+                     header.numTargets_ == MAX_COMMAND_TARGETS &&
+                     fread(snapshot.targetOn_, sizeof(snapshot.targetOn_), 1, file) == 1;
+        if (valid && header.version_ == 1)
+        {
+            valid = header.checksum_ == ComputeChecksum(snapshot.targetOn_, sizeof(snapshot.targetOn_));
+        }
+        else
+        {
+            valid = valid && header.version_ == SNAPSHOT_VERSION &&
+                    fread(snapshot.paramsSet_, sizeof(snapshot.paramsSet_), 1, file) == 1 &&
+                    fread(snapshot.params_, sizeof(snapshot.params_), 1, file) == 1 &&
+                    header.checksum_ == ComputeChecksum(snapshot);
+        }
+
+        if (valid)
+        {
+            snapshot.sequence_ = header.sequence_;
+            state = snapshot;
+        }
+        else
+        {
+            URHO3D_LOGWARNING("Ignoring invalid journal snapshot " + String(snapshotPath_.c_str()));
+        }
+        fclose(file);
+    }
+
+    FILE* file = fopen(journalPath_.c_str(), "rb");
+    if (!file)
+        return;
+
+    JournalHeader header{};
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic_, JOURNAL_MAGIC, 4) ||
+        header.version_ != JOURNAL_VERSION || header.recordSize_ != sizeof(Record))
+    {
+        URHO3D_LOGWARNING("Ignoring invalid command journal " + String(journalPath_.c_str()));
+        fclose(file);
+        return;
+    }
+    if (header.firstSequence_ > state.sequence_ + 1)
+    {
+        URHO3D_LOGWARNINGF("Command journal starts at #%llu but the snapshot ends at #%llu, commands are missing",
+                           (unsigned long long)header.firstSequence_, (unsigned long long)state.sequence_);
+        state.sequence_ = header.firstSequence_ - 1;
+    }
+
+    // Seek straight to the first record after the snapshot
+    uint64_t index = state.sequence_ + 1 - header.firstSequence_;
+    SeekFile(file, sizeof(header) + index * sizeof(Record));
+
+    std::vector<Record> chunk(RECOVERY_CHUNK);
+    bool torn = false;
+    size_t numRead;
+    while (!torn && (numRead = fread(chunk.data(), sizeof(Record), chunk.size(), file)) > 0)
+    {
+        for (size_t i = 0; i < numRead; ++i)
+        {
+            const Record& record = chunk[i];
+            if (record.sequence_ != state.sequence_ + 1 || record.checksum_ != ComputeChecksum(record))
+            {
+                torn = true;
+                break;
+            }
+            state.Apply(record);
+            ++index;
+        }
+    }
+    // A partial record at the end of the file is torn too
+    const uint64_t validSize = sizeof(header) + index * sizeof(Record);
+    const uint64_t fileSize = GetFileSize(file);
+    torn = torn || fileSize != validSize;
+    fclose(file);
+
+    if (validSize > fileSize)
+    {
+        // The snapshot is ahead of the whole journal. Truncating would pad the journal out to it with zeros, which the
+        // records appended next would sit behind; start a new journal after the snapshot instead
+        URHO3D_LOGWARNINGF("Command journal ends before the snapshot at #%llu, starting a new one",
+                           (unsigned long long)state.sequence_);
+        if (FILE* fresh = CreateJournalFile(journalPath_, state.sequence_ + 1))
+            fclose(fresh);
+    }
+    else if (torn)
+    {
+        URHO3D_LOGWARNINGF("Truncating command journal after #%llu", (unsigned long long)state.sequence_);
+        TruncateFile(journalPath_, validSize);
+    }
+}
+
+void CommandJournal::WriterLoop()
+{
+    std::vector<Record> batch;
+    batch.reserve(RING_CAPACITY);
+
+    std::unique_lock<std::mutex> lock(wakeMutex_);
+    for (;;)
+    {
+        wakeCondition_.wait_for(lock, FLUSH_INTERVAL,
+                                [this]() { return stopping_ || ring_->Size() >= RING_CAPACITY / 2; });
+        const bool stopping = stopping_;
+        lock.unlock();
+
+        // Group commit: one write and one sync for everything appended since the last wake up
+        Record record;
+        while (ring_->TryPop(record))
+        {
+            batch.push_back(record);
+        }
+        if (!batch.empty() && file_)
+        {
+            if (fwrite(batch.data(), sizeof(Record), batch.size(), file_) != batch.size())
+                URHO3D_LOGERROR("Failed to write command journal");
+            SyncFile(file_);
+
+            for (const Record& written : batch)
+            {
+                writtenState_.Apply(written);
+            }
+            numJournalRecords_ += batch.size();
+            numSinceSnapshot_ += batch.size();
+            batch.clear();
+        }
+
+        if (numSinceSnapshot_ >= SNAPSHOT_INTERVAL || (stopping && numSinceSnapshot_))
+        {
+            if (WriteSnapshot() && numJournalRecords_ >= ROTATE_RECORDS)
+                Rotate();
+        }
+
+        lock.lock();
+        if (stopping)
+            break;
+    }
+}
+
+bool CommandJournal::WriteSnapshot()
+{
+    // Write aside and rename, so a crash never leaves a half written snapshot
+    const std::string tempPath = snapshotPath_ + ".tmp";
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    if (!file)
+        return false;
+
+    SnapshotHeader header{};
+    memcpy(header.magic_, SNAPSHOT_MAGIC, 4);
+    header.version_ = SNAPSHOT_VERSION;
+    header.numTargets_ = MAX_COMMAND_TARGETS;
+    header.checksum_ = ComputeChecksum(writtenState_);
+    header.sequence_ = writtenState_.sequence_;
+    const bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                         fwrite(writtenState_.targetOn_, sizeof(writtenState_.targetOn_), 1, file) == 1 &&
+                         fwrite(writtenState_.paramsSet_, sizeof(writtenState_.paramsSet_), 1, file) == 1 &&
+                         fwrite(writtenState_.params_, sizeof(writtenState_.params_), 1, file) == 1;
+    SyncFile(file);
+    fclose(file);
+
+    if (!written || !ReplaceFile(tempPath, snapshotPath_))
+    {
+        URHO3D_LOGERROR("Failed to write journal snapshot");
+        return false;
+    }
+    numSinceSnapshot_ = 0;
+    return true;
+}
+
+bool CommandJournal::Rotate()
+{
+    // Everything written so far is covered by the snapshot just taken
+    const std::string tempPath = journalPath_ + ".tmp";
+    FILE* file = CreateJournalFile(tempPath, writtenState_.sequence_ + 1);
+    if (!file)
+        return false;
+    fclose(file);
+
+    fclose(file_);
+    const bool replaced = ReplaceFile(tempPath, journalPath_);
+    if (replaced)
+        numJournalRecords_ = 0;
+    else
+        URHO3D_LOGERROR("Failed to rotate command journal");
+    file_ = fopen(journalPath_.c_str(), "ab");
+    return replaced && file_;
+}
+
+FILE* CommandJournal::CreateJournalFile(const std::string& path, uint64_t firstSequence)
+{
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file)
+        return nullptr;
+
+    JournalHeader header{};
+    memcpy(header.magic_, JOURNAL_MAGIC, 4);
+    header.version_ = JOURNAL_VERSION;
+    header.recordSize_ = sizeof(Record);
+    header.firstSequence_ = firstSequence;
+    fwrite(&header, sizeof(header), 1, file);
+    SyncFile(file);
+    return file;
+}
@@ -0,0 +1,104 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#pragma once
+
+#include "RoomCommand.h"
+#include "SpscRing.h"
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/// Append-only journal of applied commands, used to restore the room after a restart.
+///
+/// The frame thread appends fixed-size records to a lock-free ring; an I/O thread drains the ring, writes the records
+/// in batches with one fsync per batch, and periodically writes a snapshot of the resulting state. Recovery loads the
+/// snapshot and replays only the records after it: records are fixed-size and numbered contiguously, so the first one
+/// to replay is found by arithmetic instead of by scanning the journal.
+class CommandJournal
+{
+public:
+    /// On-disk command record.
+    struct Record
+    {
+        uint64_t sequence_;
+        /// Wall clock time the command was applied, in microseconds since the epoch.
+        int64_t timeUs_;
+        uint8_t op_;
+        uint8_t target_;
+        uint16_t reserved_;
+        /// Checksum of the other fields, detects a torn write at the end of the journal.
+        uint32_t checksum_;
+        /// Command parameters.
+        float payload_[MAX_COMMAND_PARAMS];
+    };
+    static_assert(sizeof(Record) == 40, "Journal record layout changed");
+
+    /// State rebuilt from the journal: which targets are on and the parameters set on them since.
+    struct State
+    {
+        /// Sequence of the last command applied to the state.
+        uint64_t sequence_{0};
+        uint8_t targetOn_[MAX_COMMAND_TARGETS]{};
+        /// Whether a set operation was applied to a target since it was turned on.
+        uint8_t paramsSet_[MAX_COMMAND_TARGETS][MAX_COMMAND_OPS]{};
+        /// Parameters of the last set operation of each kind applied to a target.
+        float params_[MAX_COMMAND_TARGETS][MAX_COMMAND_OPS][MAX_COMMAND_PARAMS]{};
+
+        void Apply(const Record& record);
+        /// Apply a command as it is applied to the scene, without a sequence.
+        void Apply(const RoomCommand& command);
+
+        /// Version of the state, bumped when the meaning of its fields changes.
+        static const uint32_t VERSION = 1;
+        /// Return a hash of the state layout: the version, the sizes of the tables and the names of the targets and
+        /// operations in order. Builds with a different hash can not exchange the state as raw bytes.
+        static uint32_t GetLayoutHash();
+    };
+
+    /// Destruct. Flushes and closes the journal.
+    ~CommandJournal();
+
+    /// Recover the state from the journal in the directory, then open the journal for appending and start the I/O
+    /// thread. Return false if the journal can not be written.
+    bool Open(const std::string& directory, State& recovered);
+    /// Append an applied command. Frame thread only.
+    void Append(const RoomCommand& command);
+    /// Write out every appended command and a final snapshot, then stop the I/O thread.
+    void Close();
+
+private:
+    /// Load the snapshot and replay the journal tail into the state. Truncates a torn tail.
+    void Recover(State& state);
+    void WriterLoop();
+    /// Write the state of the I/O thread to the snapshot file. I/O thread only.
+    bool WriteSnapshot();
+    /// Start a new, empty journal after a snapshot. I/O thread only.
+    bool Rotate();
+    /// Create a journal file whose first record will have the given sequence.
+    FILE* CreateJournalFile(const std::string& path, uint64_t firstSequence);
+
+    static constexpr size_t RING_CAPACITY = 8192;
+
+    std::string journalPath_{};
+    std::string snapshotPath_{};
+    FILE* file_{nullptr};
+    /// Sequence of the last appended command. Frame thread only.
+    uint64_t sequence_{0};
+    /// State after the last written record. I/O thread only.
+    State writtenState_{};
+    /// Records in the current journal file. I/O thread only.
+    uint64_t numJournalRecords_{0};
+    /// Records written since the last snapshot. I/O thread only.
+    uint64_t numSinceSnapshot_{0};
+
+    std::unique_ptr<SpscRing<Record, RING_CAPACITY>> ring_{};
+    std::thread writerThread_{};
+    std::mutex wakeMutex_{};
+    std::condition_variable wakeCondition_{};
+    bool stopping_{false};
+};
@@ -0,0 +1,128 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#include "CommandMetrics.h"
+
+#include <cstdio>
+
+namespace
+{
+
+const char* const STAGE_NAMES[] = {"parse", "queue", "execute", "present", "total"};
+const char* const REJECTION_NAMES[] = {"rate_limited", "overloaded"};
+
+/// Bucket boundaries exposed to Prometheus, in seconds. The fine histogram buckets are folded into these.
+const double EXPORTED_BOUNDS[] = {1e-6, 5e-6, 1e-5, 5e-5, 1e-4, 5e-4, 1e-3, 2.5e-3, 5e-3, 0.01, 0.025,
+                                  0.05, 0.1,  0.25, 0.5,  1.0,  2.5,  5.0,  10.0};
+
+} // namespace
+
+void CommandMetrics::RecordCompleted(const RoomCommand& command)
+{
+    Record(command, STAGE_PARSE, command.time_.headersParsed_, command.time_.enqueued_);
+    Record(command, STAGE_QUEUE, command.time_.enqueued_, command.time_.dequeued_);
+    Record(command, STAGE_EXECUTE, command.time_.dequeued_, command.time_.completed_);
+}
+
+void CommandMetrics::RecordPresented(const RoomCommand& command, long long presentedNs)
+{
+    Record(command, STAGE_PRESENT, command.time_.completed_, presentedNs);
+    Record(command, STAGE_TOTAL, command.time_.headersParsed_, presentedNs);
+}
+
+void CommandMetrics::RecordElided(const RoomCommand& command)
+{
+    if (command.op_ < MAX_COMMAND_OPS && command.target_ < MAX_COMMAND_TARGETS)
+        elided_[command.op_][command.target_].fetch_add(1, std::memory_order_relaxed);
+}
+
+void CommandMetrics::Record(const RoomCommand& command, CommandStage stage, long long begin, long long end)
+{
+    // Commands that did not come through the http server have no header timestamp
+    if (command.op_ >= MAX_COMMAND_OPS || command.target_ >= MAX_COMMAND_TARGETS || !begin || !end)
+        return;
+    histograms_[command.op_][command.target_][stage].Record(end - begin);
+}
+
+std::string CommandMetrics::ToPrometheusText() const
+{
+    std::string text;
+    text += "# HELP myroom_command_latency_seconds Latency of /cmd commands by pipeline stage.\n";
+    text += "# TYPE myroom_command_latency_seconds histogram\n";
+
+    char line[256];
+    for (unsigned op = 0; op < MAX_COMMAND_OPS; ++op)
+    {
+        for (unsigned target = 0; target < MAX_COMMAND_TARGETS; ++target)
+        {
+            for (unsigned stage = 0; stage < MAX_COMMAND_STAGES; ++stage)
+            {
+                const LatencyHistogram& histogram = histograms_[op][target][stage];
+                if (!histogram.GetCount())
+                    continue;
+
+                char labels[128];
+                snprintf(labels, sizeof(labels), "cmd=\"%s\",target=\"%s\",stage=\"%s\"",
+                         GetCommandOpName((CommandOp)op), GetCommandTargetName((CommandTarget)target),
+                         STAGE_NAMES[stage]);
+
+                // Prometheus buckets are cumulative. A fine bucket is counted once its whole range is below the bound
+                uint64_t cumulative = 0;
+                unsigned bucket = 0;
+                for (double bound : EXPORTED_BOUNDS)
+                {
+                    const auto boundNs = (uint64_t)(bound * 1e9);
+                    while (bucket < LatencyHistogram::NUM_BUCKETS &&
+                           LatencyHistogram::GetBucketUpperBound(bucket) <= boundNs)
+                    {
+                        cumulative += histogram.GetBucketCount(bucket++);
+                    }
+                    snprintf(line, sizeof(line), "myroom_command_latency_seconds_bucket{%s,le=\"%g\"} %llu\n", labels,
+                             bound, (unsigned long long)cumulative);
+                    text += line;
+                }
+                // Derive the total from the buckets too, so it is consistent with them under concurrent recording
+                while (bucket < LatencyHistogram::NUM_BUCKETS)
+                {
+                    cumulative += histogram.GetBucketCount(bucket++);
+                }
+                snprintf(line, sizeof(line), "myroom_command_latency_seconds_bucket{%s,le=\"+Inf\"} %llu\n", labels,
+                         (unsigned long long)cumulative);
+                text += line;
+                snprintf(line, sizeof(line), "myroom_command_latency_seconds_sum{%s} %.9f\n", labels,
+                         histogram.GetSum() * 1e-9);
+                text += line;
+                snprintf(line, sizeof(line), "myroom_command_latency_seconds_count{%s} %llu\n", labels,
+                         (unsigned long long)cumulative);
+                text += line;
+            }
+        }
+    }
+
+    text += "# HELP myroom_commands_elided_total Commands dropped because a later command of the same frame superseded "
+            "them.\n";
+    text += "# TYPE myroom_commands_elided_total counter\n";
+    for (unsigned op = 0; op < MAX_COMMAND_OPS; ++op)
+    {
+        for (unsigned target = 0; target < MAX_COMMAND_TARGETS; ++target)
+        {
+            const uint64_t count = GetNumElided((CommandOp)op, (CommandTarget)target);
+            if (!count)
+                continue;
+            snprintf(line, sizeof(line), "myroom_commands_elided_total{cmd=\"%s\",target=\"%s\"} %llu\n",
+                     GetCommandOpName((CommandOp)op), GetCommandTargetName((CommandTarget)target),
+                     (unsigned long long)count);
+            text += line;
+        }
+    }
+
+    text += "# HELP myroom_commands_rejected_total Command requests turned away before their body was read.\n";
+    text += "# TYPE myroom_commands_rejected_total counter\n";
+    for (unsigned reason = 0; reason < MAX_COMMAND_REJECTIONS; ++reason)
+    {
+        snprintf(line, sizeof(line), "myroom_commands_rejected_total{reason=\"%s\"} %llu\n", REJECTION_NAMES[reason],
+                 (unsigned long long)GetNumRejected((CommandRejection)reason));
+        text += line;
+    }
+    return text;
+}
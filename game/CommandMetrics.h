@@ -0,0 +1,76 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#pragma once
+
+#include "LatencyHistogram.h"
+#include "RoomCommand.h"
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/// Segments of the command path measured by CommandMetrics.
+enum CommandStage : unsigned char
+{
+    /// Request headers parsed -> command pushed to the frame thread (body read and JSON parse).
+    STAGE_PARSE = 0,
+    /// Pushed -> picked up by HandleUpdate, including frames spent deferred.
+    STAGE_QUEUE,
+    /// Picked up -> applied to the scene.
+    STAGE_EXECUTE,
+    /// Applied -> end of the first frame rendered afterwards.
+    STAGE_PRESENT,
+    /// Request headers parsed -> end of the first frame rendered afterwards.
+    STAGE_TOTAL,
+    MAX_COMMAND_STAGES
+};
+
+/// Reasons for turning a command request away before reading it.
+enum CommandRejection : unsigned char
+{
+    /// The client exceeded its rate (429).
+    REJECT_RATE_LIMITED = 0,
+    /// The frame thread is behind on the queued commands (503).
+    REJECT_OVERLOADED,
+    MAX_COMMAND_REJECTIONS
+};
+
+/// End-to-end command latency histograms per operation, target and stage. Recording is lock-free and may happen from
+/// any thread.
+class CommandMetrics
+{
+public:
+    /// Record the stages up to the command being applied.
+    void RecordCompleted(const RoomCommand& command);
+    /// Record the stages ending with the first frame presented after the command was applied.
+    void RecordPresented(const RoomCommand& command, long long presentedNs);
+    /// Record a command dropped before running because a later command of the same frame superseded it.
+    void RecordElided(const RoomCommand& command);
+    /// Record a command request turned away.
+    void RecordRejected(CommandRejection reason) { rejected_[reason].fetch_add(1, std::memory_order_relaxed); }
+
+    /// Return the histogram of a stage.
+    const LatencyHistogram& GetHistogram(CommandOp op, CommandTarget target, CommandStage stage) const
+    {
+        return histograms_[op][target][stage];
+    }
+
+    /// Return the number of elided commands of an operation and target.
+    uint64_t GetNumElided(CommandOp op, CommandTarget target) const
+    {
+        return elided_[op][target].load(std::memory_order_relaxed);
+    }
+
+    /// Return the number of command requests turned away for a reason.
+    uint64_t GetNumRejected(CommandRejection reason) const { return rejected_[reason].load(std::memory_order_relaxed); }
+
+    /// Return all histograms and counters in Prometheus text exposition format.
+    std::string ToPrometheusText() const;
+
+private:
+    void Record(const RoomCommand& command, CommandStage stage, long long begin, long long end);
+
+    LatencyHistogram histograms_[MAX_COMMAND_OPS][MAX_COMMAND_TARGETS][MAX_COMMAND_STAGES];
+    std::atomic<uint64_t> elided_[MAX_COMMAND_OPS][MAX_COMMAND_TARGETS]{};
+    std::atomic<uint64_t> rejected_[MAX_COMMAND_REJECTIONS]{};
+};
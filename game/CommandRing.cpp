@@ -0,0 +1,216 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#include "CommandRing.h"
+
+#include <cstring>
+#include <new>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <Urho3D/DebugNew.h>
+
+constexpr char CommandRing::MAGIC[4];
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared memory indices must be lock-free");
+
+CommandRing::~CommandRing()
+{
+    Close();
+}
+
+bool CommandRing::Create(const std::string& name, unsigned capacity)
+{
+    Close();
+    unsigned roundedCapacity = 1;
+    while (roundedCapacity < capacity)
+        roundedCapacity <<= 1;
+
+    if (!Map(name, true, RECORDS_OFFSET + (size_t)roundedCapacity * sizeof(Record)))
+        return false;
+    owner_ = true;
+
+    // The object is zero-filled, so the indices start at 0
+    auto* header = reinterpret_cast<Header*>(data_);
+    memcpy(header->magic_, MAGIC, sizeof(MAGIC));
+    header->version_ = VERSION;
+    header->capacity_ = roundedCapacity;
+    header->recordSize_ = sizeof(Record);
+    new (data_ + HEAD_OFFSET) std::atomic<uint64_t>(0);
+    new (data_ + TAIL_OFFSET) std::atomic<uint64_t>(0);
+    new (data_ + REJECTED_OFFSET) std::atomic<uint64_t>(0);
+    return Attach();
+}
+
+bool CommandRing::Open(const std::string& name)
+{
+    Close();
+    if (!Map(name, false, 0) || !Attach())
+    {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+bool CommandRing::TryPush(const Record& record)
+{
+    const uint64_t head = head_->load(std::memory_order_relaxed);
+    if (head - tailCache_ == capacity_)
+    {
+        tailCache_ = tail_->load(std::memory_order_acquire);
+        if (head - tailCache_ == capacity_)
+            return false;
+    }
+    records_[head & (capacity_ - 1)] = record;
+    head_->store(head + 1, std::memory_order_release);
+    return true;
+}
+
+bool CommandRing::TryPop(Record& record)
+{
+    const uint64_t tail = tail_->load(std::memory_order_relaxed);
+    if (tail == headCache_)
+    {
+        headCache_ = head_->load(std::memory_order_acquire);
+        if (tail == headCache_)
+            return false;
+        // A producer that overran the tail is broken; drop what it wrote rather than read records twice
+        if (headCache_ - tail > capacity_)
+        {
+            tail_->store(headCache_, std::memory_order_release);
+            return false;
+        }
+    }
+    record = records_[tail & (capacity_ - 1)];
+    tail_->store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+std::string CommandRing::ToJSON() const
+{
+    return "{\"name\": \"" + name_ + "\", \"version\": " + std::to_string(VERSION) +
+           ", \"capacity\": " + std::to_string(capacity_) + ", \"recordSize\": " + std::to_string(sizeof(Record)) +
+           ", \"headOffset\": " + std::to_string(HEAD_OFFSET) + ", \"tailOffset\": " + std::to_string(TAIL_OFFSET) +
+           ", \"rejectedOffset\": " + std::to_string(REJECTED_OFFSET) +
+           ", \"recordsOffset\": " + std::to_string(RECORDS_OFFSET) +
+           ", \"rejected\": " + std::to_string(GetNumRejected()) + "}";
+}
+
+bool CommandRing::Map(const std::string& name, bool create, size_t size)
+{
+#ifdef _WIN32
+    HANDLE mapping;
+    if (create)
+    {
+        mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32),
+                                     (DWORD)size, name.c_str());
+        if (mapping && GetLastError() == ERROR_ALREADY_EXISTS)
+        {
+            CloseHandle(mapping);
+            return false;
+        }
+    }
+    else
+    {
+        mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+    }
+    if (!mapping)
+        return false;
+    void* view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    MEMORY_BASIC_INFORMATION info;
+    if (!view || !VirtualQuery(view, &info, sizeof(info)))
+    {
+        if (view)
+            UnmapViewOfFile(view);
+        CloseHandle(mapping);
+        return false;
+    }
+    mappingHandle_ = mapping;
+    data_ = static_cast<unsigned char*>(view);
+    size_ = create ? size : (size_t)info.RegionSize;
+#else
+    if (create)
+    {
+        // A name is only reused by a process with the same pid, after a crash left the object behind
+        shm_unlink(name.c_str());
+    }
+    const int fd = shm_open(name.c_str(), create ? O_RDWR | O_CREAT | O_EXCL : O_RDWR, S_IRUSR | S_IWUSR);
+    if (fd < 0)
+        return false;
+    struct stat fileStat;
+    bool sized = create ? ftruncate(fd, (off_t)size) == 0 : fstat(fd, &fileStat) == 0;
+    if (!create && sized)
+        size = (size_t)fileStat.st_size;
+    void* view = MAP_FAILED;
+    if (sized && size > 0)
+        view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    // The mapping keeps the object alive
+    close(fd);
+    if (view == MAP_FAILED)
+    {
+        if (create)
+            shm_unlink(name.c_str());
+        return false;
+    }
+    data_ = static_cast<unsigned char*>(view);
+    size_ = size;
+#endif
+    name_ = name;
+    return true;
+}
+
+bool CommandRing::Attach()
+{
+    if (size_ < RECORDS_OFFSET)
+        return false;
+    const auto* header = reinterpret_cast<const Header*>(data_);
+    if (memcmp(header->magic_, MAGIC, sizeof(MAGIC)) != 0 || header->version_ != VERSION ||
+        header->recordSize_ != sizeof(Record) || !header->capacity_ ||
+        (header->capacity_ & (header->capacity_ - 1)) != 0 ||
+        RECORDS_OFFSET + (uint64_t)header->capacity_ * sizeof(Record) > size_)
+        return false;
+
+    capacity_ = header->capacity_;
+    head_ = reinterpret_cast<std::atomic<uint64_t>*>(data_ + HEAD_OFFSET);
+    tail_ = reinterpret_cast<std::atomic<uint64_t>*>(data_ + TAIL_OFFSET);
+    rejected_ = reinterpret_cast<std::atomic<uint64_t>*>(data_ + REJECTED_OFFSET);
+    records_ = reinterpret_cast<Record*>(data_ + RECORDS_OFFSET);
+    headCache_ = head_->load(std::memory_order_acquire);
+    tailCache_ = tail_->load(std::memory_order_acquire);
+    return true;
+}
+
+void CommandRing::Close()
+{
+    if (data_)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(data_);
+        CloseHandle(mappingHandle_);
+        mappingHandle_ = nullptr;
+#else
+        munmap(data_, size_);
+        if (owner_)
+            shm_unlink(name_.c_str());
+#endif
+    }
+    name_.clear();
+    owner_ = false;
+    capacity_ = 0;
+    data_ = nullptr;
+    size_ = 0;
+    head_ = nullptr;
+    tail_ = nullptr;
+    rejected_ = nullptr;
+    records_ = nullptr;
+    headCache_ = 0;
+    tailCache_ = 0;
+}
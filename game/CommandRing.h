@@ -0,0 +1,113 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/// Single-producer single-consumer ring of fixed-size command records in named shared memory, for a controller process
+/// on the same host that streams commands faster than it could send requests. The producer writes the record at its
+/// head index and publishes the head with a release store; the consumer reads the records up to the head it acquires
+/// and publishes its tail. Each side caches the other's index like SpscRing, so neither pushing nor popping makes a
+/// system call. The consumer polls instead of waiting on a doorbell. Layout of the shared memory, little endian:
+///
+///     0    Header
+///     64   uint64 head, written by the producer
+///     128  uint64 tail, then uint64 number of rejected records, written by the consumer
+///     192  capacity records of 32 bytes
+class CommandRing
+{
+public:
+    /// Shared memory header.
+    struct Header
+    {
+        char magic_[4];
+        uint32_t version_;
+        /// Number of records, a power of two.
+        uint32_t capacity_;
+        uint32_t recordSize_;
+    };
+
+    /// Command record.
+    struct Record
+    {
+        /// Time the producer wrote the record, in nanoseconds of the steady clock (CLOCK_MONOTONIC on Linux), 0 if
+        /// unknown.
+        int64_t timeNs_;
+        /// CommandOp.
+        uint8_t op_;
+        /// CommandTarget.
+        uint8_t target_;
+        uint16_t reserved_;
+        /// As many parameters as the operation takes, the rest ignored.
+        float params_[4];
+        uint32_t reserved2_;
+    };
+    static_assert(sizeof(Record) == 32, "Command ring record layout changed");
+
+    static constexpr char MAGIC[4] = {'M', 'Y', 'C', 'R'};
+    static const uint32_t VERSION = 1;
+    static const size_t HEAD_OFFSET = 64;
+    static const size_t TAIL_OFFSET = 128;
+    static const size_t REJECTED_OFFSET = 136;
+    static const size_t RECORDS_OFFSET = 192;
+
+    /// Construct closed.
+    CommandRing() = default;
+    /// Unmap, and remove the shared memory object if this side created it.
+    ~CommandRing();
+    CommandRing(const CommandRing&) = delete;
+    CommandRing& operator=(const CommandRing&) = delete;
+
+    /// Create a shared memory object readable and writable by the current user only, and map it. Consumer side. The
+    /// capacity is rounded up to a power of two.
+    bool Create(const std::string& name, unsigned capacity);
+    /// Map a ring created by another process. Producer side.
+    bool Open(const std::string& name);
+
+    /// Write a record. Producer only. Return false if the ring is full.
+    bool TryPush(const Record& record);
+    /// Read a record. Consumer only. Return false if the ring is empty.
+    bool TryPop(Record& record);
+    /// Count a popped record the consumer could not use. Consumer only.
+    void AddRejected() { rejected_->store(rejected_->load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+
+    /// Return whether the ring is mapped.
+    bool IsOpen() const { return data_ != nullptr; }
+    /// Return the name of the shared memory object.
+    const std::string& GetName() const { return name_; }
+    /// Return the number of records.
+    unsigned GetCapacity() const { return capacity_; }
+    /// Return the number of records the consumer rejected.
+    uint64_t GetNumRejected() const { return rejected_ ? rejected_->load(std::memory_order_relaxed) : 0; }
+    /// Return the name, layout and capacity as JSON, for the producer to open the ring with.
+    std::string ToJSON() const;
+
+private:
+    /// Map a shared memory object of the given size.
+    bool Map(const std::string& name, bool create, size_t size);
+    /// Point at the indices and records of the mapping. Return false if the header does not describe a valid ring.
+    bool Attach();
+    /// Unmap and reset.
+    void Close();
+
+    std::string name_{};
+    /// Whether this side created the object, and removes it on close.
+    bool owner_{false};
+    unsigned capacity_{0};
+    unsigned char* data_{nullptr};
+    size_t size_{0};
+#ifdef _WIN32
+    void* mappingHandle_{nullptr};
+#endif
+    std::atomic<uint64_t>* head_{nullptr};
+    std::atomic<uint64_t>* tail_{nullptr};
+    std::atomic<uint64_t>* rejected_{nullptr};
+    Record* records_{nullptr};
+    /// This side's view of the other side's index.
+    uint64_t headCache_{0};
+    uint64_t tailCache_{0};
+};
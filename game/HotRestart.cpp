@@ -0,0 +1,355 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#include <Urho3D/IO/Log.h>
+
+#include "HotRestart.h"
+#include "UnixSocket.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include <Urho3D/DebugNew.h>
+
+using namespace Urho3D;
+
+namespace
+{
+
+const char HELLO_MAGIC[4] = {'M', 'R', 'H', 'R'};
+const uint32_t HELLO_VERSION = 2;
+/// Sent by the successor once it is ready to serve.
+const char READY_MESSAGE = 'R';
+/// Most listening sockets handed over at once.
+const unsigned MAX_SOCKETS = 8;
+/// Largest state accepted from the predecessor.
+const uint32_t MAX_STATE_SIZE = 1u << 20;
+/// Time the successor waits for the sockets after connecting.
+const int HELLO_TIMEOUT_MS = 5000;
+
+/// First message to the successor, carrying the listening sockets.
+struct Hello
+{
+    char magic_[4];
+    uint32_t version_;
+    /// Size of the state sent once the successor is ready, which differs between incompatible builds.
+    uint32_t stateSize_;
+    /// CommandJournal::State::GetLayoutHash() of the sender. The state is only restored by a build with the same.
+    uint32_t stateLayout_;
+    uint32_t numSockets_;
+};
+
+#ifndef _WIN32
+void SetReceiveTimeout(int sock, int timeoutMs)
+{
+    timeval tv;
+    tv.tv_sec = timeoutMs / 1000;
+    tv.tv_usec = (timeoutMs % 1000) * 1000;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+/// Return whether the process at the other end of a connection may take the sockets over: one running as the same user
+/// or as root.
+bool IsSuccessorAllowed(int connection)
+{
+#ifdef SO_PEERCRED
+    ucred credentials;
+    socklen_t length = sizeof(credentials);
+    if (getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &credentials, &length) != 0)
+        return false;
+    return credentials.uid == 0 || credentials.uid == geteuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    if (getpeereid(connection, &uid, &gid) != 0)
+        return false;
+    return uid == 0 || uid == geteuid();
+#endif
+}
+#endif
+
+} // namespace
+
+HotRestart::~HotRestart()
+{
+    Close();
+}
+
+#ifndef _WIN32
+
+bool HotRestart::Connect(const std::string& address)
+{
+    sockaddr_un addr;
+    socklen_t addrLength;
+    if (!GetUnixSocketAddress(address, addr, addrLength))
+        return false;
+    const int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        return false;
+    // Refused when no instance listens, or a stale socket file is left
+    if (connect(sock, reinterpret_cast<sockaddr*>(&addr), addrLength) != 0)
+    {
+        close(sock);
+        return false;
+    }
+
+    Hello hello{};
+    iovec iov{&hello, sizeof(hello)};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * MAX_SOCKETS)];
+    msghdr message{};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    SetReceiveTimeout(sock, HELLO_TIMEOUT_MS);
+    const ssize_t received = recvmsg(sock, &message, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+
+    sockets_.clear();
+    for (cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header))
+    {
+        if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+            continue;
+        const size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; ++i)
+        {
+            int fd;
+            memcpy(&fd, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+            sockets_.push_back(fd);
+        }
+    }
+
+    if (received != (ssize_t)sizeof(hello) || memcmp(hello.magic_, HELLO_MAGIC, sizeof(HELLO_MAGIC)) != 0 ||
+        hello.version_ != HELLO_VERSION || hello.numSockets_ != sockets_.size() || hello.stateSize_ > MAX_STATE_SIZE)
+    {
+        URHO3D_LOGERROR("Could not receive the listening sockets from the running instance");
+        for (int fd : sockets_)
+            close(fd);
+        sockets_.clear();
+        close(sock);
+        return false;
+    }
+    connection_ = sock;
+    stateSize_ = hello.stateSize_;
+    stateLayout_ = hello.stateLayout_;
+    return true;
+}
+
+bool HotRestart::ReceiveState(CommandJournal::State& state, int timeoutMs)
+{
+    if (connection_ < 0)
+        return false;
+
+    // Received whatever its layout, so that the predecessor has stopped, and closed the journal, on return
+    std::vector<char> received(stateSize_);
+    SetReceiveTimeout(connection_, timeoutMs);
+    bool success = send(connection_, &READY_MESSAGE, 1, MSG_NOSIGNAL) == 1 &&
+                   recv(connection_, received.data(), received.size(), MSG_WAITALL) == (ssize_t)received.size();
+    if (success && (received.size() != sizeof(state) || stateLayout_ != CommandJournal::State::GetLayoutHash()))
+    {
+        URHO3D_LOGWARNING("The running instance has a different state layout");
+        success = false;
+    }
+    if (success)
+        memcpy(&state, received.data(), sizeof(state));
+    close(connection_);
+    connection_ = -1;
+    return success;
+}
+
+bool HotRestart::Listen(const std::string& address, std::vector<int> sockets)
+{
+    sockaddr_un addr;
+    socklen_t addrLength;
+    if (sockets.size() > MAX_SOCKETS || !GetUnixSocketAddress(address, addr, addrLength))
+        return false;
+    listenSocket_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenSocket_ < 0)
+        return false;
+    if (bind(listenSocket_, reinterpret_cast<sockaddr*>(&addr), addrLength) != 0 || listen(listenSocket_, 1) != 0)
+    {
+        close(listenSocket_);
+        listenSocket_ = -1;
+        return false;
+    }
+    if (address[0] != '\0')
+        listenPath_ = address;
+
+    sockets_ = std::move(sockets);
+    closing_ = false;
+    successorReady_.store(false, std::memory_order_relaxed);
+    thread_ = std::thread([this] { ListenLoop(); });
+    return true;
+}
+
+bool HotRestart::SendState(const CommandJournal::State& state)
+{
+    // Free the address for the successor, which listens there next
+    StopListening();
+    if (connection_ < 0)
+        return false;
+
+    const bool success = send(connection_, &state, sizeof(state), MSG_NOSIGNAL) == (ssize_t)sizeof(state);
+    close(connection_);
+    connection_ = -1;
+    successorReady_.store(false, std::memory_order_relaxed);
+    return success;
+}
+
+void HotRestart::Close()
+{
+    StopListening();
+    if (connection_ >= 0)
+    {
+        close(connection_);
+        connection_ = -1;
+    }
+    successorReady_.store(false, std::memory_order_relaxed);
+}
+
+void HotRestart::ListenLoop()
+{
+    for (;;)
+    {
+        const int connection = accept4(listenSocket_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (connection < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            // Shut down by Close()
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (closing_)
+            {
+                close(connection);
+                return;
+            }
+            pendingConnection_ = connection;
+        }
+        const bool ready = HandOff(connection);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pendingConnection_ = -1;
+        }
+
+        if (ready)
+        {
+            connection_ = connection;
+            successorReady_.store(true, std::memory_order_release);
+            return;
+        }
+        // The successor failed to start. Keep serving and wait for another one
+        close(connection);
+    }
+}
+
+void HotRestart::StopListening()
+{
+    if (listenSocket_ < 0)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closing_ = true;
+        // Wakes the listener thread up, whether it waits for a successor to connect or to be ready
+        shutdown(listenSocket_, SHUT_RDWR);
+        if (pendingConnection_ >= 0)
+            shutdown(pendingConnection_, SHUT_RDWR);
+    }
+    thread_.join();
+    close(listenSocket_);
+    listenSocket_ = -1;
+    if (!listenPath_.empty())
+    {
+        unlink(listenPath_.c_str());
+        listenPath_.clear();
+    }
+}
+
+bool HotRestart::HandOff(int connection)
+{
+    if (!IsSuccessorAllowed(connection))
+    {
+        URHO3D_LOGWARNING("Refused to hand the listening sockets over to a process of another user");
+        return false;
+    }
+
+    Hello hello{};
+    memcpy(hello.magic_, HELLO_MAGIC, sizeof(HELLO_MAGIC));
+    hello.version_ = HELLO_VERSION;
+    hello.stateSize_ = sizeof(CommandJournal::State);
+    hello.stateLayout_ = CommandJournal::State::GetLayoutHash();
+    hello.numSockets_ = (uint32_t)sockets_.size();
+
+    iovec iov{&hello, sizeof(hello)};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * MAX_SOCKETS)]{};
+    msghdr message{};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    if (!sockets_.empty())
+    {
+        message.msg_control = control;
+        message.msg_controllen = CMSG_SPACE(sizeof(int) * sockets_.size());
+        cmsghdr* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int) * sockets_.size());
+        memcpy(CMSG_DATA(header), sockets_.data(), sizeof(int) * sockets_.size());
+    }
+    if (sendmsg(connection, &message, MSG_NOSIGNAL) != (ssize_t)sizeof(hello))
+        return false;
+
+    // The successor loads for as long as it takes, then reports ready. Disconnects if it fails to start
+    char ready = 0;
+    return recv(connection, &ready, 1, 0) == 1 && ready == READY_MESSAGE;
+}
+
+#else
+
+bool HotRestart::Connect(const std::string& address)
+{
+    return false;
+}
+
+bool HotRestart::ReceiveState(CommandJournal::State& state, int timeoutMs)
+{
+    return false;
+}
+
+bool HotRestart::Listen(const std::string& address, std::vector<int> sockets)
+{
+    return false;
+}
+
+bool HotRestart::SendState(const CommandJournal::State& state)
+{
+    return false;
+}
+
+void HotRestart::Close()
+{
+}
+
+void HotRestart::ListenLoop()
+{
+}
+
+void HotRestart::StopListening()
+{
+}
+
+bool HotRestart::HandOff(int connection)
+{
+    return false;
+}
+
+#endif
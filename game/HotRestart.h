@@ -0,0 +1,73 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#pragma once
+
+#include "CommandJournal.h"
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Hands the listening sockets and the room state of a running instance over to the instance replacing it, so that a
+/// deploy refuses no connection. Both listen for their successor on the same unix domain socket. The successor
+/// connects at startup and receives the listening sockets (as SCM_RIGHTS), which queue connections for both processes
+/// from then on. The predecessor keeps serving while the successor loads; when it reports ready, the predecessor stops
+/// accepting without shutting the sockets down, answers the requests in flight, applies the commands they queued and
+/// sends the resulting state, after which the successor starts accepting. Connections arriving in between wait in the
+/// listen backlog. Not supported on Windows, where every call fails.
+class HotRestart
+{
+public:
+    /// Destruct. Stops listening for a successor.
+    ~HotRestart();
+
+    /// Connect to the instance listening for a successor at a socket address and receive its listening sockets.
+    /// Return false if no instance is listening.
+    bool Connect(const std::string& address);
+    /// Return the listening sockets received from the predecessor. The caller takes them over.
+    const std::vector<int>& GetSockets() const { return sockets_; }
+    /// Tell the predecessor this instance is ready to serve and wait for the state once it has stopped. Return false
+    /// if it does not send it within the timeout, for instance because it exited.
+    bool ReceiveState(CommandJournal::State& state, int timeoutMs);
+
+    /// Listen for a successor at a socket address, and hand it the listening sockets when one connects. The sockets
+    /// remain owned by the caller. Return false if the address can not be listened on.
+    bool Listen(const std::string& address, std::vector<int> sockets);
+    /// Return whether a successor has the sockets and is ready to serve. The successor waits for SendState() then.
+    /// Thread safe.
+    bool IsSuccessorReady() const { return successorReady_.load(std::memory_order_acquire); }
+    /// Send the final state to the ready successor.
+    bool SendState(const CommandJournal::State& state);
+
+    /// Close the connection and stop listening.
+    void Close();
+
+private:
+    /// Accept successors until one is ready. Runs on the listener thread.
+    void ListenLoop();
+    /// Stop the listener thread and close the socket listening for a successor.
+    void StopListening();
+    /// Send the sockets to a successor and wait for it to be ready. Return false if it disconnects first.
+    bool HandOff(int connection);
+
+    /// Socket listening for a successor.
+    int listenSocket_{-1};
+    /// Socket file of listenSocket_, removed once it closes. Empty in the abstract namespace.
+    std::string listenPath_{};
+    /// Connection to the predecessor or to the ready successor.
+    int connection_{-1};
+    /// Size of the state the predecessor sends, which differs between incompatible builds.
+    uint32_t stateSize_{0};
+    /// Layout hash of the state the predecessor sends. A state of another layout is dropped for the journal.
+    uint32_t stateLayout_{0};
+    /// Connection of a successor being handed the sockets, shut down by Close().
+    int pendingConnection_{-1};
+    /// Set by Close() to stop the listener thread.
+    bool closing_{false};
+    std::mutex mutex_{};
+    std::thread thread_{};
+    std::atomic<bool> successorReady_{false};
+    std::vector<int> sockets_{};
+};
@@ -0,0 +1,280 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#include "httplib.h"
+
+#include "CommandRing.h"
+#include "HttpBenchmark.h"
+#include "LatencyHistogram.h"
+#include "RoomCommand.h"
+#include "UnixSocket.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <Urho3D/DebugNew.h>
+
+using namespace Urho3D;
+
+namespace
+{
+
+/// Transport and keep-alive settings of one benchmark run.
+struct BenchmarkCase
+{
+    const char* name_;
+    bool unixSocket_;
+    bool parking_;
+    size_t maxCount_;
+    bool ioUring_;
+};
+
+/// Worker threads of the server, fewer than the connections so that the connections compete for them.
+const unsigned NUM_WORKERS = 4;
+
+const BenchmarkCase CASES[] = {
+    {"tcp-parked", false, true, CPPHTTPLIB_KEEPALIVE_MAX_COUNT, false},
+    {"tcp-legacy", false, false, 5, false},
+    {"tcp-uring", false, true, CPPHTTPLIB_KEEPALIVE_MAX_COUNT, true},
+#ifndef _WIN32
+    {"uds-parked", true, true, CPPHTTPLIB_KEEPALIVE_MAX_COUNT, false},
+#endif
+};
+
+/// Endpoint of the benchmark's unix domain socket: in the abstract namespace where there is one, so that no file is
+/// left behind.
+#ifdef __linux__
+const char* const UNIX_SOCKET_ENDPOINT = "@myroom-http-benchmark";
+#else
+const char* const UNIX_SOCKET_ENDPOINT = "/tmp/myroom-http-benchmark.sock";
+#endif
+
+/// Shared memory ring measured against the http transports.
+#ifdef _WIN32
+const char* const RING_NAME = "Local\\myroom-http-benchmark";
+#else
+const char* const RING_NAME = "/myroom-http-benchmark";
+#endif
+const unsigned RING_CAPACITY = 1024;
+const unsigned RING_RECORDS = 100000;
+
+/// Iterations of each codec microbenchmark.
+const unsigned CODEC_ITERATIONS = 20000;
+/// Parameters in the long query string of the codec microbenchmark.
+const unsigned CODEC_QUERY_PARAMS = 200;
+
+long long GetNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+/// Run a function a number of times and return the mean nanoseconds per run. The function returns a size that is
+/// accumulated, so that its work is not optimized away.
+template <typename T> double TimeNs(unsigned numIterations, T function)
+{
+    volatile size_t sink = 0;
+    const long long startNs = GetNs();
+    for (unsigned i = 0; i < numIterations; ++i)
+        sink = sink + function();
+    return (double)(GetNs() - startNs) / numIterations;
+}
+
+} // namespace
+
+HttpBenchmark::HttpBenchmark(Context* context)
+    : Object(context)
+{
+}
+
+std::string HttpBenchmark::Run(unsigned numConnections, unsigned numRequests)
+{
+    std::string report = "{\"connections\": " + std::to_string(numConnections) +
+                         ", \"requestsPerConnection\": " + std::to_string(numRequests) + ", \"cases\": [";
+    for (unsigned i = 0; i < sizeof(CASES) / sizeof(CASES[0]); ++i)
+    {
+        const BenchmarkCase& benchmarkCase = CASES[i];
+        const std::string host = benchmarkCase.unixSocket_ ? GetUnixSocketAddress(UNIX_SOCKET_ENDPOINT) : "127.0.0.1";
+
+        httplib::Server server;
+        server.set_tcp_nodelay(true);
+        server.set_keep_alive_parking(benchmarkCase.parking_);
+        server.set_keep_alive_max_count(benchmarkCase.maxCount_);
+        server.set_io_uring(benchmarkCase.ioUring_);
+        server.set_count_syscalls(true);
+        server.new_task_queue = [] { return new httplib::ThreadPool(NUM_WORKERS); };
+        server.Get("/ping",
+                   [](const httplib::Request& req, httplib::Response& res) { res.set_content("pong", "text/plain"); });
+        int port;
+        if (benchmarkCase.unixSocket_)
+        {
+            server.set_address_family(AF_UNIX);
+            // The port does not apply to unix domain sockets
+            port = 80;
+            RemoveStaleSocketFile(host);
+            server.bind_to_port(host, port);
+        }
+        else
+        {
+            port = server.bind_to_any_port(host);
+        }
+        std::thread serverThread([&server] { server.listen_after_bind(); });
+        server.wait_until_ready();
+
+        LatencyHistogram first;
+        LatencyHistogram followUp;
+        std::atomic<unsigned> numFailed{0};
+        std::vector<std::thread> clients;
+        // Kept open until the server has stopped, so that stopping it closes idle connections
+        std::vector<std::unique_ptr<httplib::Client>> connections(numConnections);
+        const long long startNs = GetNs();
+        for (unsigned j = 0; j < numConnections; ++j)
+        {
+            clients.emplace_back(
+                [&, port, j]
+                {
+                    connections[j] = std::make_unique<httplib::Client>(host, port);
+                    httplib::Client& client = *connections[j];
+                    client.set_keep_alive(true);
+                    client.set_tcp_nodelay(true);
+                    if (benchmarkCase.unixSocket_)
+                    {
+                        client.set_address_family(AF_UNIX);
+                        // Instead of the socket address
+                        client.set_default_headers({{"Host", "localhost"}});
+                    }
+                    for (unsigned k = 0; k < numRequests; ++k)
+                    {
+                        const long long sentNs = GetNs();
+                        auto res = client.Get("/ping");
+                        if (!res || res->status != 200)
+                            ++numFailed;
+                        (k ? followUp : first).Record(GetNs() - sentNs);
+                    }
+                });
+        }
+        for (std::thread& client : clients)
+            client.join();
+        const double totalS = (GetNs() - startNs) / 1e9;
+
+        const long long stopNs = GetNs();
+        server.stop();
+        serverThread.join();
+        const double stopMs = (GetNs() - stopNs) / 1e6;
+        if (benchmarkCase.unixSocket_)
+            RemoveStaleSocketFile(host);
+
+        const unsigned long long numRequestsSent = first.GetCount() + followUp.GetCount();
+        char result[640];
+        snprintf(result, sizeof(result),
+                 "%s{\"case\": \"%s\", \"parking\": %s, \"maxCount\": %u, \"ioUring\": %s, \"failed\": %u, "
+                 "\"requestsPerSecond\": %.0f, \"syscallsPerRequest\": %.1f, \"firstP50Us\": %.1f, "
+                 "\"firstP99Us\": %.1f, \"followUpP50Us\": %.1f, \"followUpP99Us\": %.1f, \"stopMs\": %.1f}",
+                 i ? ", " : "", benchmarkCase.name_, benchmarkCase.parking_ ? "true" : "false",
+                 (unsigned)benchmarkCase.maxCount_, benchmarkCase.ioUring_ ? "true" : "false", numFailed.load(),
+                 numRequestsSent / totalS, (double)server.socket_syscall_count() / numRequestsSent,
+                 first.GetValueAtQuantile(0.5) / 1000.0, first.GetValueAtQuantile(0.99) / 1000.0,
+                 followUp.GetValueAtQuantile(0.5) / 1000.0, followUp.GetValueAtQuantile(0.99) / 1000.0, stopMs);
+        report += result;
+    }
+    report += "], \"ring\": " + RunRing(RING_RECORDS) + ", \"codec\": " + RunCodec(CODEC_ITERATIONS) + "}";
+    return report;
+}
+
+std::string HttpBenchmark::RunRing(unsigned numRecords)
+{
+    CommandRing consumer;
+    CommandRing producer;
+    if (!consumer.Create(RING_NAME, RING_CAPACITY) || !producer.Open(RING_NAME))
+        return "null";
+
+    LatencyHistogram push;
+    LatencyHistogram latency;
+    const long long startNs = GetNs();
+    std::thread consumerThread(
+        [&]
+        {
+            CommandRing::Record record;
+            for (unsigned i = 0; i < numRecords;)
+            {
+                if (consumer.TryPop(record))
+                {
+                    latency.Record(GetNs() - record.timeNs_);
+                    ++i;
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+
+    CommandRing::Record record{};
+    record.op_ = CMD_SETCOLOR;
+    record.target_ = TARGET_DISCO;
+    for (unsigned i = 0; i < numRecords; ++i)
+    {
+        record.params_[0] = (float)(i & 255) / 255.0f;
+        record.timeNs_ = GetNs();
+        while (!producer.TryPush(record))
+            std::this_thread::yield();
+        push.Record(GetNs() - record.timeNs_);
+    }
+    consumerThread.join();
+    const double totalS = (GetNs() - startNs) / 1e9;
+
+    char result[256];
+    snprintf(result, sizeof(result),
+             "{\"records\": %u, \"capacity\": %u, \"recordsPerSecond\": %.0f, \"pushP50Ns\": %llu, "
+             "\"pushP99Ns\": %llu, \"latencyP50Us\": %.1f, \"latencyP99Us\": %.1f}",
+             numRecords, consumer.GetCapacity(), numRecords / totalS, (unsigned long long)push.GetValueAtQuantile(0.5),
+             (unsigned long long)push.GetValueAtQuantile(0.99), latency.GetValueAtQuantile(0.5) / 1000.0,
+             latency.GetValueAtQuantile(0.99) / 1000.0);
+    return result;
+}
+
+std::string HttpBenchmark::RunCodec(unsigned numIterations)
+{
+    // A long query string of short parameters, every tenth with escapes
+    std::string query;
+    for (unsigned i = 0; i < CODEC_QUERY_PARAMS; ++i)
+    {
+        query += (i ? "&target" : "target") + std::to_string(i) + "=value_" + std::to_string(i * 7919);
+        if (i % 10 == 0)
+            query += "%20with+spaces";
+    }
+    // Every header value is percent-decoded, though few have escapes
+    const std::string userAgent =
+        "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36";
+    const std::string path = "/cmd/setcolor/disco?r=0.5&g=0.25&b=1.0&note=f%C3%BCr%20alle";
+
+    const double queryNs = TimeNs(numIterations,
+        [&]
+        {
+            httplib::Params params;
+            httplib::detail::parse_query_text(query, params);
+            return params.size();
+        });
+    const double headerNs = TimeNs(numIterations * 10,
+        [&]
+        {
+            std::string value = userAgent;
+            httplib::detail::decode_url_in_place(value, false);
+            return value.size();
+        });
+    const double encodeNs = TimeNs(numIterations, [&] { return httplib::detail::encode_url(path).size(); });
+    const double basicAuthNs = TimeNs(numIterations * 10,
+        [&] { return httplib::make_basic_authentication_header("controller", "correct horse battery").second.size(); });
+
+    char result[256];
+    snprintf(result, sizeof(result),
+             "{\"queryParams\": %u, \"queryBytes\": %u, \"queryParseNs\": %.0f, \"headerDecodeNs\": %.1f, "
+             "\"encodeUrlNs\": %.1f, \"basicAuthNs\": %.1f}",
+             CODEC_QUERY_PARAMS, (unsigned)query.size(), queryNs, headerNs, encodeNs, basicAuthNs);
+    return result;
+}
@@ -0,0 +1,35 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#pragma once
+
+#include <Urho3D/Core/Object.h>
+#include <string>
+
+/// Measures the latency and throughput of requests on kept-alive connections to an in-process http server: over
+/// loopback TCP with idle connections parked, over loopback TCP under the previous keep-alive policy (a worker waiting
+/// on each idle connection, at most 5 requests per connection), over loopback TCP with idle connections parked and
+/// sockets served through io_uring, and over a unix domain socket with idle connections parked. The server's socket
+/// system calls are reported per request, and the time to stop the server with the connections still open. The
+/// connections outnumber the server's workers. The first request of a connection includes connecting, so it is reported
+/// apart from requests 2..N. For comparison, commands are also streamed through a shared memory CommandRing. The
+/// server's per-request parsing and encoding (query strings, percent-decoded header values, basic authentication) is
+/// timed on its own. Used by the --headless --http-benchmark mode.
+class HttpBenchmark : public Urho3D::Object
+{
+    URHO3D_OBJECT(HttpBenchmark, Urho3D::Object);
+
+public:
+    /// Construct.
+    explicit HttpBenchmark(Urho3D::Context* context);
+
+    /// Send the given number of requests on each of several concurrent connections per policy and return the report
+    /// as JSON.
+    std::string Run(unsigned numConnections, unsigned numRequests);
+
+private:
+    /// Stream records through a CommandRing from one thread to another and return the report as JSON.
+    std::string RunRing(unsigned numRecords);
+    /// Time the url and base64 codecs of the http server on typical inputs and return the report as JSON.
+    std::string RunCodec(unsigned numIterations);
+};
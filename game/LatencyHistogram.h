@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/// Lock-free log-linear (HDR style) histogram of durations in nanoseconds. Every power of two range is split into
+/// SUB_BUCKETS linear sub-buckets, so a recorded value is off by less than 1 / SUB_BUCKETS. Recording is three relaxed
+/// atomic adds and may happen concurrently from any thread; readers see a slightly torn but monotonic view.
+class LatencyHistogram
+{
+public:
+    static constexpr unsigned SUB_BUCKET_BITS = 3;
+    static constexpr unsigned SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+    /// Values are clamped below 2^MAX_MAGNITUDE ns (about 18 minutes).
+    static constexpr unsigned MAX_MAGNITUDE = 40;
+    static constexpr unsigned NUM_BUCKETS = (MAX_MAGNITUDE - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    void Record(int64_t ns)
+    {
+        const uint64_t value = ns < 0 ? 0 : (uint64_t)ns;
+        buckets_[GetBucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    uint64_t GetCount() const { return count_.load(std::memory_order_relaxed); }
+    uint64_t GetSum() const { return sum_.load(std::memory_order_relaxed); }
+    uint64_t GetBucketCount(unsigned index) const { return buckets_[index].load(std::memory_order_relaxed); }
+
+    /// Return the largest value that falls into a bucket.
+    static uint64_t GetBucketUpperBound(unsigned index)
+    {
+        if (index < SUB_BUCKETS)
+            return index;
+        const unsigned shift = index / SUB_BUCKETS - 1;
+        const uint64_t lower = (uint64_t)(SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+        return lower + ((uint64_t)1 << shift) - 1;
+    }
+
+    /// Return the value below which the given fraction (0..1) of the samples fall, or 0 if empty.
+    uint64_t GetValueAtQuantile(double quantile) const
+    {
+        const uint64_t count = GetCount();
+        if (!count)
+            return 0;
+        auto rank = (uint64_t)(quantile * count + 0.5);
+        if (rank < 1)
+            rank = 1;
+        uint64_t seen = 0;
+        for (unsigned i = 0; i < NUM_BUCKETS; ++i)
+        {
+            seen += GetBucketCount(i);
+            if (seen >= rank)
+                return GetBucketUpperBound(i);
+        }
+        return GetBucketUpperBound(NUM_BUCKETS - 1);
+    }
+
+    /// Add the samples of another histogram to this one.
+    void Merge(const LatencyHistogram& other)
+    {
+        for (unsigned i = 0; i < NUM_BUCKETS; ++i)
+            buckets_[i].fetch_add(other.GetBucketCount(i), std::memory_order_relaxed);
+        count_.fetch_add(other.GetCount(), std::memory_order_relaxed);
+        sum_.fetch_add(other.GetSum(), std::memory_order_relaxed);
+    }
+
+    void Reset()
+    {
+        for (auto& bucket : buckets_)
+            bucket.store(0, std::memory_order_relaxed);
+        count_.store(0, std::memory_order_relaxed);
+        sum_.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    static unsigned GetBucketIndex(uint64_t value)
+    {
+        if (value < SUB_BUCKETS)
+            return (unsigned)value;
+        if (value >> MAX_MAGNITUDE)
+            value = ((uint64_t)1 << MAX_MAGNITUDE) - 1;
+        const unsigned shift = GetMostSignificantBit(value) - SUB_BUCKET_BITS;
+        return (shift + 1) * SUB_BUCKETS + (unsigned)(value >> shift) - SUB_BUCKETS;
+    }
+
+    static unsigned GetMostSignificantBit(uint64_t value)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return 63u - (unsigned)__builtin_clzll(value);
+#elif defined(_MSC_VER) && defined(_WIN64)
+        unsigned long index;
+        _BitScanReverse64(&index, value);
+        return (unsigned)index;
+#else
+        unsigned index = 0;
+        while (value >>= 1)
+            ++index;
+        return index;
+#endif
+    }
+
+    std::atomic<uint64_t> buckets_[NUM_BUCKETS]{};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_{0};
+};
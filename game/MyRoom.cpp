@@ -3,9 +3,13 @@
 
 #include "httplib.h"
 #include <Urho3D/Core/CoreEvents.h>
+#include <Urho3D/Core/ProcessUtils.h>
+#include <Urho3D/Core/Timer.h>
 #include <Urho3D/Engine/Engine.h>
+#include <Urho3D/Engine/EngineDefs.h>
 #include <Urho3D/Graphics/Camera.h>
 #include <Urho3D/Graphics/Graphics.h>
+#include <Urho3D/Graphics/Light.h>
 #include <Urho3D/Graphics/Material.h>
 #include <Urho3D/Graphics/Model.h>
 #include <Urho3D/Graphics/Octree.h>
@@ -13,71 +17,797 @@
 #include <Urho3D/Graphics/Skybox.h>
 #include <Urho3D/Graphics/StaticModel.h>
 #include <Urho3D/Graphics/Technique.h>
+#include <Urho3D/Graphics/Viewport.h>
 #include <Urho3D/Graphics/Zone.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/IO/FileSystem.h>
 #include <Urho3D/Input/Input.h>
 #include <Urho3D/Resource/ResourceCache.h>
-#include <Urho3D/Scene/ObjectAnimation.h>
+#include <Urho3D/Resource/XMLFile.h>
 #include <Urho3D/Scene/Scene.h>
-#include <Urho3D/Scene/ValueAnimation.h>
 #include <Urho3D/UI/Font.h>
 #include <Urho3D/UI/Sprite.h>
 #include <Urho3D/UI/Text.h>
 #include <Urho3D/UI/UI.h>
 
+#include "ActivationManager.h"
+#include "AnimationBenchmark.h"
+#include "BatchedAnimation.h"
+#include "CommandJournal.h"
+#include "CommandMetrics.h"
+#include "CommandRing.h"
+#include "HotRestart.h"
+#include "HttpBenchmark.h"
 #include "MyRoom.h"
+#include "PropField.h"
+#include "PropGenerator.h"
+#include "RateLimiter.h"
+#include "ReplayBenchmark.h"
+#include "ResourcePreloader.h"
+#include "RoomFile.h"
+#include "RoomLoader.h"
+#include "SceneBenchmark.h"
+#include "SceneMirror.h"
+#include "SceneProfiler.h"
+#include "UnixSocket.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
 
 #include <Urho3D/DebugNew.h>
 
 URHO3D_DEFINE_APPLICATION_MAIN(MyRoom)
 
+namespace
+{
+
+/// Resources fetched from the cache by the command handlers, listed per target. They are loaded in background during
+/// Start(), and a command is deferred until the resources of its target are available instead of blocking the frame.
+struct PreloadManifestEntry
+{
+    const char* target_;
+    const char* type_;
+    const char* name_;
+};
+
+const PreloadManifestEntry PRELOAD_MANIFEST[] = {
+    {"sun", "Model", "Models/Box.mdl"},
+    {"sun", "Material", "Materials/Skybox.xml"},
+    {"disco", "XMLFile", "RenderPaths/Deferred.xml"},
+    {"welcome", "Model", "Models/Box.mdl"},
+    {"welcome", "Texture2D", "Textures/welcome.png"},
+    {"welcome", "Technique", "Techniques/DiffNormal.xml"},
+};
+
+StringVector GetRequiredResources(const String& target)
+{
+    StringVector resources;
+    for (const auto& entry : PRELOAD_MANIFEST)
+    {
+        if (target == entry.target_)
+            resources.Push(entry.name_);
+    }
+    return resources;
+}
+
+/// Return the tag of the nodes of a target. The tags are constructed once so that looking up nodes does not allocate.
+const String& GetTargetTag(CommandTarget target)
+{
+    static const String tags[MAX_COMMAND_TARGETS] = {GetCommandTargetName(TARGET_SUN),
+                                                     GetCommandTargetName(TARGET_DISCO),
+                                                     GetCommandTargetName(TARGET_WELCOME)};
+    return tags[target];
+}
+
+/// Number of disco lights created by lighton.
+const unsigned NUM_DISCO_LIGHTS = 21;
+/// Maximum number of disco lights accepted by setcount.
+const unsigned MAX_DISCO_LIGHTS = 4096;
+/// Number of disco lights above which the viewport switches to deferred shading. Forward shading renders every lit
+/// object once more per light touching it (the floor is touched by all of them), while deferred shading draws one
+/// light volume per light. It switches back below half the threshold, so that counts around it do not flip-flop.
+const unsigned DEFERRED_SHADING_LIGHTS = 64;
+/// Tension of the disco light paths.
+const float DISCO_PATH_TENSION = 0.7f;
+/// Number of keys of a random disco light path, the last one returning to the first.
+const unsigned DISCO_PATH_KEYS = 21;
+
+/// Node counts and frames per count measured by --animation-benchmark.
+const std::vector<unsigned> ANIMATION_BENCHMARK_NODES = {10, 100, 1000, 10000};
+const unsigned ANIMATION_BENCHMARK_FRAMES = 300;
+
+/// Concurrent connections and requests per connection measured by --http-benchmark.
+const unsigned HTTP_BENCHMARK_CONNECTIONS = 16;
+const unsigned HTTP_BENCHMARK_REQUESTS = 200;
+
+/// Prop counts measured by --scene-benchmark.
+const std::vector<unsigned> SCENE_BENCHMARK_PROPS = {1000, 10000, 100000};
+
+/// Side of the square area the mushrooms are scattered over.
+const float PROP_AREA_SIZE = 90.0f;
+/// Side of the cells the mushrooms are culled by. About one cell per draw call at the default count of 200.
+const float PROP_CHUNK_SIZE = 10.0f;
+/// Distance beyond which mushroom chunks cast no shadows.
+const float PROP_SHADOW_DISTANCE = 60.0f;
+
+/// Name used by the set commands, constructed once for the same reason as the target tags.
+const String DIFFUSE_COLOR_PARAMETER("MatDiffColor");
+
+/// Read the numeric parameters of a command from a number or an array of numbers. Return false unless there are
+/// exactly as many as the command takes.
+bool ParseCommandParams(const JSONValue& value, unsigned numParams, float* params)
+{
+    if (value.IsNumber())
+    {
+        params[0] = value.GetFloat();
+        return numParams == 1;
+    }
+    if (!value.IsArray() || value.Size() != numParams)
+        return false;
+    for (unsigned i = 0; i < numParams; ++i)
+    {
+        if (!value[i].IsNumber())
+            return false;
+        params[i] = value[i].GetFloat();
+    }
+    return true;
+}
+
+/// Maximum number of concurrent GET /state/stream observers.
+const unsigned MAX_STATE_STREAMS = 16;
+
+/// TCP port of the http server.
+const int HTTP_PORT = 8888;
+
+/// Keep-alive policy of the http server. Idle connections are parked rather than holding a worker, so a command client
+/// may keep its connection for a long session.
+const size_t HTTP_KEEPALIVE_MAX_REQUESTS = 100000;
+const time_t HTTP_KEEPALIVE_TIMEOUT_SEC = 30;
+/// Time the http servers give the requests in flight to finish on exit before shutting their connections down.
+const int HTTP_DRAIN_TIMEOUT_MS = 250;
+/// Interval at which the accept loops of the http servers check whether they are handed off.
+const int HTTP_HANDOFF_POLL_MS = 20;
+/// Time a new instance waits for the one it replaces to stop and send the state, which includes answering the
+/// requests in flight.
+const int TAKEOVER_STATE_TIMEOUT_MS = 10000;
+
+/// Time the current request's headers were parsed, set by the pre-routing handler of the worker thread handling it.
+thread_local long long requestHeadersParsedNs = 0;
+
+/// Commands a client may send at once after being idle, on top of the sustained rate (--rate-limit).
+const unsigned COMMAND_RATE_BURST = 250;
+/// Number of tasks queued for the frame thread at which command requests are turned away until it catches up.
+const size_t COMMAND_QUEUE_WATERMARK = 4096;
+/// Retry-After of a request turned away because the frame thread is behind. A frame or two would do; http counts in
+/// seconds.
+const int OVERLOADED_RETRY_AFTER_SEC = 1;
+
+/// Return the rate limiting key of the client of a request: the peer process on the unix domain socket, where the port
+/// holds its pid, or else the remote address, whatever the connection.
+uint64_t GetClientKey(const httplib::Request& req)
+{
+    if (req.remote_addr.empty())
+        return (uint64_t)(unsigned)req.remote_port * 0x9e3779b97f4a7c15ull;
+    return std::hash<std::string>()(req.remote_addr);
+}
+
+/// Remove the listening socket bound to an address from the sockets taken over from the predecessor and return it, or
+/// -1 if there is none. TCP sockets match by port, unix domain sockets by address.
+int TakeInheritedSocket(std::vector<int>& sockets, int family, const std::string& address, int port)
+{
+#ifndef _WIN32
+    for (auto i = sockets.begin(); i != sockets.end(); ++i)
+    {
+        sockaddr_storage addr;
+        socklen_t length = sizeof(addr);
+        if (getsockname(*i, reinterpret_cast<sockaddr*>(&addr), &length) != 0 || addr.ss_family != family)
+            continue;
+        bool matches;
+        if (family == AF_UNIX)
+        {
+            // A path includes its terminating zero, a name in the abstract namespace does not
+            const auto& unixAddr = reinterpret_cast<const sockaddr_un&>(addr);
+            std::string name(unixAddr.sun_path, length - offsetof(sockaddr_un, sun_path));
+            if (!name.empty() && name[0] != '\0')
+                name = name.c_str();
+            matches = name == address;
+        }
+        else
+        {
+            matches = ntohs(reinterpret_cast<const sockaddr_in&>(addr).sin_port) == port;
+        }
+        if (matches)
+        {
+            const int sock = *i;
+            sockets.erase(i);
+            return sock;
+        }
+    }
+#endif
+    return -1;
+}
+
+/// Number of records of the shared memory command ring.
+const unsigned COMMAND_RING_CAPACITY = 1024;
+/// Time after which the producer lease of the command ring lapses, unless renewed or records arrive meanwhile.
+const long long COMMAND_RING_LEASE_NS = 30000000000LL;
+
+/// Return the name of the shared memory command ring, unique per process.
+std::string GetCommandRingName()
+{
+#ifdef _WIN32
+    return "Local\\myroom-cmd-" + std::to_string(_getpid());
+#else
+    return "/myroom-cmd-" + std::to_string(getpid());
+#endif
+}
+
+/// Convert a command ring record. Return false unless it names a known operation and target and has finite
+/// parameters.
+bool ParseCommandRecord(const CommandRing::Record& record, RoomCommand& command)
+{
+    if (record.op_ >= MAX_COMMAND_OPS || record.target_ >= MAX_COMMAND_TARGETS)
+        return false;
+    command.op_ = static_cast<CommandOp>(record.op_);
+    command.target_ = static_cast<CommandTarget>(record.target_);
+    for (unsigned i = 0; i < GetCommandNumParams(command.op_); ++i)
+    {
+        if (!std::isfinite(record.params_[i]))
+            return false;
+        command.params_[i] = record.params_[i];
+    }
+    // Count the time spent in the ring when the producer stamped the record
+    const long long now = GetCommandTimeNs();
+    command.time_.headersParsed_ = record.timeNs_ > 0 && record.timeNs_ <= now ? record.timeNs_ : now;
+    command.time_.enqueued_ = command.time_.headersParsed_;
+    return true;
+}
+
+/// Return whether the sender of a request may use the server. Peers on the unix domain socket are identified by their
+/// credentials and must run as the same user as the room, or as root; TCP peers carry none.
+bool IsPeerAllowed(const httplib::Request& req)
+{
+#ifndef _WIN32
+    return req.remote_uid < 0 || req.remote_uid == 0 || (uid_t)req.remote_uid == geteuid();
+#else
+    return true;
+#endif
+}
+
+} // namespace
+
 MyRoom::MyRoom(Context* context)
     : Sample(context)
+    , commandMetrics_(std::make_unique<CommandMetrics>())
+    , sceneMirror_(std::make_unique<SceneMirror>())
 {
 }
 
 MyRoom::~MyRoom()
 {
-    httpServer_->stop();
-    if (httpServerThread_.joinable())
+    // In case Stop() did not run
+    hotRestart_.reset();
+    StopHttpServers(takingOver_);
+    // Write out the journal only once no more commands can arrive
+    journal_.reset();
+}
+
+void MyRoom::Stop()
+{
+    // Stop listening for a successor first, so that none takes over sockets about to close. While taking over, the
+    // predecessor keeps serving on the sockets
+    hotRestart_.reset();
+    StopHttpServers(takingOver_);
+    // Apply the commands the servers queued before they stopped, so that every command answered is journaled
+    if (preloader_)
+        RunFrameTasks();
+    Sample::Stop();
+}
+
+void MyRoom::Setup()
+{
+    Sample::Setup();
+
+    // The engine ignores double-dash options, so they do not clash with its own
+    const StringVector& arguments = GetArguments();
+    for (unsigned i = 0; i < arguments.Size(); ++i)
     {
-        httpServerThread_.join();
+        if (arguments[i] == "--headless")
+            headless_ = true;
+        else if (arguments[i] == "--replay" && i + 1 < arguments.Size())
+            replayFile_ = arguments[++i];
+        else if (arguments[i] == "--report" && i + 1 < arguments.Size())
+            reportFile_ = arguments[++i];
+        else if (arguments[i] == "--journal" && i + 1 < arguments.Size())
+            journalDir_ = arguments[++i];
+        else if (arguments[i] == "--no-journal")
+            journalEnabled_ = false;
+        else if (arguments[i] == "--animation-benchmark")
+            animationBenchmark_ = true;
+        else if (arguments[i] == "--props" && i + 1 < arguments.Size())
+            numProps_ = ToUInt(arguments[++i]);
+        else if (arguments[i] == "--seed" && i + 1 < arguments.Size())
+            seed_ = ToUInt(arguments[++i]);
+        else if (arguments[i] == "--scene-benchmark")
+            sceneBenchmark_ = true;
+        else if (arguments[i] == "--http-benchmark")
+            httpBenchmark_ = true;
+        else if (arguments[i] == "--room" && i + 1 < arguments.Size())
+            roomFile_ = arguments[++i];
+        else if (arguments[i] == "--export-room" && i + 1 < arguments.Size())
+            exportRoomFile_ = arguments[++i];
+        else if (arguments[i] == "--uds" && i + 1 < arguments.Size())
+            unixSocket_ = arguments[++i];
+        else if (arguments[i] == "--restart-socket" && i + 1 < arguments.Size())
+            restartSocket_ = arguments[++i];
+        else if (arguments[i] == "--no-tcp")
+            httpTcpEnabled_ = false;
+        else if (arguments[i] == "--io-uring")
+            httpIoUring_ = true;
+        else if (arguments[i] == "--rate-limit" && i + 1 < arguments.Size())
+            commandRateLimit_ = ToFloat(arguments[++i]);
+        else if (arguments[i] == "--activation-radius" && i + 1 < arguments.Size())
+            activationRadius_ = ToFloat(arguments[++i]);
     }
+
+    // The disco light paths follow the seed too, so that the whole room is reproducible
+    discoRandom_.seed(seed_);
+
+    // Sample::Setup() forces windowed mode
+    if (headless_)
+        engineParameters_[EP_HEADLESS] = true;
 }
 
 void MyRoom::Start()
 {
-    // Execute base class startup
-    Sample::Start();
+    // Execute base class startup. It sets up the window, logo and console, none of which exist when headless
+    if (!headless_)
+        Sample::Start();
+
+    BatchedAnimation::RegisterObject(context_);
+    PropField::RegisterObject(context_);
+
+    if (animationBenchmark_)
+    {
+        WriteReport(AnimationBenchmark(context_).Run(ANIMATION_BENCHMARK_NODES, ANIMATION_BENCHMARK_FRAMES));
+        engine_->Exit();
+        return;
+    }
+    if (sceneBenchmark_)
+    {
+        WriteReport(SceneBenchmark(context_).Run(SCENE_BENCHMARK_PROPS, seed_));
+        engine_->Exit();
+        return;
+    }
+    if (httpBenchmark_)
+    {
+        WriteReport(HttpBenchmark(context_).Run(HTTP_BENCHMARK_CONNECTIONS, HTTP_BENCHMARK_REQUESTS));
+        engine_->Exit();
+        return;
+    }
 
     // Create the UI content
     CreateInstructions();
 
-    CreateHttpServer();
+    // Start loading command resources before accepting commands, so the first command does not hitch
+    PreloadResources();
+
+    // Sample the cost of every frame, queryable over http
+    sceneProfiler_ = new SceneProfiler(context_);
+
+    // A replay drives the room in-process and an export only writes a file, do not compete for the port with a
+    // running instance
+    const bool serving = replayFile_.Empty() && exportRoomFile_.Empty();
+
+    // Take the listening sockets over from the instance this one replaces, if it listens for a successor
+    if (serving && !restartSocket_.Empty())
+    {
+        hotRestart_ = std::make_unique<HotRestart>();
+        takingOver_ = hotRestart_->Connect(GetUnixSocketAddress(restartSocket_.CString()));
+        if (!takingOver_)
+            hotRestart_.reset();
+    }
+
+    // Restore the targets that were on before a restart. A replay only persists state when asked to. The instance
+    // being taken over still journals; its state is restored once it stops
+    if (!takingOver_)
+    {
+        CommandJournal::State state;
+        if (journalEnabled_ && (replayFile_.Empty() || !journalDir_.Empty()))
+            OpenJournal(state);
+        RestoreState(state);
+    }
+
+    if (serving)
+        CreateHttpServers();
 
     // Create the scene content
     CreateScene();
+    sceneProfiler_->SetScene(scene_);
 
-    // Setup the viewport for displaying the scene
-    SetupViewport();
+    // Pause the disco lights the camera can not see
+    activationManager_ = new ActivationManager(context_);
+    activationManager_->SetScene(scene_, cameraNode_->GetComponent<Camera>(), animation_);
+    activationManager_->SetTag(GetTargetTag(TARGET_DISCO));
+    activationManager_->SetRadius(activationRadius_);
+
+    // A room file streams in over the first frames and is exported from HandleUpdate() once complete
+    if (!exportRoomFile_.Empty() && !roomLoader_)
+    {
+        ExportRoom();
+        return;
+    }
+
+    if (!replayFile_.Empty())
+    {
+        StartReplay();
+    }
+
+    if (!headless_)
+    {
+        // Setup the viewport for displaying the scene
+        SetupViewport();
+    }
 
     // Hook up to the frame update events
     SubscribeToEvents();
 
-    // Set the mouse mode to use in the sample
-    Sample::InitMouseMode(MM_RELATIVE);
+    if (!headless_)
+    {
+        // Set the mouse mode to use in the sample
+        Sample::InitMouseMode(MM_RELATIVE);
+    }
+}
+
+void MyRoom::StartReplay()
+{
+    replay_ = new ReplayBenchmark(context_);
+    if (!replay_->Load(replayFile_))
+    {
+        ErrorExit("Could not load replay file " + replayFile_);
+        return;
+    }
+
+    replay_->SetInjector(
+        [this](const std::string& body)
+        {
+            // Same path as a request arriving over http, minus the socket
+            httplib::Request req;
+            req.body = body;
+            httplib::Response res;
+            requestHeadersParsedNs = GetCommandTimeNs();
+            OnHttpRequest(req, res);
+        });
+}
+
+void MyRoom::FinishReplay()
+{
+    const std::string report = replay_->MakeReport(*commandMetrics_);
+    URHO3D_LOGINFO("Replay finished: " + String(report.c_str()));
+    WriteReport(report);
+
+    replay_.Reset();
+    engine_->Exit();
+}
+
+void MyRoom::WriteReport(const std::string& report)
+{
+    if (!reportFile_.Empty())
+    {
+        File file(context_, reportFile_, FILE_WRITE);
+        file.Write(report.data(), (unsigned)report.size());
+    }
+    else
+    {
+        PrintLine(report.c_str());
+    }
 }
 
-void MyRoom::CreateHttpServer()
+std::unique_ptr<httplib::Server> MyRoom::CreateHttpServer()
 {
-    httpServerThread_ = std::thread(
-        [this]()
+    auto server = std::make_unique<httplib::Server>();
+    // State streams hold a worker each for as long as they are watched
+    server->new_task_queue = []
+    { return new httplib::ThreadPool(Max((unsigned)CPPHTTPLIB_THREAD_POOL_COUNT, MAX_STATE_STREAMS * 2)); };
+    server->set_keep_alive_max_count(HTTP_KEEPALIVE_MAX_REQUESTS);
+    server->set_keep_alive_timeout(HTTP_KEEPALIVE_TIMEOUT_SEC);
+    server->set_drain_timeout(std::chrono::milliseconds(HTTP_DRAIN_TIMEOUT_MS));
+    // Handing off can not wake the accept loop up by shutting the shared listening socket down
+    if (!restartSocket_.Empty())
+        server->set_idle_interval(std::chrono::milliseconds(HTTP_HANDOFF_POLL_MS));
+    // Falls back to plain socket calls where the kernel lacks io_uring or an operation it needs
+    server->set_io_uring(httpIoUring_);
+    server->set_pre_routing_handler(
+        [this](const httplib::Request& req, httplib::Response& res)
         {
-            httpServer_ = std::make_unique<httplib::Server>();
-            httpServer_->Post("/cmd",
-                              [this](const httplib::Request& req, httplib::Response& res) { OnHttpRequest(req, res); });
-            httpServer_->listen("0.0.0.0", 8888);
-            httpServer_ = nullptr;
+            // Runs on the worker thread right after the headers are parsed, before the body is read
+            requestHeadersParsedNs = GetCommandTimeNs();
+            if (!IsPeerAllowed(req))
+            {
+                res.status = 403;
+                return httplib::Server::HandlerResponse::Handled;
+            }
+            // Queries are cheap and do not reach the frame thread; POSTs queue work for it
+            if (req.method == "POST" && !AdmitCommandRequest(req, res))
+                return httplib::Server::HandlerResponse::Handled;
+            return httplib::Server::HandlerResponse::Unhandled;
         });
+    server->Post("/cmd",
+                 [this](const httplib::Request& req, httplib::Response& res) { OnHttpRequest(req, res); });
+    server->Post("/cmd/ring",
+                 [this](const httplib::Request& req, httplib::Response& res) { HandleCommandRingRequest(req, res); });
+    server->Delete("/cmd/ring", [this](const httplib::Request& req, httplib::Response& res)
+                   { HandleCommandRingRelease(req, res); });
+    server->Get("/ready",
+                [this](const httplib::Request& req, httplib::Response& res)
+                {
+                    const bool ready = preloader_->IsReady();
+                    res.set_header("content-type", "application/json");
+                    res.status = ready ? 200 : 503;
+                    res.body = "{\"ready\": " + std::string(ready ? "true" : "false") +
+                               ", \"loaded\": " + std::to_string(preloader_->GetNumLoaded()) +
+                               ", \"failed\": " + std::to_string(preloader_->GetNumFailed()) +
+                               ", \"total\": " + std::to_string(preloader_->GetNumTotal()) + "}";
+                });
+    server->Get("/metrics",
+                [this](const httplib::Request& req, httplib::Response& res)
+                {
+                    res.set_content(commandMetrics_->ToPrometheusText(),
+                                    "text/plain; version=0.0.4; charset=utf-8");
+                });
+    server->Get("/state",
+                [this](const httplib::Request& req, httplib::Response& res)
+                {
+                    res.set_content(RoomStatePublisher::ToJSON(statePublisher_.GetState()),
+                                    "application/json");
+                });
+    server->Get("/state/stream",
+                [this](const httplib::Request& req, httplib::Response& res) { StreamState(res); });
+    server->Post("/scene/load", [this](const httplib::Request& req, httplib::Response& res)
+                 { HandleLoadRoomRequest(req, res); });
+    server->Get("/scene",
+                [this](const httplib::Request& req, httplib::Response& res)
+                { res.set_content(sceneMirror_->ToJSON(req.get_param_value("tag")), "application/json"); });
+    server->Get("/profile",
+                [this](const httplib::Request& req, httplib::Response& res)
+                { res.set_content(sceneProfiler_->ToJSON(), "application/json"); });
+    server->Get("/profile/trace",
+                [this](const httplib::Request& req, httplib::Response& res)
+                {
+                    res.set_header("content-disposition", "attachment; filename=\"myroom-trace.json\"");
+                    res.set_content(sceneProfiler_->ToChromeTrace(), "application/json");
+                });
+    return server;
+}
+
+bool MyRoom::AdmitCommandRequest(const httplib::Request& req, httplib::Response& res)
+{
+    // Checked first, so that a client turned away for overload keeps its tokens. The backlog is what has arrived since
+    // the last frame plus what earlier frames deferred
+    if (eventQueue_.Size() + numPendingTasks_.load(std::memory_order_relaxed) >= COMMAND_QUEUE_WATERMARK)
+    {
+        commandMetrics_->RecordRejected(REJECT_OVERLOADED);
+        res.status = 503;
+        res.set_header("Retry-After", std::to_string(OVERLOADED_RETRY_AFTER_SEC));
+    }
+    else if (const long long waitNs = rateLimiter_->Acquire(GetClientKey(req), requestHeadersParsedNs))
+    {
+        commandMetrics_->RecordRejected(REJECT_RATE_LIMITED);
+        res.status = 429;
+        res.set_header("Retry-After", std::to_string((waitNs + 999999999) / 1000000000));
+    }
+    else
+    {
+        return true;
+    }
+    // The body is left unread, so the connection can not carry another request
+    res.set_header("Connection", "close");
+    return false;
+}
+
+void MyRoom::CreateHttpServers()
+{
+    // Shared by the servers, so that a client is limited the same over TCP and the unix domain socket
+    rateLimiter_ = std::make_unique<RateLimiter>(commandRateLimit_, COMMAND_RATE_BURST);
+
+    std::vector<int> inherited;
+    if (takingOver_)
+        inherited = hotRestart_->GetSockets();
+    auto addListener = [this](std::unique_ptr<httplib::Server> server)
+    {
+        HttpListener listener;
+        listener.server_ = std::move(server);
+        httpListeners_.push_back(std::move(listener));
+    };
+
+    if (httpTcpEnabled_)
+    {
+        std::unique_ptr<httplib::Server> server = CreateHttpServer();
+        // Responses are written as headers then body; do not hold the body back until the headers are acknowledged
+        server->set_tcp_nodelay(true);
+        const int sock = TakeInheritedSocket(inherited, AF_INET, std::string(), HTTP_PORT);
+        if (sock >= 0 ? server->bind_to_socket(sock) : server->bind_to_port("0.0.0.0", HTTP_PORT))
+            addListener(std::move(server));
+        else
+            URHO3D_LOGERRORF("Could not listen on port %d", HTTP_PORT);
+    }
+
+    if (!unixSocket_.Empty())
+    {
+        std::unique_ptr<httplib::Server> server = CreateHttpServer();
+        server->set_address_family(AF_UNIX);
+        const std::string address = GetUnixSocketAddress(unixSocket_.CString());
+        const int sock = TakeInheritedSocket(inherited, AF_UNIX, address, 0);
+        // The socket file of a socket taken over is in use. Otherwise only a stale one is replaced: unlinking the file
+        // of a running instance would leave it unreachable
+        if (sock < 0 && !RemoveStaleSocketFile(address))
+        {
+            URHO3D_LOGERROR("Could not listen on unix domain socket " + unixSocket_ + ": already in use");
+        }
+        // The port does not apply to unix domain sockets
+        else if (sock >= 0 ? server->bind_to_socket(sock) : server->bind_to_port(address, HTTP_PORT))
+        {
+            addListener(std::move(server));
+            if (address[0] != '\0')
+                unixSocketPath_ = address;
+        }
+        else
+        {
+            URHO3D_LOGERROR("Could not listen on unix domain socket " + unixSocket_);
+        }
+    }
+
+#ifndef _WIN32
+    // Sockets this instance is not configured to listen on any more
+    for (int sock : inherited)
+    {
+        URHO3D_LOGWARNING("Closing a listening socket taken over but not configured");
+        close(sock);
+    }
+#endif
+
+    // Taking over, the predecessor accepts until this instance is ready
+    if (!takingOver_)
+    {
+        StartHttpListeners();
+        ListenForSuccessor();
+    }
+}
+
+void MyRoom::StartHttpListeners()
+{
+    for (HttpListener& listener : httpListeners_)
+    {
+        if (!listener.thread_.joinable())
+            listener.thread_ = std::thread([server = listener.server_.get()] { server->listen_after_bind(); });
+    }
+}
+
+void MyRoom::StopHttpServers(bool handOff)
+{
+    // Release the workers streaming state, or stopping the servers would wait for them
+    statePublisher_.Shutdown();
+    // Stop accepting everywhere first, so that the servers drain at the same time. A server that has not started
+    // listening yet returns as soon as it does
+    for (HttpListener& listener : httpListeners_)
+    {
+        if (handOff)
+            listener.server_->hand_off();
+        else
+            listener.server_->stop();
+    }
+    for (HttpListener& listener : httpListeners_)
+    {
+        if (listener.thread_.joinable())
+            listener.thread_.join();
+    }
+    httpListeners_.clear();
+    // The other process listens on the socket file
+    if (!handOff)
+        RemoveStaleSocketFile(unixSocketPath_);
+    unixSocketPath_.clear();
+}
+
+void MyRoom::ListenForSuccessor()
+{
+    if (restartSocket_.Empty())
+        return;
+
+    std::vector<int> sockets;
+    for (HttpListener& listener : httpListeners_)
+        sockets.push_back((int)listener.server_->listening_socket());
+    const std::string address = GetUnixSocketAddress(restartSocket_.CString());
+    if (!RemoveStaleSocketFile(address))
+    {
+        URHO3D_LOGERROR("Could not listen for a new instance on " + restartSocket_ + ": already in use");
+        return;
+    }
+    hotRestart_ = std::make_unique<HotRestart>();
+    if (!hotRestart_->Listen(address, std::move(sockets)))
+    {
+        URHO3D_LOGERROR("Could not listen for a new instance on " + restartSocket_);
+        hotRestart_.reset();
+    }
+}
+
+void MyRoom::CompleteTakeOver()
+{
+    takingOver_ = false;
+    CommandJournal::State state;
+    const bool received = hotRestart_->ReceiveState(state, TAKEOVER_STATE_TIMEOUT_MS);
+    if (!received)
+        URHO3D_LOGWARNING("Did not receive the state of the instance taken over, recovering it from the journal");
+
+    // The predecessor closed the journal before sending the state, so the journal recovers the same state
+    CommandJournal::State recovered;
+    if (journalEnabled_)
+        OpenJournal(recovered);
+    RestoreState(received ? state : recovered);
+
+    StartHttpListeners();
+    ListenForSuccessor();
+    URHO3D_LOGINFO("Took over the listening sockets");
+}
+
+void MyRoom::HandOffToSuccessor()
+{
+    URHO3D_LOGINFO("Handing the listening sockets over to the new instance");
+    // The connections waiting to be accepted are left to the successor, the requests in flight are answered
+    StopHttpServers(true);
+    // Apply the commands they queued and write them out, so that the state sent includes every command answered
+    RunFrameTasks();
+    journal_.reset();
+    if (!hotRestart_->SendState(appliedState_))
+        URHO3D_LOGERROR("Could not send the state to the new instance");
+    hotRestart_.reset();
+    engine_->Exit();
+}
+
+void MyRoom::StreamState(httplib::Response& res)
+{
+    // Every stream holds a worker thread, keep some for commands
+    if (numStateStreams_.fetch_add(1) >= MAX_STATE_STREAMS)
+    {
+        --numStateStreams_;
+        res.status = 503;
+        return;
+    }
+
+    // One JSON line per change: the full state first, then only the targets that changed
+    res.set_chunked_content_provider(
+        "application/x-ndjson",
+        [this, lastVersion = (uint64_t)0, started = false](size_t offset, httplib::DataSink& sink) mutable
+        {
+            RoomState state;
+            if (!started)
+            {
+                state = statePublisher_.GetState();
+            }
+            else if (!statePublisher_.WaitForChange(lastVersion, std::chrono::seconds(1), state))
+            {
+                sink.done();
+                return true;
+            }
+
+            // An empty line keeps idle streams alive and detects clients that went away
+            const std::string line = !started || state.version_ > lastVersion
+                                         ? RoomStatePublisher::ToJSON(state, started ? lastVersion : 0)
+                                         : std::string("\n");
+            started = true;
+            lastVersion = state.version_;
+            return sink.write(line.data(), line.size());
+        },
+        [this](bool) { --numStateStreams_; });
 }
 
 void MyRoom::OnHttpRequest(const httplib::Request& req, httplib::Response& res)
@@ -92,169 +822,515 @@ void MyRoom::OnHttpRequest(const httplib::Request& req, httplib::Response& res)
 
     URHO3D_LOGDEBUG("Got request: " + reqBodyString);
 
-    auto& json = jsonFile.GetRoot();
-    // as a demo, we skip the validation here
-    auto& jsonObj = json.GetObject();
-    auto cmd = jsonObj["cmd"]->GetString();
-    if (cmd == "lighton")
+    auto& jsonObj = jsonFile.GetRoot().GetObject();
+    const JSONValue* cmd = jsonObj["cmd"];
+    const JSONValue* targetValue = jsonObj["target"];
+    res.set_header("content-type", "application/json");
+    if (!cmd || !cmd->IsString() || !targetValue || !targetValue->IsString())
     {
-        auto& target = jsonObj["target"]->GetString();
-        eventQueue_.Push(
-            [target, this]()
-            {
-                if (target == "sun")
-                {
-                    auto* scene = scene_.Get();
-                    Node* zoneNode = scene->CreateChild("Zone");
-                    zoneNode->AddTag(target);
-                    auto* zone = zoneNode->CreateComponent<Zone>();
-                    zone->SetBoundingBox(BoundingBox(-1000.0f, 1000.0f));
-                    zone->SetAmbientColor(Color(0.5f, 0.5f, 0.5f));
-                    zone->SetFogColor(Color(0.4f, 0.5f, 0.8f));
-                    zone->SetFogStart(100.0f);
-                    zone->SetFogEnd(300.0f);
-
-                    auto* cache = GetSubsystem<ResourceCache>();
-                    auto* skyNode = scene->CreateChild("SkyNode");
-                    skyNode->AddTag(target);
-                    skyNode->SetScale(500);
-                    auto* skybox = skyNode->CreateComponent<Skybox>();
-                    skybox->SetModel(cache->GetResource<Model>("Models/Box.mdl"));
-                    skybox->SetMaterial(cache->GetResource<Material>("Materials/Skybox.xml"));
-
-                    Node* lightNode = scene_->CreateChild("DirectionalLight");
-                    lightNode->SetDirection(Vector3(0.6f, -1.0f, 0.8f));
-                    lightNode->AddTag(target);
-                    auto* light = lightNode->CreateComponent<Light>();
-                    light->SetLightType(LIGHT_DIRECTIONAL);
-                    light->SetCastShadows(true);
-                    light->SetColor(Color(0.5f, 0.5f, 0.5f));
-                    light->SetShadowBias(BiasParameters(0.00025f, 0.5f));
-                    light->SetShadowCascade(CascadeParameters(10.0f, 50.0f, 200.0f, 0.0f, 0.8f));
-                }
-                else if (target == "disco")
-                {
-                    CreateDiscoLight(target);
-                }
-                else if (target == "welcome")
-                {
-                    eventQueue_.Push([target, this]() { CreateWelcome(target); });
-                }
-            });
+        res.status = 400;
+        res.body = R"json({"code": 1, "error": "expected {\"cmd\": \"<op>\", \"target\": \"<target>\"}"})json";
+        return;
     }
-    else if (cmd == "lightoff")
+
+    RoomCommand command;
+    command.op_ = ParseCommandOp(cmd->GetString());
+    const String& target = targetValue->GetString();
+    command.target_ = ParseCommandTarget(target);
+    std::string error;
+    if (command.op_ == MAX_COMMAND_OPS)
+        error = "unknown cmd";
+    else if (command.target_ == MAX_COMMAND_TARGETS)
+        error = "unknown target";
+    else if (const unsigned numParams = GetCommandNumParams(command.op_))
     {
-        auto& target = jsonObj["target"]->GetString();
-        eventQueue_.Push(
-            [target, this]()
-            {
-                PODVector<Node*> nodes;
-                scene_->GetNodesWithTag(nodes, target);
-                for (auto* node : nodes)
-                {
-                    node->Remove();
-                }
-            });
+        const JSONValue* value = jsonObj["value"];
+        if (!value || !ParseCommandParams(*value, numParams, command.params_))
+        {
+            error = numParams == 1 ? std::string("expected a number as value")
+                                   : "expected an array of " + std::to_string(numParams) + " numbers as value";
+        }
     }
-    res.set_header("content-type", "application/json");
+    if (!error.empty())
+    {
+        // Rejected, so that the client can tell it from an applied command
+        res.status = 400;
+        res.body = "{\"code\": 1, \"error\": \"" + error + "\"}";
+        return;
+    }
+
+    command.time_.headersParsed_ = requestHeadersParsedNs;
+    command.time_.enqueued_ = GetCommandTimeNs();
+    eventQueue_.Push(FrameTask{command.op_ == CMD_LIGHTON ? GetRequiredResources(target) : StringVector(), command});
     res.status = 200;
     res.body = R"json({"code": 0})json";
 }
 
-void MyRoom::CreateDiscoLight(const String& tag)
+void MyRoom::HandleCommandRingRequest(const httplib::Request& req, httplib::Response& res)
+{
+    std::lock_guard<std::mutex> lock(commandRingMutex_);
+
+    // One producer at a time: another one would race on the head. The holder renews its lease by asking again with it
+    const long long nowNs = GetCommandTimeNs();
+    const long long activeNs = Max(commandRingLeaseNs_, commandRingActiveNs_.load(std::memory_order_relaxed));
+    const bool held = !commandRingLease_.empty() && nowNs - activeNs < COMMAND_RING_LEASE_NS;
+    if (held && req.get_param_value("lease") != commandRingLease_)
+    {
+        res.status = 409;
+        res.set_content(R"json({"error": "the command ring has a producer"})json", "application/json");
+        return;
+    }
+
+    if (!commandRing_)
+    {
+        auto ring = std::make_unique<CommandRing>();
+        if (!ring->Create(GetCommandRingName(), COMMAND_RING_CAPACITY))
+        {
+            res.status = 500;
+            res.set_content(R"json({"error": "could not create the command ring"})json", "application/json");
+            return;
+        }
+        commandRing_ = std::move(ring);
+        publishedCommandRing_.store(commandRing_.get(), std::memory_order_release);
+    }
+    if (!held)
+    {
+        std::random_device device;
+        char lease[17];
+        snprintf(lease, sizeof(lease), "%08x%08x", device(), device());
+        commandRingLease_ = lease;
+    }
+    commandRingLeaseNs_ = nowNs;
+    res.set_content("{\"lease\": \"" + commandRingLease_ + "\", " + commandRing_->ToJSON().substr(1),
+                    "application/json");
+}
+
+void MyRoom::HandleCommandRingRelease(const httplib::Request& req, httplib::Response& res)
+{
+    std::lock_guard<std::mutex> lock(commandRingMutex_);
+    if (commandRingLease_.empty() || req.get_param_value("lease") != commandRingLease_)
+    {
+        res.status = 409;
+        res.set_content(R"json({"error": "not the producer of the command ring"})json", "application/json");
+        return;
+    }
+    commandRingLease_.clear();
+    res.status = 204;
+}
+
+void MyRoom::ExecuteCommand(RoomCommand& command)
+{
+    command.time_.dequeued_ = GetCommandTimeNs();
+
+    ApplyCommand(command);
+
+    command.time_.completed_ = GetCommandTimeNs();
+    appliedState_.Apply(command);
+    if (journal_)
+        journal_->Append(command);
+    commandMetrics_->RecordCompleted(command);
+    sceneProfiler_->AddMarker(String(GetCommandOpName(command.op_)) + " " + GetCommandTargetName(command.target_));
+    presentingCommands_.Push(command);
+}
+
+void MyRoom::ApplyCommand(const RoomCommand& command)
+{
+    const String& tag = GetTargetTag(command.target_);
+    statePublisher_.MarkDirty(command.target_);
+    if (command.op_ == CMD_LIGHTON)
+    {
+        switch (command.target_)
+        {
+        case TARGET_SUN:
+            CreateSun(tag);
+            break;
+        case TARGET_DISCO:
+            CreateDiscoLight(tag);
+            break;
+        case TARGET_WELCOME:
+            CreateWelcome(tag);
+            break;
+        default:
+            break;
+        }
+    }
+    else if (command.op_ == CMD_LIGHTOFF)
+    {
+        PODVector<Node*> nodes;
+        scene_->GetNodesWithTag(nodes, tag);
+        for (auto* node : nodes)
+        {
+            node->Remove();
+        }
+    }
+    else
+    {
+        SetTargetParams(command);
+    }
+}
+
+void MyRoom::SetTargetParams(const RoomCommand& command)
 {
+    // Write the parameters to the existing components in place: high-frequency updates, such as colours streamed at
+    // the frame rate, neither recreate nodes nor allocate
+    scene_->GetNodesWithTag(targetNodes_, GetTargetTag(command.target_));
+    const float* params = command.params_;
+    switch (command.op_)
+    {
+    case CMD_SETCOUNT:
+        // At least one light stays, turning the disco off is lightoff
+        if (command.target_ == TARGET_DISCO && !targetNodes_.Empty())
+            SetDiscoLightCount(targetNodes_, (unsigned)Clamp(params[0], 1.0f, (float)MAX_DISCO_LIGHTS));
+        break;
+    case CMD_SETCOLOR:
+    {
+        const Color color(params[0], params[1], params[2]);
+        for (Node* node : targetNodes_)
+        {
+            if (auto* light = node->GetComponent<Light>())
+            {
+                light->SetColor(color);
+            }
+            else if (command.target_ == TARGET_WELCOME)
+            {
+                auto* model = node->GetComponent<StaticModel>();
+                if (Material* material = model ? model->GetMaterial() : nullptr)
+                    material->SetShaderParameter(DIFFUSE_COLOR_PARAMETER, color);
+            }
+        }
+        // Keep the colour instead of having the animation overwrite it next frame
+        for (Node* node : targetNodes_)
+            animation_->Stop(node, CHANNEL_COLOR);
+        break;
+    }
+    case CMD_SETINTENSITY:
+        for (Node* node : targetNodes_)
+        {
+            if (auto* light = node->GetComponent<Light>())
+                light->SetBrightness(params[0]);
+        }
+        break;
+    case CMD_SETFOG:
+        for (Node* node : targetNodes_)
+        {
+            if (auto* zone = node->GetComponent<Zone>())
+            {
+                zone->SetFogStart(params[0]);
+                zone->SetFogEnd(params[1]);
+            }
+        }
+        break;
+    case CMD_SETTRANSFORM:
     {
-        // Create a point light to the world so that we can see something.
-        Node* lightNode = scene_->CreateChild("PointLight");
-        lightNode->AddTag(tag);
-        auto* light = lightNode->CreateComponent<Light>();
-        light->SetLightType(LIGHT_POINT);
-        light->SetRange(10.0f);
-
-        // Create light animation
-        SharedPtr<ObjectAnimation> MyRoom(new ObjectAnimation(context_));
-
-        // Create light position animation
-        SharedPtr<ValueAnimation> positionAnimation(new ValueAnimation(context_));
-        // Use spline interpolation method
-        positionAnimation->SetInterpolationMethod(IM_SPLINE);
-        // Set spline tension
-        positionAnimation->SetSplineTension(0.7f);
-        positionAnimation->SetKeyFrame(0.0f, Vector3(-30.0f, 5.0f, -30.0f));
-        positionAnimation->SetKeyFrame(1.0f, Vector3(30.0f, 5.0f, -30.0f));
-        positionAnimation->SetKeyFrame(2.0f, Vector3(30.0f, 5.0f, 30.0f));
-        positionAnimation->SetKeyFrame(3.0f, Vector3(-30.0f, 5.0f, 30.0f));
-        positionAnimation->SetKeyFrame(4.0f, Vector3(-30.0f, 5.0f, -30.0f));
-        // Set position animation
-        MyRoom->AddAttributeAnimation("Position", positionAnimation);
-
-        // Create light color animation
-        SharedPtr<ValueAnimation> colorAnimation(new ValueAnimation(context_));
-        colorAnimation->SetKeyFrame(0.0f, Color::WHITE);
-        colorAnimation->SetKeyFrame(1.0f, Color::RED);
-        colorAnimation->SetKeyFrame(2.0f, Color::YELLOW);
-        colorAnimation->SetKeyFrame(3.0f, Color::GREEN);
-        colorAnimation->SetKeyFrame(4.0f, Color::WHITE);
-        // Set Light component's color animation
-        MyRoom->AddAttributeAnimation("@Light/Color", colorAnimation);
-
-        // Apply light animation to light node
-        lightNode->SetObjectAnimation(MyRoom);
-    }
-
-    for (int i = 0; i < 20; ++i)
-    {
-        // Create a point light to the world so that we can see something.
-        Node* lightNode = scene_->CreateChild("PointLight");
-        lightNode->AddTag(tag);
-        auto* light = lightNode->CreateComponent<Light>();
-        light->SetLightType(LIGHT_POINT);
-        light->SetRange(10.0f);
-
-        // Create light animation
-        SharedPtr<ObjectAnimation> MyRoom(new ObjectAnimation(context_));
-
-        // Create light position animation
-        SharedPtr<ValueAnimation> positionAnimation(new ValueAnimation(context_));
-        // Use spline interpolation method
-        positionAnimation->SetInterpolationMethod(Urho3D::IM_SPLINE);
-        // Set spline tension
-        positionAnimation->SetSplineTension(0.7f);
-        float lastT = 0.0F;
-        std::random_device rd;
-        std::uniform_real_distribution<> dist(0.0F, 1.0F);
-        for (int j = 20; j >= 0; --j)
+        const Vector3 vector(params[0], params[1], params[2]);
+        for (Node* node : targetNodes_)
         {
-            Vector3 position{-60.0F + (float)dist(rd) * 120, 3.0F, -60.0F + (float)dist(rd) * 120};
-            if (j == 0)
+            auto* light = node->GetComponent<Light>();
+            if (light && light->GetLightType() == LIGHT_DIRECTIONAL)
             {
-                auto& f = positionAnimation->GetKeyFrames()[0];
-                positionAnimation->SetKeyFrame(lastT, f.value_.GetVector3());
+                if (vector != Vector3::ZERO)
+                    node->SetDirection(vector);
             }
-            else
+            else if (command.target_ == TARGET_WELCOME)
             {
-                positionAnimation->SetKeyFrame(lastT, position);
+                // The box stays where it is put, but keeps spinning
+                animation_->Stop(node, CHANNEL_POSITION);
+                node->SetPosition(vector);
             }
-            lastT += (float)dist(rd) * 3.0F + 0.5F;
         }
-        // Set position animation
-        MyRoom->AddAttributeAnimation("Position", positionAnimation);
-
-        // Create light color animation
-        SharedPtr<ValueAnimation> colorAnimation(new ValueAnimation(context_));
-        std::vector<Color> colors{Color::WHITE, Color::GRAY, Color::RED,     Color::GREEN,
-                                  Color::BLUE,  Color::CYAN, Color::MAGENTA, Color::YELLOW};
-        std::random_shuffle(colors.begin(), colors.end());
-        for (std::size_t j = 0; j < colors.size(); ++j)
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void MyRoom::SetDiscoLightCount(const PODVector<Node*>& lights, unsigned count)
+{
+    // The remaining lights keep their animations and parameters; added ones start with the defaults
+    for (unsigned i = count; i < lights.Size(); ++i)
+        lights[i]->Remove();
+    for (unsigned i = lights.Size(); i < count; ++i)
+        CreateDiscoLightNode(GetTargetTag(TARGET_DISCO), i);
+}
+
+void MyRoom::OpenJournal(CommandJournal::State& recovered)
+{
+    String directory = journalDir_;
+    if (directory.Empty())
+        directory = GetSubsystem<FileSystem>()->GetAppPreferencesDir("urho3d", "MyRoom");
+    directory = AddTrailingSlash(directory);
+    GetSubsystem<FileSystem>()->CreateDir(directory);
+
+    journal_ = std::make_unique<CommandJournal>();
+    if (!journal_->Open(directory.CString(), recovered))
+        journal_.reset();
+}
+
+void MyRoom::RestoreState(const CommandJournal::State& state)
+{
+    // Applied after the scene exists, ahead of any new command. These are not journaled again
+    appliedState_ = state;
+    for (unsigned i = 0; i < MAX_COMMAND_TARGETS; ++i)
+    {
+        if (!state.targetOn_[i])
+            continue;
+        RoomCommand command;
+        command.op_ = CMD_LIGHTON;
+        command.target_ = static_cast<CommandTarget>(i);
+        eventQueue_.Push(FrameTask{GetRequiredResources(GetCommandTargetName(command.target_)), RoomCommand(),
+                                   [command, this]() { ApplyCommand(command); }});
+
+        // Then set the parameters again, in operation order so that lights added by setcount get their colour
+        for (unsigned op = 0; op < MAX_COMMAND_OPS; ++op)
+        {
+            if (!state.paramsSet_[i][op])
+                continue;
+            RoomCommand setCommand;
+            setCommand.op_ = static_cast<CommandOp>(op);
+            setCommand.target_ = command.target_;
+            memcpy(setCommand.params_, state.params_[i][op], sizeof(setCommand.params_));
+            eventQueue_.Push(
+                FrameTask{StringVector(), RoomCommand(), [setCommand, this]() { ApplyCommand(setCommand); }});
+        }
+    }
+}
+
+void MyRoom::PreloadResources()
+{
+    preloader_ = new ResourcePreloader(context_);
+    for (const auto& entry : PRELOAD_MANIFEST)
+    {
+        preloader_->Add(StringHash(entry.type_), entry.name_);
+    }
+    preloader_->Start();
+}
+
+void MyRoom::RunFrameTasks()
+{
+    // Keep the arrival order: new tasks go behind the deferred ones
+    FrameTask task;
+    bool received = false;
+    while (eventQueue_.Pop(task))
+    {
+        pendingTasks_.push_back(std::move(task));
+        received = true;
+    }
+    // Then the commands streamed through the shared memory ring, at most one ring's worth per frame
+    if (CommandRing* ring = publishedCommandRing_.load(std::memory_order_acquire))
+    {
+        CommandRing::Record record;
+        unsigned numPopped = 0;
+        for (; numPopped < ring->GetCapacity() && ring->TryPop(record); ++numPopped)
         {
-            colorAnimation->SetKeyFrame(j + dist(rd) * 0.5F, colors[j]);
+            RoomCommand command;
+            if (!ParseCommandRecord(record, command))
+            {
+                ring->AddRejected();
+                continue;
+            }
+            pendingTasks_.push_back(FrameTask{
+                command.op_ == CMD_LIGHTON ? GetRequiredResources(GetTargetTag(command.target_)) : StringVector(),
+                command});
+            received = true;
         }
-        // Set Light component's color animation
-        MyRoom->AddAttributeAnimation("@Light/Color", colorAnimation);
+        // A producer streaming records keeps its lease
+        if (numPopped)
+            commandRingActiveNs_.store(GetCommandTimeNs(), std::memory_order_relaxed);
+    }
+    if (received)
+        CoalesceFrameTasks();
+
+    while (!pendingTasks_.empty())
+    {
+        // Defer this task (and everything behind it) to a later frame rather than block on a resource load
+        if (!preloader_->IsLoaded(pendingTasks_.front().requiredResources_))
+            break;
 
-        // Apply light animation to light node
-        lightNode->SetObjectAnimation(MyRoom);
+        task = std::move(pendingTasks_.front());
+        pendingTasks_.pop_front();
+        if (task.run_)
+            task.run_();
+        else
+            ExecuteCommand(task.command_);
     }
+    numPendingTasks_.store(pendingTasks_.size(), std::memory_order_relaxed);
+}
+
+void MyRoom::CoalesceFrameTasks()
+{
+    // What is known about the commands of a target that come later than the one being looked at
+    struct Window
+    {
+        /// Seen a lighton or lightoff.
+        bool switched_{false};
+        /// The last lighton or lightoff is a lighton.
+        bool endsOn_{false};
+        /// Seen a lightoff.
+        bool switchedOff_{false};
+        /// Bits of the set operations seen, up to the nearest setcount.
+        unsigned set_{0};
+    };
+    Window windows[MAX_COMMAND_TARGETS];
+
+    // Walk backwards, so that the commands deciding the final state of a target are seen before those they supersede
+    bool elided = false;
+    for (auto it = pendingTasks_.rbegin(); it != pendingTasks_.rend(); ++it)
+    {
+        if (it->run_)
+        {
+            // Other work may depend on the commands queued before it, do not coalesce across it
+            std::fill(std::begin(windows), std::end(windows), Window());
+            continue;
+        }
+
+        RoomCommand& command = it->command_;
+        Window& window = windows[command.target_];
+        bool keep;
+        if (command.op_ == CMD_LIGHTON || command.op_ == CMD_LIGHTOFF)
+        {
+            // The last switch decides whether the target ends up on. When that is a lighton, the last lightoff before
+            // it stays too: the target is then rebuilt with default parameters, as it would be without coalescing
+            const bool off = command.op_ == CMD_LIGHTOFF;
+            keep = !window.switched_ || (off && window.endsOn_ && !window.switchedOff_);
+            if (!window.switched_)
+                window.endsOn_ = !off;
+            window.switched_ = true;
+            window.switchedOff_ = window.switchedOff_ || off;
+        }
+        else
+        {
+            // Only the last value of a parameter matters, and nothing set before the target is switched off. A setcount
+            // does not commute with the other set operations, which apply to the lights it leaves: coalesce neither
+            // across it, nor a setcount across them
+            const unsigned bit = 1u << command.op_;
+            const unsigned countBit = 1u << CMD_SETCOUNT;
+            keep = !window.switchedOff_ && !(window.set_ & bit);
+            window.set_ = command.op_ == CMD_SETCOUNT ? countBit : (window.set_ & ~countBit) | bit;
+        }
+
+        if (!keep)
+        {
+            commandMetrics_->RecordElided(command);
+            command.op_ = MAX_COMMAND_OPS;
+            elided = true;
+        }
+    }
+
+    if (elided)
+    {
+        pendingTasks_.erase(std::remove_if(pendingTasks_.begin(), pendingTasks_.end(),
+                                           [](const FrameTask& task)
+                                           { return !task.run_ && task.command_.op_ == MAX_COMMAND_OPS; }),
+                            pendingTasks_.end());
+    }
+}
+
+void MyRoom::CreateSun(const String& tag)
+{
+    auto* scene = scene_.Get();
+    Node* zoneNode = scene->CreateChild("Zone");
+    zoneNode->AddTag(tag);
+    auto* zone = zoneNode->CreateComponent<Zone>();
+    zone->SetBoundingBox(BoundingBox(-1000.0f, 1000.0f));
+    zone->SetAmbientColor(Color(0.5f, 0.5f, 0.5f));
+    zone->SetFogColor(Color(0.4f, 0.5f, 0.8f));
+    zone->SetFogStart(100.0f);
+    zone->SetFogEnd(300.0f);
+
+    auto* cache = GetSubsystem<ResourceCache>();
+    auto* skyNode = scene->CreateChild("SkyNode");
+    skyNode->AddTag(tag);
+    skyNode->SetScale(500);
+    auto* skybox = skyNode->CreateComponent<Skybox>();
+    skybox->SetModel(cache->GetResource<Model>("Models/Box.mdl"));
+    skybox->SetMaterial(cache->GetResource<Material>("Materials/Skybox.xml"));
+
+    Node* lightNode = scene_->CreateChild("DirectionalLight");
+    lightNode->SetDirection(Vector3(0.6f, -1.0f, 0.8f));
+    lightNode->AddTag(tag);
+    auto* light = lightNode->CreateComponent<Light>();
+    light->SetLightType(LIGHT_DIRECTIONAL);
+    light->SetCastShadows(true);
+    light->SetColor(Color(0.5f, 0.5f, 0.5f));
+    light->SetShadowBias(BiasParameters(0.00025f, 0.5f));
+    light->SetShadowCascade(CascadeParameters(10.0f, 50.0f, 200.0f, 0.0f, 0.8f));
+}
+
+void MyRoom::CreateDiscoLight(const String& tag)
+{
+    for (unsigned i = 0; i < NUM_DISCO_LIGHTS; ++i)
+        CreateDiscoLightNode(tag, i);
+}
+
+void MyRoom::CreateDiscoLightNode(const String& tag, unsigned index)
+{
+    // Create a point light to the world so that we can see something.
+    Node* lightNode = scene_->CreateChild("PointLight");
+    lightNode->AddTag(tag);
+    auto* light = lightNode->CreateComponent<Light>();
+    light->SetLightType(LIGHT_POINT);
+    light->SetRange(10.0f);
+
+    // Animate it together with the other disco lights
+    AnimationKeys keys;
+    keys.tension_ = DISCO_PATH_TENSION;
+    if (!index)
+    {
+        keys.positions_ = {Vector3(-30.0f, 5.0f, -30.0f), Vector3(30.0f, 5.0f, -30.0f), Vector3(30.0f, 5.0f, 30.0f),
+                           Vector3(-30.0f, 5.0f, 30.0f), Vector3(-30.0f, 5.0f, -30.0f)};
+        keys.positionTimes_ = {0.0f, 1.0f, 2.0f, 3.0f, 4.0f};
+        keys.colors_ = {Color::WHITE, Color::RED, Color::YELLOW, Color::GREEN, Color::WHITE};
+        keys.colorTimes_ = keys.positionTimes_;
+    }
+    else
+    {
+        std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+
+        // A random closed path: the last key returns to the first
+        float time = 0.0f;
+        for (unsigned k = 0; k + 1 < DISCO_PATH_KEYS; ++k)
+        {
+            keys.positions_.push_back(Vector3(-60.0f + dist(discoRandom_) * 120.0f, 3.0f,
+                                              -60.0f + dist(discoRandom_) * 120.0f));
+            keys.positionTimes_.push_back(time);
+            time += dist(discoRandom_) * 3.0f + 0.5f;
+        }
+        keys.positions_.push_back(keys.positions_.front());
+        keys.positionTimes_.push_back(time);
+
+        // The eight colours in random order, at slightly jittered times starting from zero
+        keys.colors_ = {Color::WHITE, Color::GRAY, Color::RED,     Color::GREEN,
+                        Color::BLUE,  Color::CYAN, Color::MAGENTA, Color::YELLOW};
+        std::shuffle(keys.colors_.begin(), keys.colors_.end(), discoRandom_);
+        for (unsigned k = 0; k < keys.colors_.size(); ++k)
+            keys.colorTimes_.push_back(k ? (float)k + dist(discoRandom_) * 0.5f : 0.0f);
+    }
+    animation_->Add(lightNode, keys);
+}
+
+void MyRoom::UpdateRenderPath()
+{
+    auto* renderer = GetSubsystem<Renderer>();
+    Viewport* viewport = renderer ? renderer->GetViewport(0) : nullptr;
+    if (!viewport)
+        return;
+
+    scene_->GetNodesWithTag(targetNodes_, GetTargetTag(TARGET_DISCO));
+    const unsigned numLights = targetNodes_.Size();
+    bool deferred = deferredShading_;
+    if (numLights > DEFERRED_SHADING_LIGHTS)
+        deferred = GetSubsystem<Graphics>()->GetDeferredSupport();
+    else if (numLights < DEFERRED_SHADING_LIGHTS / 2)
+        deferred = false;
+    if (deferred == deferredShading_)
+        return;
+
+    auto* cache = GetSubsystem<ResourceCache>();
+    viewport->SetRenderPath(
+        cache->GetResource<XMLFile>(deferred ? "RenderPaths/Deferred.xml" : "RenderPaths/Forward.xml"));
+    deferredShading_ = deferred;
+    URHO3D_LOGINFOF("Switched to %s shading for %u disco lights", deferred ? "deferred" : "forward", numLights);
 }
 
 void MyRoom::CreateWelcome(const Urho3D::String& tag)
@@ -276,35 +1352,14 @@ void MyRoom::CreateWelcome(const Urho3D::String& tag)
     model->SetMaterial(renderMaterial);
     model->SetCastShadows(true);
 
-    SharedPtr<ObjectAnimation> objectAnimation(new ObjectAnimation(context_));
-    {
-        // Create light position animation
-        SharedPtr<ValueAnimation> rotAnimation(new ValueAnimation(context_));
-        Quaternion quat1, quat2, quat3;
-        quat1.FromAngleAxis(0, Vector3::UP);
-        quat2.FromAngleAxis(180, Vector3::UP);
-        quat3.FromAngleAxis(360, Vector3::UP);
-
-        // Use spline interpolation method
-        rotAnimation->SetInterpolationMethod(Urho3D::IM_LINEAR);
-        // Set spline tension
-        rotAnimation->SetKeyFrame(0.0f, quat1);
-        rotAnimation->SetKeyFrame(3.0f, quat2);
-        rotAnimation->SetKeyFrame(6.0f, quat3);
-        // Set position animation
-        objectAnimation->AddAttributeAnimation("Rotation", rotAnimation);
-    }
-    {
-        SharedPtr<ValueAnimation> posAnimation(new ValueAnimation(context_));
-        posAnimation->SetInterpolationMethod(Urho3D::IM_SPLINE);
-        posAnimation->SetSplineTension(0.5F);
-        posAnimation->SetKeyFrame(0.0F, Vector3{0, 10, 0});
-        posAnimation->SetKeyFrame(2.5F, Vector3{0, 20, 0});
-        posAnimation->SetKeyFrame(5.F, Vector3{0, 10, 0});
-        objectAnimation->AddAttributeAnimation("Position", posAnimation);
-    }
-
-    box->SetObjectAnimation(objectAnimation);
+    // Spin about the vertical axis while bobbing up and down
+    AnimationKeys keys;
+    keys.yawTimes_ = {0.0f, 3.0f, 6.0f};
+    keys.yaws_ = {0.0f, 180.0f, 360.0f};
+    keys.positionTimes_ = {0.0f, 2.5f, 5.0f};
+    keys.positions_ = {Vector3(0.0f, 10.0f, 0.0f), Vector3(0.0f, 20.0f, 0.0f), Vector3(0.0f, 10.0f, 0.0f)};
+    keys.tension_ = 0.5f;
+    animation_->Add(box, keys);
 }
 
 void MyRoom::CreateScene()
@@ -318,43 +1373,140 @@ void MyRoom::CreateScene()
     // coordinates; it is also legal to place objects outside the volume but their visibility can then not be checked in
     // a hierarchically optimizing manner
     scene_->CreateComponent<Octree>();
+    // Animates the lights and the welcome box on scene update
+    animation_ = scene_->CreateComponent<BatchedAnimation>();
+
+    // Create a scene node for the camera, which we will move around. It comes before the room, which loads nearest to
+    // the camera first
+    // The camera will use default settings (1000 far clip distance, 45 degrees FOV, set aspect ratio automatically)
+    cameraNode_ = scene_->CreateChild("Camera");
+    cameraNode_->CreateComponent<Camera>();
+
+    // Set an initial position for the camera scene node above the plane
+    cameraNode_->SetPosition(Vector3(0.0f, 5.0f, 0.0f));
+
+    // The room content goes under one node, so that POST /scene/load can swap it
+    roomNode_ = scene_->CreateChild("Room");
+    if (!roomFile_.Empty())
+    {
+        auto file = std::make_shared<RoomFile>();
+        if (file->Open(roomFile_.CString()))
+        {
+            LoadRoom(file);
+            return;
+        }
+        URHO3D_LOGERROR("Could not load room file " + roomFile_ + ", creating the default room");
+    }
+    CreateRoom();
+}
+
+void MyRoom::CreateRoom()
+{
+    auto* cache = GetSubsystem<ResourceCache>();
 
     // Create a child scene node (at world origin) and a StaticModel component into it. Set the StaticModel to show a
     // simple plane mesh with a "stone" material. Note that naming the scene nodes is optional. Scale the scene node
     // larger (100 x 100 world units)
-    Node* planeNode = scene_->CreateChild("Plane");
+    Node* planeNode = roomNode_->CreateChild("Plane");
     planeNode->SetScale(Vector3(100.0f, 1.0f, 100.0f));
     auto* planeObject = planeNode->CreateComponent<StaticModel>();
     planeObject->SetModel(cache->GetResource<Model>("Models/Plane.mdl"));
     planeObject->SetMaterial(cache->GetResource<Material>("Materials/StoneTiled.xml"));
 
-    //        auto* cache = GetSubsystem<ResourceCache>();
-    // Create more StaticModel objects to the scene, randomly positioned, rotated and scaled. For rotation, we construct
-    // a quaternion from Euler angles where the Y angle (rotation about the Y axis) is randomized. The mushroom model
-    // contains LOD levels, so the StaticModel component will automatically select the LOD level according to the view
-    // distance (you'll see the model get simpler as it moves further away). Finally, rendering a large number of the
-    // same object with the same material allows instancing to be used, if the GPU supports it. This reduces the amount
-    // of CPU work in rendering the scene.
-    const unsigned NUM_OBJECTS = 200;
-    for (unsigned i = 0; i < NUM_OBJECTS; ++i)
-    {
-        Node* mushroomNode = scene_->CreateChild("Mushroom");
-        mushroomNode->SetPosition(Vector3(Random(90.0f) - 45.0f, 0.0f, Random(90.0f) - 45.0f));
-        mushroomNode->SetRotation(Quaternion(0.0f, Random(360.0f), 0.0f));
-        mushroomNode->SetScale(0.5f + Random(2.0f));
-        auto* mushroomObject = mushroomNode->CreateComponent<StaticModel>();
-        mushroomObject->SetModel(cache->GetResource<Model>("Models/Mushroom.mdl"));
-        mushroomObject->SetMaterial(cache->GetResource<Material>("Materials/Mushroom.xml"));
-        mushroomObject->SetCastShadows(true);
-    }
-
-    // Create a scene node for the camera, which we will move around
-    // The camera will use default settings (1000 far clip distance, 45 degrees FOV, set aspect ratio automatically)
-    cameraNode_ = scene_->CreateChild("Camera");
-    cameraNode_->CreateComponent<Camera>();
+    // Scatter mushrooms over the plane, randomly positioned, rotated about the Y axis and scaled (--props sets how
+    // many, --seed their layout). The transforms are computed on the WorkQueue threads; only attaching them to the
+    // scene runs here. The mushrooms are not scene nodes: a PropField packs their transforms into per-cell chunks,
+    // each culled by the octree and drawn with hardware instancing where the GPU supports it. The mushroom model
+    // contains LOD levels, selected per chunk by view distance (you'll see the model get simpler as it moves further
+    // away)
+    HiresTimer propTimer;
+    PropGenerator propGenerator(context_);
+    propGenerator.SetSeed(seed_);
+    propGenerator.SetAreaSize(PROP_AREA_SIZE);
+    const std::vector<Matrix3x4> propTransforms = propGenerator.Generate(numProps_);
+    const long long generateUs = propTimer.GetUSec(true);
 
-    // Set an initial position for the camera scene node above the plane
-    cameraNode_->SetPosition(Vector3(0.0f, 5.0f, 0.0f));
+    auto* propField = roomNode_->CreateChild("Mushrooms")->CreateComponent<PropField>();
+    propField->SetModel(cache->GetResource<Model>("Models/Mushroom.mdl"),
+                        cache->GetResource<Material>("Materials/Mushroom.xml"));
+    propField->SetChunkSize(PROP_CHUNK_SIZE);
+    propField->SetShadowDistance(PROP_SHADOW_DISTANCE);
+    propField->SetInstances(propTransforms);
+    URHO3D_LOGINFOF("Scattered %u mushrooms in %u chunks: generated in %.1f ms, attached in %.1f ms", numProps_,
+                    propField->GetNumChunks(), generateUs / 1000.0, propTimer.GetUSec(false) / 1000.0);
+}
+
+void MyRoom::LoadRoom(const std::shared_ptr<RoomFile>& file)
+{
+    // The first frame shows what is loaded by then, the rest streams in over the following frames
+    roomNode_->RemoveAllChildren();
+    roomLoader_ = new RoomLoader(context_);
+    roomLoader_->Start(file, roomNode_, cameraNode_->GetWorldPosition());
+}
+
+void MyRoom::ExportRoom()
+{
+    if (!RoomLoader::Save(roomNode_, exportRoomFile_.CString()))
+    {
+        ErrorExit("Could not write room file " + exportRoomFile_);
+        return;
+    }
+
+    // Round trip: a room that failed to load was replaced by the default room, and a record the loader dropped or the
+    // writer split shows up as a count mismatch
+    if (!roomFile_.Empty())
+    {
+        RoomFile loaded;
+        RoomFile written;
+        if (!loaded.Open(roomFile_.CString()) || !written.Open(exportRoomFile_.CString()))
+        {
+            ErrorExit("Could not read back room file " + (loaded.IsOpen() ? exportRoomFile_ : roomFile_));
+            return;
+        }
+        if (written.GetNumNodes() != loaded.GetNumNodes() || written.GetNumInstances() != loaded.GetNumInstances())
+        {
+            ErrorExit(ToString("Room file %s has %u nodes and %u instances, %s has %u nodes and %u instances",
+                               exportRoomFile_.CString(), written.GetNumNodes(), written.GetNumInstances(),
+                               roomFile_.CString(), loaded.GetNumNodes(), loaded.GetNumInstances()));
+            return;
+        }
+        URHO3D_LOGINFOF("Round trip of %u room nodes and %u instances", written.GetNumNodes(),
+                        written.GetNumInstances());
+    }
+    engine_->Exit();
+}
+
+void MyRoom::HandleLoadRoomRequest(const httplib::Request& req, httplib::Response& res)
+{
+    res.set_header("content-type", "application/json");
+    JSONFile jsonFile(context_);
+    const JSONValue* room = jsonFile.FromString(req.body.c_str()) ? jsonFile.GetRoot().GetObject()["room"] : nullptr;
+    if (!room || !room->IsString())
+    {
+        res.status = 400;
+        res.body = R"json({"code": 1, "error": "expected {\"room\": \"<resource name>\"}"})json";
+        return;
+    }
+
+    // Only room files inside the resource directories can be loaded
+    const String& name = room->GetString();
+    const String path = IsAbsolutePath(name) || name.Contains("..")
+                            ? String::EMPTY
+                            : GetSubsystem<ResourceCache>()->GetResourceFileName(name);
+    auto file = std::make_shared<RoomFile>();
+    if (path.Empty() || !file->Open(path.CString()))
+    {
+        res.status = path.Empty() ? 404 : 400;
+        res.body = path.Empty() ? R"json({"code": 1, "error": "room not found"})json"
+                                : R"json({"code": 1, "error": "invalid room file"})json";
+        return;
+    }
+
+    // Mapped and validated here; the swap runs on the frame thread in order with the commands around it
+    const unsigned numNodes = file->GetNumNodes();
+    eventQueue_.Push(FrameTask{StringVector(), RoomCommand(), [this, file]() { LoadRoom(file); }});
+    res.status = 202;
+    res.body = "{\"code\": 0, \"nodes\": " + std::to_string(numNodes) + "}";
 }
 
 void MyRoom::CreateInstructions()
@@ -436,17 +1588,43 @@ void MyRoom::SubscribeToEvents()
 {
     // Subscribe HandleUpdate() function for processing update events
     SubscribeToEvent(E_UPDATE, URHO3D_HANDLER(MyRoom, HandleUpdate));
+    // Subscribe HandleEndFrame() function for measuring when command effects become visible
+    SubscribeToEvent(E_ENDFRAME, URHO3D_HANDLER(MyRoom, HandleEndFrame));
 }
 
 void MyRoom::HandleUpdate(StringHash eventType, VariantMap& eventData)
 {
     using namespace Update;
 
+    // Take over once ready to serve commands without a hitch, as /ready reports
+    if (takingOver_ && preloader_->IsReady())
+        CompleteTakeOver();
+    if (hotRestart_ && hotRestart_->IsSuccessorReady())
+    {
+        HandOffToSuccessor();
+        return;
+    }
+
+    if (replay_)
+    {
+        replay_->Update();
+        const long long drainStart = GetCommandTimeNs();
+        RunFrameTasks();
+        replay_->RecordDrainTime(GetCommandTimeNs() - drainStart);
+    }
+    else
+    {
+        RunFrameTasks();
+    }
+
+    if (roomLoader_ && roomLoader_->Update(cameraNode_->GetWorldPosition()))
     {
-        std::function<void()> task;
-        while (eventQueue_.Pop(task))
+        URHO3D_LOGINFOF("Loaded %u room nodes in %.1f ms", roomLoader_->GetNumNodes(), roomLoader_->GetElapsedMs());
+        roomLoader_.Reset();
+        if (!exportRoomFile_.Empty())
         {
-            task();
+            ExportRoom();
+            return;
         }
     }
 
@@ -454,5 +1632,30 @@ void MyRoom::HandleUpdate(StringHash eventType, VariantMap& eventData)
     float timeStep = eventData[P_TIMESTEP].GetFloat();
 
     // Move the camera, scale movement with time step
-    MoveCamera(timeStep);
+    if (!headless_)
+        MoveCamera(timeStep);
+
+    activationManager_->Update(timeStep);
+    UpdateRenderPath();
+
+    // Let observers see what the commands of this frame changed
+    statePublisher_.Update(scene_);
+    sceneMirror_->Publish(scene_, GetSubsystem<Time>()->GetFrameNumber());
+}
+
+void MyRoom::HandleEndFrame(StringHash eventType, VariantMap& eventData)
+{
+    if (!presentingCommands_.Empty())
+    {
+        // The frame that just ended is the first one rendered with the effects of these commands
+        const long long now = GetCommandTimeNs();
+        for (const RoomCommand& command : presentingCommands_)
+        {
+            commandMetrics_->RecordPresented(command, now);
+        }
+        presentingCommands_.Clear();
+    }
+
+    if (replay_ && replay_->IsInjectionFinished() && pendingTasks_.empty())
+        FinishReplay();
 }
@@ -3,9 +3,17 @@
 
 #pragma once
 
+#include "CommandJournal.h"
+#include "RoomCommand.h"
+#include "RoomState.h"
 #include "Sample.h"
 #include "SimpleThreadSafeQueue.h"
+#include <atomic>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <random>
+#include <vector>
 
 namespace Urho3D
 {
@@ -22,6 +30,19 @@ class Request;
 class Response;
 } // namespace httplib
 
+class ActivationManager;
+class BatchedAnimation;
+class CommandMetrics;
+class CommandRing;
+class HotRestart;
+class RateLimiter;
+class ReplayBenchmark;
+class ResourcePreloader;
+class RoomFile;
+class RoomLoader;
+class SceneMirror;
+class SceneProfiler;
+
 /// Light animation example.
 /// This sample is base on StaticScene, and it demonstrates:
 ///     - Usage of attribute animation for light color & UI animation
@@ -34,18 +55,87 @@ public:
     explicit MyRoom(Context* context);
     ~MyRoom() override;
 
+    /// Setup before engine initialization. Parses the command line.
+    void Setup() override;
     /// Setup after engine initialization and before running the main loop.
     void Start() override;
+    /// Cleanup after the main loop. Stops the http servers and applies the commands they queued.
+    void Stop() override;
 
 private:
-    /// Create an http server to handle commands
-    void CreateHttpServer();
+    /// Create the http servers to handle commands, on TCP and/or a unix domain socket, and start listening unless
+    /// taking over. The listening sockets taken over from the predecessor are used instead of binding new ones.
+    void CreateHttpServers();
+    /// Create an http server with the command and query routes.
+    std::unique_ptr<httplib::Server> CreateHttpServer();
+    /// Start the threads of the http servers not listening yet.
+    void StartHttpListeners();
+    /// Stop accepting connections, let the requests in flight finish for a moment and join the server threads. Idle
+    /// connections are closed right away. When handing off, the listening sockets are closed without shutting them
+    /// down, as another process shares them.
+    void StopHttpServers(bool handOff = false);
+    /// Listen for a successor to hand the listening sockets over to (--restart-socket).
+    void ListenForSuccessor();
+    /// Once ready to serve, have the predecessor stop, then restore the state it sends and start listening.
+    void CompleteTakeOver();
+    /// Stop serving for the ready successor, send it the state once the commands in flight are applied, and exit.
+    void HandOffToSuccessor();
     void OnHttpRequest(const httplib::Request& req, httplib::Response& res);
+    /// Decide, before its body is read, whether to serve a request that queues work for the frame thread. Answer 503
+    /// when the frame thread is behind and 429 when the client exceeds its rate, both with Retry-After, and return
+    /// false; called from the pre-routing handler on the worker thread.
+    bool AdmitCommandRequest(const httplib::Request& req, httplib::Response& res);
+    /// Answer GET /state/stream with a stream of state changes.
+    void StreamState(httplib::Response& res);
+    /// Answer POST /cmd/ring: create the shared memory command ring on first use, grant or renew the producer lease
+    /// and describe the ring. Answer 409 while another producer holds the lease.
+    void HandleCommandRingRequest(const httplib::Request& req, httplib::Response& res);
+    /// Answer DELETE /cmd/ring: release the producer lease given as the "lease" parameter.
+    void HandleCommandRingRelease(const httplib::Request& req, httplib::Response& res);
+    /// Answer POST /scene/load: open a room file and queue swapping the room for it.
+    void HandleLoadRoomRequest(const httplib::Request& req, httplib::Response& res);
+    /// Apply a command to the scene. Called on the frame thread.
+    void ExecuteCommand(RoomCommand& command);
+    /// Change the scene according to a command.
+    void ApplyCommand(const RoomCommand& command);
+    /// Apply the parameters of a set command to the existing nodes of its target.
+    void SetTargetParams(const RoomCommand& command);
+    /// Add or remove disco lights until there are the given number of them.
+    void SetDiscoLightCount(const PODVector<Node*>& lights, unsigned count);
+    /// Recover the state of the previous run from the command journal and start journaling.
+    void OpenJournal(CommandJournal::State& recovered);
+    /// Turn the targets of a state back on and set their parameters again, once the scene exists.
+    void RestoreState(const CommandJournal::State& state);
+    void CreateSun(const String& tag);
     void CreateDiscoLight(const String& tag);
+    /// Create one disco light and animate it. The first light follows a fixed path, the others random ones.
+    void CreateDiscoLightNode(const String& tag, unsigned index);
+    /// Switch between forward and deferred shading as the number of disco lights crosses the threshold.
+    void UpdateRenderPath();
     void CreateWelcome(const String& tag);
+    /// Queue the resources used by command handlers for background loading.
+    void PreloadResources();
+    /// Run queued frame tasks in order, stopping at the first one whose resources are still loading.
+    void RunFrameTasks();
+    /// Drop the queued commands superseded by later ones of the same target, leaving one switch per target and the
+    /// last value of each parameter.
+    void CoalesceFrameTasks();
+    /// Load the replay file and start feeding its commands through the request path.
+    void StartReplay();
+    /// Output the replay report and exit.
+    void FinishReplay();
+    /// Write a report to the --report file, or stdout if none was given.
+    void WriteReport(const std::string& report);
 
     /// Construct the scene content.
     void CreateScene();
+    /// Construct the default room: the plane and the mushrooms.
+    void CreateRoom();
+    /// Replace the room with the content of a room file, streamed in over the next frames.
+    void LoadRoom(const std::shared_ptr<RoomFile>& file);
+    /// Write the room to the --export-room file and exit. A room loaded with --room must read back from the written file
+    /// with the same node and instance counts.
+    void ExportRoom();
     /// Construct an instruction text to the UI.
     void CreateInstructions();
     /// Set up a viewport for displaying the scene.
@@ -56,9 +146,116 @@ private:
     void SubscribeToEvents();
     /// Handle the logic update event.
     void HandleUpdate(StringHash eventType, VariantMap& eventData);
+    /// Handle the end of frame event.
+    void HandleEndFrame(StringHash eventType, VariantMap& eventData);
 
 private:
-    std::thread httpServerThread_{};
-    std::unique_ptr<httplib::Server> httpServer_{nullptr};
-    SimpleThreadSafeQueue<std::function<void()>> eventQueue_{};
+    /// Work handed from the http thread to the frame thread.
+    struct FrameTask
+    {
+        /// Resources the task will fetch from the cache; the task is deferred until they are loaded.
+        StringVector requiredResources_{};
+        /// Command to execute unless the task runs other work. Commands may be coalesced with later ones.
+        RoomCommand command_{};
+        /// Work to run instead of a command.
+        std::function<void()> run_{};
+    };
+
+    /// An http server and the thread it listens on.
+    struct HttpListener
+    {
+        std::unique_ptr<httplib::Server> server_{};
+        std::thread thread_{};
+    };
+
+    std::vector<HttpListener> httpListeners_{};
+    /// Unix domain socket to listen on, a path or @name in the abstract namespace (--uds).
+    String unixSocket_{};
+    /// Unix domain socket on which an instance hands its listening sockets over to the instance replacing it, a path or
+    /// @name (--restart-socket).
+    String restartSocket_{};
+    /// Connection to the predecessor while taking over, then the listener for a successor.
+    std::unique_ptr<HotRestart> hotRestart_{};
+    /// Whether the listening sockets were taken over from a predecessor which still serves on them.
+    bool takingOver_{false};
+    /// Socket file created for unixSocket_, removed on exit.
+    std::string unixSocketPath_{};
+    /// Listen on TCP port 8888 (disabled by --no-tcp).
+    bool httpTcpEnabled_{true};
+    /// Serve the http sockets through io_uring where the kernel supports it (--io-uring).
+    bool httpIoUring_{false};
+    /// Sustained commands per second allowed to each client, 0 for no limit (--rate-limit).
+    float commandRateLimit_{500.0f};
+    /// Token buckets of the clients, shared by the http servers.
+    std::unique_ptr<RateLimiter> rateLimiter_{};
+    SimpleThreadSafeQueue<FrameTask> eventQueue_{};
+    /// Shared memory ring of binary commands, created by the first POST /cmd/ring.
+    std::unique_ptr<CommandRing> commandRing_{};
+    /// commandRing_ once created, for the frame thread to poll.
+    std::atomic<CommandRing*> publishedCommandRing_{nullptr};
+    std::mutex commandRingMutex_{};
+    /// Token of the producer holding the command ring, empty if none. Guarded by commandRingMutex_.
+    std::string commandRingLease_{};
+    /// Time the lease was granted or last renewed, in nanoseconds of the command clock. Guarded by commandRingMutex_.
+    long long commandRingLeaseNs_{0};
+    /// Time records were last drained from the command ring, which renews the lease too.
+    std::atomic<long long> commandRingActiveNs_{0};
+    /// Tasks popped from eventQueue_ but deferred because their resources are not loaded yet. Frame thread only.
+    std::deque<FrameTask> pendingTasks_{};
+    /// Size of pendingTasks_ after the last frame, for the http workers to shed load on.
+    std::atomic<size_t> numPendingTasks_{0};
+    SharedPtr<ResourcePreloader> preloader_{};
+    std::unique_ptr<CommandMetrics> commandMetrics_{};
+    SharedPtr<SceneProfiler> sceneProfiler_{};
+    /// Run without a window (--headless).
+    bool headless_{false};
+    /// Command log to replay instead of listening for commands (--replay).
+    String replayFile_{};
+    /// File receiving the replay report, stdout if empty (--report).
+    String reportFile_{};
+    SharedPtr<ReplayBenchmark> replay_{};
+    /// Measure the light animation at several node counts and exit (--animation-benchmark).
+    bool animationBenchmark_{false};
+    /// Number of mushrooms scattered over the plane (--props).
+    unsigned numProps_{200};
+    /// Seed of the mushroom layout and the disco light paths (--seed).
+    unsigned seed_{1};
+    /// Measure the mushroom field startup at several prop counts and exit (--scene-benchmark).
+    bool sceneBenchmark_{false};
+    /// Measure request latency on kept-alive http connections and exit (--http-benchmark).
+    bool httpBenchmark_{false};
+    /// Room file to load instead of the default room (--room).
+    String roomFile_{};
+    /// File to write the room to before exiting (--export-room), once a --room file has streamed in.
+    String exportRoomFile_{};
+    /// Distance from the camera beyond which disco lights are paused (--activation-radius).
+    float activationRadius_{80.0f};
+    /// Directory of the command journal, the preferences directory if empty (--journal).
+    String journalDir_{};
+    /// Journal applied commands and restore them on startup (disabled by --no-journal).
+    bool journalEnabled_{true};
+    std::unique_ptr<CommandJournal> journal_{};
+    /// Targets on and their parameters after the commands applied so far, as the journal would recover them. Handed to
+    /// the successor. Frame thread only.
+    CommandJournal::State appliedState_{};
+    RoomStatePublisher statePublisher_{};
+    std::atomic<unsigned> numStateStreams_{0};
+    /// Read-only copy of the scene for http workers, published at the end of each update.
+    std::unique_ptr<SceneMirror> sceneMirror_{};
+    /// Commands applied this frame, waiting for the frame to be presented. Frame thread only.
+    PODVector<RoomCommand> presentingCommands_{};
+    /// Scratch buffer for the nodes of a command target. Frame thread only.
+    PODVector<Node*> targetNodes_{};
+    /// Parent of the room content.
+    SharedPtr<Node> roomNode_{};
+    /// Loader streaming in the room, until it has finished.
+    SharedPtr<RoomLoader> roomLoader_{};
+    /// Animation of the disco lights and the welcome box.
+    WeakPtr<BatchedAnimation> animation_{};
+    /// Pauses the disco lights out of view.
+    SharedPtr<ActivationManager> activationManager_{};
+    /// Random paths and colour orders of the disco lights, seeded in Setup().
+    std::mt19937 discoRandom_{};
+    /// Whether the viewport uses the deferred render path because of the number of disco lights.
+    bool deferredShading_{false};
 };
@@ -0,0 +1,203 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Graphics/Camera.h>
+#include <Urho3D/Graphics/Geometry.h>
+#include <Urho3D/Graphics/Material.h>
+#include <Urho3D/Graphics/Model.h>
+#include <Urho3D/Graphics/OctreeQuery.h>
+#include <Urho3D/Scene/Node.h>
+
+#include "PropField.h"
+
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+
+#include <Urho3D/DebugNew.h>
+
+using namespace Urho3D;
+
+namespace
+{
+
+const Vector3 DOT_SCALE(1 / 3.0f, 1 / 3.0f, 1 / 3.0f);
+
+} // namespace
+
+PropChunk::PropChunk(Context* context)
+    : StaticModel(context)
+{
+}
+
+void PropChunk::RegisterObject(Context* context)
+{
+    context->RegisterFactory<PropChunk>();
+}
+
+void PropChunk::ProcessRayQuery(const RayOctreeQuery& query, PODVector<RayQueryResult>& results)
+{
+    // GetWorldBoundingBox() updates the world transforms
+    if (query.ray_.HitDistance(GetWorldBoundingBox()) >= query.maxDistance_)
+        return;
+
+    for (unsigned i = 0; i < worldTransforms_.size(); ++i)
+    {
+        const Matrix3x4& worldTransform = worldTransforms_[i];
+        float distance = query.ray_.HitDistance(boundingBox_.Transformed(worldTransform));
+        Vector3 normal = -query.ray_.direction_;
+        if (query.level_ >= RAY_OBB && distance < query.maxDistance_)
+        {
+            const Ray localRay = query.ray_.Transformed(worldTransform.Inverse());
+            distance = localRay.HitDistance(boundingBox_);
+            if (query.level_ == RAY_TRIANGLE && distance < query.maxDistance_)
+            {
+                distance = M_INFINITY;
+                for (const SourceBatch& batch : batches_)
+                {
+                    if (!batch.geometry_)
+                        continue;
+                    Vector3 geometryNormal;
+                    const float geometryDistance = batch.geometry_->GetHitDistance(localRay, &geometryNormal);
+                    if (geometryDistance < query.maxDistance_ && geometryDistance < distance)
+                    {
+                        distance = geometryDistance;
+                        normal = (worldTransform * Vector4(geometryNormal, 0.0f)).Normalized();
+                    }
+                }
+            }
+        }
+
+        if (distance < query.maxDistance_)
+        {
+            RayQueryResult result;
+            result.position_ = query.ray_.origin_ + distance * query.ray_.direction_;
+            result.normal_ = normal;
+            result.distance_ = distance;
+            result.drawable_ = this;
+            result.node_ = node_;
+            result.subObject_ = i;
+            results.Push(result);
+        }
+    }
+}
+
+void PropChunk::UpdateBatches(const FrameInfo& frame)
+{
+    // Getting the world bounding box ensures the transforms are updated
+    const BoundingBox& worldBoundingBox = GetWorldBoundingBox();
+    distance_ = frame.camera_->GetDistance(worldBoundingBox.Center());
+
+    // All instances in one batch per geometry, so that the renderer instances them together
+    const Matrix3x4* worldTransforms = worldTransforms_.empty() ? &Matrix3x4::IDENTITY : worldTransforms_.data();
+    for (SourceBatch& batch : batches_)
+    {
+        batch.distance_ = distance_;
+        batch.worldTransform_ = worldTransforms;
+        batch.numWorldTransforms_ = (unsigned)worldTransforms_.size();
+    }
+
+    // The LOD of an instance at the chunk centre applies to the whole chunk, in the main view and the shadow maps
+    const float scale = boundingBox_.Size().DotProduct(DOT_SCALE);
+    const float newLodDistance = frame.camera_->GetLodDistance(distance_, scale, lodBias_);
+    if (newLodDistance != lodDistance_)
+    {
+        lodDistance_ = newLodDistance;
+        CalculateLodLevels();
+    }
+}
+
+void PropChunk::SetInstances(std::vector<Matrix3x4> transforms)
+{
+    transforms_ = std::move(transforms);
+    worldTransforms_.resize(transforms_.size());
+    OnMarkedDirty(node_);
+}
+
+void PropChunk::OnWorldBoundingBoxUpdate()
+{
+    // Update transforms and bounding box at the same time to go through the instances only once
+    const Matrix3x4& nodeTransform = node_->GetWorldTransform();
+    BoundingBox worldBox;
+    for (unsigned i = 0; i < transforms_.size(); ++i)
+    {
+        worldTransforms_[i] = nodeTransform * transforms_[i];
+        worldBox.Merge(boundingBox_.Transformed(worldTransforms_[i]));
+    }
+    worldBoundingBox_ = worldBox;
+}
+
+PropField::PropField(Context* context)
+    : Component(context)
+{
+}
+
+void PropField::RegisterObject(Context* context)
+{
+    context->RegisterFactory<PropField>();
+    PropChunk::RegisterObject(context);
+}
+
+void PropField::SetModel(Model* model, Material* material)
+{
+    model_ = model;
+    material_ = material;
+}
+
+void PropField::SetChunkSize(float size)
+{
+    chunkSize_ = Max(size, M_EPSILON);
+}
+
+void PropField::SetShadowDistance(float distance)
+{
+    shadowDistance_ = Max(distance, 0.0f);
+}
+
+void PropField::SetInstances(const std::vector<Matrix3x4>& transforms)
+{
+    RemoveChunks();
+    numInstances_ = (unsigned)transforms.size();
+    if (!node_ || transforms.empty())
+        return;
+
+    // Bin the instances by the cell their position falls into
+    std::unordered_map<unsigned long long, unsigned> cellChunks;
+    std::vector<std::vector<Matrix3x4>> chunkTransforms;
+    for (const Matrix3x4& transform : transforms)
+    {
+        const Vector3 position = transform.Translation();
+        const auto x = (long long)std::floor(position.x_ / chunkSize_);
+        const auto z = (long long)std::floor(position.z_ / chunkSize_);
+        // Shifted unsigned: a left shift of a negative cell coordinate is undefined before C++20
+        const unsigned long long key = (unsigned long long)x << 32 | (uint32_t)z;
+        const auto inserted = cellChunks.emplace(key, (unsigned)chunkTransforms.size());
+        if (inserted.second)
+            chunkTransforms.emplace_back();
+        chunkTransforms[inserted.first->second].push_back(transform);
+    }
+
+    chunkNodes_.reserve(chunkTransforms.size());
+    for (std::vector<Matrix3x4>& chunk : chunkTransforms)
+    {
+        Node* chunkNode = node_->CreateChild("PropChunk", LOCAL);
+        auto* propChunk = chunkNode->CreateComponent<PropChunk>(LOCAL);
+        propChunk->SetModel(model_);
+        propChunk->SetMaterial(material_);
+        propChunk->SetCastShadows(true);
+        propChunk->SetShadowDistance(shadowDistance_);
+        propChunk->SetInstances(std::move(chunk));
+        chunkNodes_.emplace_back(chunkNode);
+    }
+}
+
+void PropField::RemoveChunks()
+{
+    for (const WeakPtr<Node>& chunkNode : chunkNodes_)
+    {
+        if (chunkNode)
+            chunkNode->Remove();
+    }
+    chunkNodes_.clear();
+}
@@ -0,0 +1,91 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#pragma once
+
+#include <Urho3D/Graphics/StaticModel.h>
+#include <Urho3D/Math/Matrix3x4.h>
+#include <vector>
+
+namespace Urho3D
+{
+class Material;
+class Model;
+} // namespace Urho3D
+
+/// Instances of one model within a cell of a PropField, drawn as one drawable. The instance transforms are packed in a
+/// contiguous array handed to the renderer as a single batch, which draws them with hardware instancing where
+/// supported. The octree culls, sorts and selects the LOD of the chunk as a whole, like StaticModelGroup does for its
+/// instance nodes.
+class PropChunk : public Urho3D::StaticModel
+{
+    URHO3D_OBJECT(PropChunk, Urho3D::StaticModel);
+
+public:
+    /// Construct.
+    explicit PropChunk(Urho3D::Context* context);
+    /// Register object factory.
+    static void RegisterObject(Urho3D::Context* context);
+
+    /// Process octree raycast, testing each instance. May be called from a worker thread.
+    void ProcessRayQuery(const Urho3D::RayOctreeQuery& query, Urho3D::PODVector<Urho3D::RayQueryResult>& results) override;
+    /// Calculate distance and prepare batches for rendering. May be called from worker thread(s), possibly
+    /// re-entrantly.
+    void UpdateBatches(const Urho3D::FrameInfo& frame) override;
+
+    /// Set the instance transforms, relative to the node.
+    void SetInstances(std::vector<Urho3D::Matrix3x4> transforms);
+    /// Return the number of instances.
+    unsigned GetNumInstances() const { return (unsigned)transforms_.size(); }
+    /// Return the instance transforms, relative to the node.
+    const std::vector<Urho3D::Matrix3x4>& GetInstances() const { return transforms_; }
+
+protected:
+    /// Recalculate the world transforms of the instances and the world-space bounding box.
+    void OnWorldBoundingBoxUpdate() override;
+
+private:
+    /// Instance transforms relative to the node.
+    std::vector<Urho3D::Matrix3x4> transforms_{};
+    /// Instance world transforms. Sized with transforms_ so that worker threads updating them do not allocate.
+    std::vector<Urho3D::Matrix3x4> worldTransforms_{};
+};
+
+/// Many instances of one model, such as vegetation or props, without a scene node per instance. The instances are
+/// binned into square cells on the XZ plane, one PropChunk per cell, so that the octree culls them by cell. Chunks
+/// past the shadow distance do not render shadow casters.
+class PropField : public Urho3D::Component
+{
+    URHO3D_OBJECT(PropField, Urho3D::Component);
+
+public:
+    /// Construct.
+    explicit PropField(Urho3D::Context* context);
+    /// Register object factory.
+    static void RegisterObject(Urho3D::Context* context);
+
+    /// Set the model and material of the instances. Applies to instances set afterwards.
+    void SetModel(Urho3D::Model* model, Urho3D::Material* material);
+    /// Set the side of the chunk cells in world units. Applies to instances set afterwards.
+    void SetChunkSize(float size);
+    /// Set the distance beyond which chunks cast no shadows, 0 for no limit. Applies to instances set afterwards.
+    void SetShadowDistance(float distance);
+    /// Replace the instances. Transforms are relative to the node.
+    void SetInstances(const std::vector<Urho3D::Matrix3x4>& transforms);
+
+    /// Return the number of instances.
+    unsigned GetNumInstances() const { return numInstances_; }
+    /// Return the number of chunks.
+    unsigned GetNumChunks() const { return (unsigned)chunkNodes_.size(); }
+
+private:
+    /// Remove the chunk nodes.
+    void RemoveChunks();
+
+    Urho3D::SharedPtr<Urho3D::Model> model_{};
+    Urho3D::SharedPtr<Urho3D::Material> material_{};
+    float chunkSize_{10.0f};
+    float shadowDistance_{0.0f};
+    unsigned numInstances_{0};
+    std::vector<Urho3D::WeakPtr<Urho3D::Node>> chunkNodes_{};
+};
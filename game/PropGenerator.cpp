@@ -0,0 +1,91 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#include <Urho3D/Core/WorkQueue.h>
+
+#include "PropGenerator.h"
+
+#include <random>
+
+#include <Urho3D/DebugNew.h>
+
+using namespace Urho3D;
+
+namespace
+{
+
+/// Props per work item, and per random stream. Fixed so that the layout does not depend on the number of threads.
+const unsigned PROPS_PER_BLOCK = 4096;
+
+/// Return a float in [0, 1) from the top 24 bits of the generator output. Unlike std::uniform_real_distribution,
+/// whose algorithm is up to the standard library, this gives the same layout on every platform.
+float NextFloat(std::mt19937& random)
+{
+    return (float)(random() >> 8) * (1.0f / 16777216.0f);
+}
+
+} // namespace
+
+PropGenerator::PropGenerator(Context* context)
+    : Object(context)
+{
+}
+
+void PropGenerator::SetScaleRange(float minScale, float maxScale)
+{
+    minScale_ = minScale;
+    maxScale_ = Max(minScale, maxScale);
+}
+
+std::vector<Matrix3x4> PropGenerator::Generate(unsigned count) const
+{
+    std::vector<Matrix3x4> transforms(count);
+    const unsigned numBlocks = (count + PROPS_PER_BLOCK - 1) / PROPS_PER_BLOCK;
+    std::vector<Block> blocks(numBlocks);
+    for (unsigned i = 0; i < numBlocks; ++i)
+    {
+        const unsigned first = i * PROPS_PER_BLOCK;
+        blocks[i] = Block{this, i, transforms.data() + first, Min(PROPS_PER_BLOCK, count - first)};
+    }
+
+    auto* queue = GetSubsystem<WorkQueue>();
+    if (!queue || numBlocks < 2)
+    {
+        for (const Block& block : blocks)
+            GenerateBlock(block);
+        return transforms;
+    }
+
+    // The main thread works on the blocks too while waiting
+    for (Block& block : blocks)
+    {
+        SharedPtr<WorkItem> item = queue->GetFreeItem();
+        item->priority_ = M_MAX_UNSIGNED;
+        item->workFunction_ = GenerateWork;
+        item->aux_ = &block;
+        queue->AddWorkItem(item);
+    }
+    queue->Complete(M_MAX_UNSIGNED);
+    return transforms;
+}
+
+void PropGenerator::GenerateBlock(const Block& block) const
+{
+    std::seed_seq seed{seed_, block.index_};
+    std::mt19937 random(seed);
+    const float halfArea = areaSize_ * 0.5f;
+    for (unsigned i = 0; i < block.count_; ++i)
+    {
+        const float x = NextFloat(random) * areaSize_ - halfArea;
+        const float z = NextFloat(random) * areaSize_ - halfArea;
+        const float yaw = NextFloat(random) * 360.0f;
+        const float scale = minScale_ + NextFloat(random) * (maxScale_ - minScale_);
+        block.transforms_[i] = Matrix3x4(Vector3(x, 0.0f, z), Quaternion(0.0f, yaw, 0.0f), scale);
+    }
+}
+
+void PropGenerator::GenerateWork(const WorkItem* item, unsigned threadIndex)
+{
+    const auto* block = static_cast<const Block*>(item->aux_);
+    block->generator_->GenerateBlock(*block);
+}
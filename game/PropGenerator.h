@@ -0,0 +1,55 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#pragma once
+
+#include <Urho3D/Core/Object.h>
+#include <Urho3D/Math/Matrix3x4.h>
+#include <vector>
+
+namespace Urho3D
+{
+struct WorkItem;
+}
+
+/// Computes the transforms of scattered props on the WorkQueue threads. The props are generated in fixed-size blocks,
+/// each with its own random stream seeded from the seed and the block index, so the layout depends only on the seed
+/// and the count, not on the number of threads or the order the blocks run in. Call from the main thread.
+class PropGenerator : public Urho3D::Object
+{
+    URHO3D_OBJECT(PropGenerator, Urho3D::Object);
+
+public:
+    /// Construct.
+    explicit PropGenerator(Urho3D::Context* context);
+
+    /// Set the seed of the random streams.
+    void SetSeed(unsigned seed) { seed_ = seed; }
+    /// Set the side of the square area centred on the origin of the XZ plane the props are scattered over.
+    void SetAreaSize(float size) { areaSize_ = size; }
+    /// Set the range of the uniform scale of the props.
+    void SetScaleRange(float minScale, float maxScale);
+
+    /// Return the transforms of a number of props, randomly positioned, rotated about the Y axis and scaled.
+    std::vector<Urho3D::Matrix3x4> Generate(unsigned count) const;
+
+private:
+    /// Props generated by one work item.
+    struct Block
+    {
+        const PropGenerator* generator_;
+        unsigned index_;
+        Urho3D::Matrix3x4* transforms_;
+        unsigned count_;
+    };
+
+    /// Fill the transforms of a block.
+    void GenerateBlock(const Block& block) const;
+    /// Work function generating a Block.
+    static void GenerateWork(const Urho3D::WorkItem* item, unsigned threadIndex);
+
+    unsigned seed_{1};
+    float areaSize_{90.0f};
+    float minScale_{0.5f};
+    float maxScale_{2.5f};
+};
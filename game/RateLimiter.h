@@ -0,0 +1,90 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+/// Per-client token buckets that http workers may check concurrently without locking. A client, identified by a hash
+/// of its address, maps to a slot of a fixed table; the slots are the shards, each on its own cache line, so clients
+/// only contend with themselves. A bucket is kept as the time at which it will be full again (the generic cell rate
+/// algorithm), which a check advances by one token interval with a compare-and-swap. A slot whose bucket is full again
+/// may be taken over by another client. When every probed slot is busy, the client shares the first one, so the table
+/// never grows: colliding clients are limited together rather than not at all.
+class RateLimiter
+{
+public:
+    /// Slots probed for a client before it shares one.
+    static constexpr unsigned MAX_PROBES = 4;
+
+    /// Construct with a sustained rate per client and the number of requests a client may send at once after being
+    /// idle. The slot count is rounded up to a power of two.
+    RateLimiter(double ratePerSecond, unsigned burst, unsigned numSlots = 1024)
+        : intervalNs_(ratePerSecond > 0.0 ? (long long)(1e9 / ratePerSecond) : 0)
+        , toleranceNs_(intervalNs_ * (long long)(burst > 0 ? burst - 1 : 0))
+    {
+        while (numSlots_ < numSlots)
+            numSlots_ *= 2;
+        slots_.reset(new Slot[numSlots_]);
+    }
+
+    /// Take a token for a client at a time in nanoseconds. Return 0 if one was available, or else the nanoseconds
+    /// until there is one. Always 0 when the rate is 0 (unlimited).
+    long long Acquire(uint64_t client, long long nowNs)
+    {
+        if (!intervalNs_)
+            return 0;
+        // 0 marks a free slot
+        client = client ? client : 1;
+
+        Slot& slot = FindSlot(client, nowNs);
+        long long full = slot.full_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            const long long start = full > nowNs ? full : nowNs;
+            if (start - nowNs > toleranceNs_)
+                return start - nowNs - toleranceNs_;
+            if (slot.full_.compare_exchange_weak(full, start + intervalNs_, std::memory_order_relaxed))
+                return 0;
+        }
+    }
+
+    /// Return the number of slots.
+    unsigned GetNumSlots() const { return numSlots_; }
+
+private:
+    struct alignas(64) Slot
+    {
+        std::atomic<uint64_t> client_{0};
+        /// Time at which the bucket is full again, in nanoseconds.
+        std::atomic<long long> full_{0};
+    };
+
+    /// Return the slot of a client, claiming a free or idle one if it has none.
+    Slot& FindSlot(uint64_t client, long long nowNs)
+    {
+        const unsigned mask = numSlots_ - 1;
+        for (unsigned i = 0; i < MAX_PROBES; ++i)
+        {
+            Slot& slot = slots_[(client + i) & mask];
+            uint64_t owner = slot.client_.load(std::memory_order_relaxed);
+            if (owner == client)
+                return slot;
+            // A full bucket is the same as a fresh one, so an idle client loses nothing when its slot is taken
+            if ((!owner || slot.full_.load(std::memory_order_relaxed) <= nowNs) &&
+                slot.client_.compare_exchange_strong(owner, client, std::memory_order_relaxed))
+                return slot;
+            if (owner == client)
+                return slot;
+        }
+        return slots_[client & mask];
+    }
+
+    long long intervalNs_;
+    /// How far ahead of now the full time may be for a token to be available: burst - 1 intervals.
+    long long toleranceNs_;
+    unsigned numSlots_{1};
+    std::unique_ptr<Slot[]> slots_{};
+};
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/// Single-writer, multi-reader publication of immutable values (read-copy-update). The writer publishes a new value
+/// with one atomic exchange; readers pin the current epoch, read the value without locking and unpin. Replaced values
+/// are retired with the epoch they were replaced in and reclaimed once every pinned reader has moved past it. Reclaimed
+/// values are kept for reuse, so a writer that refills them each frame stops allocating once warmed up.
+template <typename T, unsigned MAX_READERS = 64> class RcuPublisher
+{
+public:
+    RcuPublisher() { current_.store(new T(), std::memory_order_relaxed); }
+
+    ~RcuPublisher()
+    {
+        delete current_.load(std::memory_order_relaxed);
+        for (const Retired& retired : retired_)
+            delete retired.value_;
+    }
+
+    RcuPublisher(const RcuPublisher&) = delete;
+    RcuPublisher& operator=(const RcuPublisher&) = delete;
+
+    /// Call a function with the current value, without blocking the writer. The reference must not escape the
+    /// function. Thread safe; at most MAX_READERS threads read at once, further readers spin.
+    template <typename Function> auto Read(Function&& function) const
+    {
+        Pin pin(*this);
+        return function(*current_.load(std::memory_order_seq_cst));
+    }
+
+    /// Return a value to fill in and publish, reusing a reclaimed one when possible. Writer only.
+    std::unique_ptr<T> Acquire()
+    {
+        if (free_.empty())
+            return std::make_unique<T>();
+        std::unique_ptr<T> value = std::move(free_.back());
+        free_.pop_back();
+        return value;
+    }
+
+    /// Make a value the current one and reclaim what no reader can see anymore. Writer only.
+    void Publish(std::unique_ptr<T> value)
+    {
+        T* previous = current_.exchange(value.release(), std::memory_order_seq_cst);
+        retired_.push_back(Retired{previous, epoch_.fetch_add(1, std::memory_order_seq_cst)});
+        Reclaim();
+    }
+
+private:
+    struct alignas(64) Slot
+    {
+        /// Epoch the reader pinned, 0 when unused.
+        std::atomic<uint64_t> epoch_{0};
+    };
+
+    struct Retired
+    {
+        T* value_;
+        uint64_t epoch_;
+    };
+
+    /// Marks a reader active in the current epoch for its lifetime.
+    class Pin
+    {
+    public:
+        explicit Pin(const RcuPublisher& publisher)
+        {
+            // Start scanning at a per-thread offset so concurrent readers rarely contend for a slot
+            static std::atomic<unsigned> nextHint{0};
+            thread_local unsigned hint = nextHint.fetch_add(1, std::memory_order_relaxed);
+            for (unsigned i = hint;; ++i)
+            {
+                Slot& slot = publisher.slots_[i % MAX_READERS];
+                uint64_t expected = 0;
+                // Publish the epoch before loading the value: the writer then sees the pin when it scans
+                if (slot.epoch_.compare_exchange_weak(expected, publisher.epoch_.load(std::memory_order_seq_cst),
+                                                      std::memory_order_seq_cst))
+                {
+                    slot_ = &slot;
+                    return;
+                }
+            }
+        }
+
+        ~Pin() { slot_->epoch_.store(0, std::memory_order_release); }
+
+    private:
+        Slot* slot_;
+    };
+
+    void Reclaim()
+    {
+        uint64_t oldestPinned = UINT64_MAX;
+        for (const Slot& slot : slots_)
+        {
+            const uint64_t epoch = slot.epoch_.load(std::memory_order_seq_cst);
+            if (epoch)
+                oldestPinned = std::min(oldestPinned, epoch);
+        }
+
+        // A reader pinned in epoch E may hold any value retired in epoch E or later
+        auto it = std::remove_if(retired_.begin(), retired_.end(),
+                                 [&](const Retired& retired)
+                                 {
+                                     if (retired.epoch_ >= oldestPinned)
+                                         return false;
+                                     if (free_.size() < MAX_FREE)
+                                         free_.emplace_back(retired.value_);
+                                     else
+                                         delete retired.value_;
+                                     return true;
+                                 });
+        retired_.erase(it, retired_.end());
+    }
+
+    static constexpr size_t MAX_FREE = 4;
+
+    std::atomic<T*> current_{nullptr};
+    /// Starts at 1 so that 0 can mark an unused slot.
+    std::atomic<uint64_t> epoch_{1};
+    mutable Slot slots_[MAX_READERS];
+    /// Replaced values not reclaimed yet. Writer only.
+    std::vector<Retired> retired_{};
+    /// Reclaimed values for reuse. Writer only.
+    std::vector<std::unique_ptr<T>> free_{};
+};
@@ -0,0 +1,131 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#include <Urho3D/Core/StringUtils.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/IO/Log.h>
+
+#include "CommandMetrics.h"
+#include "ReplayBenchmark.h"
+
+#include <cstdio>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include <Urho3D/DebugNew.h>
+
+using namespace Urho3D;
+
+namespace
+{
+
+/// Return the peak resident set size of the process in kilobytes, or 0 if unknown.
+unsigned long long GetPeakRssKB()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize / 1024;
+    return 0;
+#else
+    rusage usage{};
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    // Reported in bytes on macOS, kilobytes elsewhere
+    return (unsigned long long)usage.ru_maxrss / 1024;
+#else
+    return (unsigned long long)usage.ru_maxrss;
+#endif
+#endif
+}
+
+} // namespace
+
+ReplayBenchmark::ReplayBenchmark(Context* context)
+    : Object(context)
+{
+}
+
+bool ReplayBenchmark::Load(const String& fileName)
+{
+    File file(context_);
+    if (!file.Open(fileName, FILE_READ))
+        return false;
+
+    entries_.clear();
+    while (!file.IsEof())
+    {
+        const String line = file.ReadLine().Trimmed();
+        if (line.Empty() || line.StartsWith("#"))
+            continue;
+
+        const unsigned separator = line.Find(' ');
+        if (separator == String::NPOS)
+        {
+            URHO3D_LOGERROR("Malformed replay line: " + line);
+            return false;
+        }
+        Entry entry;
+        entry.offsetUs_ = (long long)(ToDouble(line.Substring(0, separator)) * 1000.0);
+        entry.body_ = line.Substring(separator + 1).Trimmed().CString();
+        entries_.push_back(std::move(entry));
+    }
+
+    URHO3D_LOGINFO("Loaded " + String((unsigned)entries_.size()) + " replay commands from " + fileName);
+    return !entries_.empty();
+}
+
+void ReplayBenchmark::Update()
+{
+    if (!started_)
+    {
+        clock_.Reset();
+        started_ = true;
+    }
+
+    ++numFrames_;
+    const long long now = clock_.GetUSec(false);
+    while (next_ < entries_.size() && entries_[next_].offsetUs_ <= now)
+    {
+        injector_(entries_[next_].body_);
+        ++next_;
+    }
+}
+
+void ReplayBenchmark::RecordDrainTime(long long ns)
+{
+    drainTime_.Record(ns);
+}
+
+std::string ReplayBenchmark::MakeReport(const CommandMetrics& metrics) const
+{
+    LatencyHistogram latency;
+    uint64_t numElided = 0;
+    for (unsigned op = 0; op < MAX_COMMAND_OPS; ++op)
+    {
+        for (unsigned target = 0; target < MAX_COMMAND_TARGETS; ++target)
+        {
+            latency.Merge(metrics.GetHistogram((CommandOp)op, (CommandTarget)target, STAGE_TOTAL));
+            numElided += metrics.GetNumElided((CommandOp)op, (CommandTarget)target);
+        }
+    }
+
+    const double seconds = clock_.GetUSec(false) / 1e6;
+    char report[1024];
+    snprintf(report, sizeof(report),
+             "{\"commands\": %u, \"elided\": %llu, \"frames\": %u, \"durationSeconds\": %.3f, "
+             "\"commandsPerSecond\": %.1f, \"drainMs\": {\"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f}, "
+             "\"latencyMs\": {\"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f}, \"peakRssKB\": %llu}",
+             (unsigned)entries_.size(), (unsigned long long)numElided, numFrames_, seconds,
+             seconds > 0.0 ? entries_.size() / seconds : 0.0,
+             drainTime_.GetValueAtQuantile(0.5) / 1e6, drainTime_.GetValueAtQuantile(0.99) / 1e6,
+             drainTime_.GetValueAtQuantile(1.0) / 1e6, latency.GetValueAtQuantile(0.5) / 1e6,
+             latency.GetValueAtQuantile(0.99) / 1e6, latency.GetValueAtQuantile(1.0) / 1e6, GetPeakRssKB());
+    return report;
+}
@@ -0,0 +1,60 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#pragma once
+
+#include "LatencyHistogram.h"
+#include <Urho3D/Core/Object.h>
+#include <Urho3D/Core/Timer.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+class CommandMetrics;
+
+/// Replays a timestamped command log through the /cmd request path and reports throughput, per-frame drain time,
+/// command latency and peak memory. Used by the --headless --replay benchmark mode. Main thread only.
+///
+/// The log has one command per line: the offset in milliseconds from the start of the replay, a space, and the /cmd
+/// request body. Empty lines and lines starting with '#' are ignored.
+class ReplayBenchmark : public Urho3D::Object
+{
+    URHO3D_OBJECT(ReplayBenchmark, Urho3D::Object);
+
+public:
+    /// Function handing a request body to the /cmd handler.
+    using Injector = std::function<void(const std::string& body)>;
+
+    /// Construct.
+    explicit ReplayBenchmark(Urho3D::Context* context);
+
+    /// Load a command log. Return false on failure.
+    bool Load(const Urho3D::String& fileName);
+    /// Set the function commands are injected with.
+    void SetInjector(Injector injector) { injector_ = std::move(injector); }
+
+    /// Inject the commands that are due. Call once per frame before the queued commands are run.
+    void Update();
+    /// Record the time the frame spent running queued commands.
+    void RecordDrainTime(long long ns);
+    /// Return whether every command has been injected.
+    bool IsInjectionFinished() const { return next_ >= entries_.size(); }
+
+    /// Return the report as JSON, with command latencies taken from the metrics.
+    std::string MakeReport(const CommandMetrics& metrics) const;
+
+private:
+    struct Entry
+    {
+        long long offsetUs_;
+        std::string body_;
+    };
+
+    std::vector<Entry> entries_{};
+    size_t next_{0};
+    Injector injector_{};
+    Urho3D::HiresTimer clock_{};
+    bool started_{false};
+    unsigned numFrames_{0};
+    LatencyHistogram drainTime_{};
+};
@@ -0,0 +1,84 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#include <Urho3D/IO/Log.h>
+#include <Urho3D/Resource/ResourceCache.h>
+#include <Urho3D/Resource/ResourceEvents.h>
+
+#include "ResourcePreloader.h"
+
+#include <Urho3D/DebugNew.h>
+
+using namespace Urho3D;
+
+ResourcePreloader::ResourcePreloader(Context* context)
+    : Object(context)
+{
+}
+
+void ResourcePreloader::Add(StringHash type, const String& name)
+{
+    if (entries_.Contains(name))
+        return;
+
+    Entry entry;
+    entry.type_ = type;
+    entries_[name] = entry;
+    numTotal_.fetch_add(1, std::memory_order_release);
+}
+
+void ResourcePreloader::Start()
+{
+    SubscribeToEvent(E_RESOURCEBACKGROUNDLOADED, URHO3D_HANDLER(ResourcePreloader, HandleResourceBackgroundLoaded));
+
+    auto* cache = GetSubsystem<ResourceCache>();
+    for (auto it = entries_.Begin(); it != entries_.End(); ++it)
+    {
+        // BackgroundLoadResource returns false when the resource already exists (or, without threading support, when
+        // the synchronous fallback failed), in which case no event will follow
+        if (!cache->BackgroundLoadResource(it->second_.type_, it->first_))
+            MarkLoaded(it->first_, cache->GetExistingResource(it->second_.type_, it->first_) != nullptr);
+    }
+}
+
+bool ResourcePreloader::IsLoaded(const String& name) const
+{
+    auto it = entries_.Find(name);
+    return it == entries_.End() || it->second_.loaded_;
+}
+
+bool ResourcePreloader::IsLoaded(const StringVector& names) const
+{
+    for (const String& name : names)
+    {
+        if (!IsLoaded(name))
+            return false;
+    }
+    return true;
+}
+
+void ResourcePreloader::HandleResourceBackgroundLoaded(StringHash eventType, VariantMap& eventData)
+{
+    using namespace ResourceBackgroundLoaded;
+
+    MarkLoaded(eventData[P_RESOURCENAME].GetString(), eventData[P_SUCCESS].GetBool());
+}
+
+void ResourcePreloader::MarkLoaded(const String& name, bool success)
+{
+    auto it = entries_.Find(name);
+    // Dependencies of manifest entries (e.g. textures of a material) are reported too, ignore them
+    if (it == entries_.End() || it->second_.loaded_)
+        return;
+
+    it->second_.loaded_ = true;
+    if (!success)
+    {
+        URHO3D_LOGWARNING("Failed to preload " + name);
+        numFailed_.fetch_add(1, std::memory_order_release);
+    }
+    numLoaded_.fetch_add(1, std::memory_order_release);
+
+    if (IsReady())
+        URHO3D_LOGINFO("Preloaded " + String(numTotal_.load()) + " resources");
+}
@@ -0,0 +1,57 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#pragma once
+
+#include <Urho3D/Container/HashMap.h>
+#include <Urho3D/Core/Object.h>
+#include <atomic>
+
+/// Loads a manifest of resources with ResourceCache::BackgroundLoadResource and tracks when each has finished.
+/// Registration and IsLoaded() are for the main thread only; the counters may be read from any thread.
+class ResourcePreloader : public Urho3D::Object
+{
+    URHO3D_OBJECT(ResourcePreloader, Urho3D::Object);
+
+public:
+    /// Construct.
+    explicit ResourcePreloader(Urho3D::Context* context);
+
+    /// Add a resource to the manifest. Must be called before Start().
+    void Add(Urho3D::StringHash type, const Urho3D::String& name);
+    /// Queue every resource of the manifest for background loading.
+    void Start();
+
+    /// Return whether a resource has finished loading (successfully or not). Resources not in the manifest are
+    /// considered loaded, since they will be loaded synchronously on demand anyway.
+    bool IsLoaded(const Urho3D::String& name) const;
+    /// Return whether all the given resources have finished loading.
+    bool IsLoaded(const Urho3D::StringVector& names) const;
+
+    /// Return whether the whole manifest has finished loading. Thread safe.
+    bool IsReady() const { return numLoaded_.load(std::memory_order_acquire) == numTotal_.load(std::memory_order_acquire); }
+    /// Return number of resources that have finished loading. Thread safe.
+    unsigned GetNumLoaded() const { return numLoaded_.load(std::memory_order_acquire); }
+    /// Return number of resources that failed to load. Thread safe.
+    unsigned GetNumFailed() const { return numFailed_.load(std::memory_order_acquire); }
+    /// Return number of resources in the manifest. Thread safe.
+    unsigned GetNumTotal() const { return numTotal_.load(std::memory_order_acquire); }
+
+private:
+    /// Handle a background load finishing.
+    void HandleResourceBackgroundLoaded(Urho3D::StringHash eventType, Urho3D::VariantMap& eventData);
+    /// Mark a manifest entry as finished.
+    void MarkLoaded(const Urho3D::String& name, bool success);
+
+    struct Entry
+    {
+        Urho3D::StringHash type_;
+        bool loaded_{false};
+    };
+
+    /// Manifest entries by resource name.
+    Urho3D::HashMap<Urho3D::String, Entry> entries_{};
+    std::atomic<unsigned> numLoaded_{0};
+    std::atomic<unsigned> numFailed_{0};
+    std::atomic<unsigned> numTotal_{0};
+};
@@ -0,0 +1,113 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#pragma once
+
+#include <Urho3D/Container/Str.h>
+#include <chrono>
+
+/// Command operations of the /cmd protocol. The set operations change the existing nodes of a target in place and do
+/// nothing while it is off; their numeric parameters are given as "value", a number or an array of numbers.
+enum CommandOp : unsigned char
+{
+    CMD_LIGHTON = 0,
+    CMD_LIGHTOFF,
+    /// Number of disco lights: [count].
+    CMD_SETCOUNT,
+    /// Light colour, or the diffuse colour of the welcome box: [r, g, b].
+    CMD_SETCOLOR,
+    /// Light brightness: [brightness].
+    CMD_SETINTENSITY,
+    /// Fog distances of the zone created by the sun: [start, end].
+    CMD_SETFOG,
+    /// Direction of the sun, or position of the welcome box: [x, y, z].
+    CMD_SETTRANSFORM,
+    MAX_COMMAND_OPS
+};
+
+/// Maximum number of numeric parameters of a command.
+static const unsigned MAX_COMMAND_PARAMS = 4;
+
+/// Command targets of the /cmd protocol. Each target is also the tag of the scene nodes it creates.
+enum CommandTarget : unsigned char
+{
+    TARGET_SUN = 0,
+    TARGET_DISCO,
+    TARGET_WELCOME,
+    MAX_COMMAND_TARGETS
+};
+
+/// Points in time along the path of a command, in nanoseconds of the steady clock. Zero if not reached.
+struct CommandTimestamps
+{
+    /// Request headers parsed by the http worker.
+    long long headersParsed_{0};
+    /// Command pushed to the frame thread.
+    long long enqueued_{0};
+    /// Command picked up by HandleUpdate.
+    long long dequeued_{0};
+    /// Command applied to the scene.
+    long long completed_{0};
+};
+
+/// A parsed /cmd request, handed from the http thread to the frame thread.
+struct RoomCommand
+{
+    CommandOp op_{MAX_COMMAND_OPS};
+    CommandTarget target_{MAX_COMMAND_TARGETS};
+    /// Numeric parameters, carried inline so that setting them does not allocate.
+    float params_[MAX_COMMAND_PARAMS]{};
+    CommandTimestamps time_{};
+};
+
+static const char* const COMMAND_OP_NAMES[] = {"lighton",      "lightoff", "setcount",    "setcolor",
+                                               "setintensity", "setfog",   "settransform"};
+static const unsigned COMMAND_OP_NUM_PARAMS[] = {0, 0, 1, 3, 1, 2, 3};
+static const char* const COMMAND_TARGET_NAMES[] = {"sun", "disco", "welcome"};
+
+/// Return the protocol name of an operation.
+inline const char* GetCommandOpName(CommandOp op)
+{
+    return op < MAX_COMMAND_OPS ? COMMAND_OP_NAMES[op] : "";
+}
+
+/// Return the number of numeric parameters an operation takes.
+inline unsigned GetCommandNumParams(CommandOp op)
+{
+    return op < MAX_COMMAND_OPS ? COMMAND_OP_NUM_PARAMS[op] : 0;
+}
+
+/// Return the protocol name of a target.
+inline const char* GetCommandTargetName(CommandTarget target)
+{
+    return target < MAX_COMMAND_TARGETS ? COMMAND_TARGET_NAMES[target] : "";
+}
+
+/// Parse an operation name. Return MAX_COMMAND_OPS if unknown.
+inline CommandOp ParseCommandOp(const Urho3D::String& name)
+{
+    for (unsigned i = 0; i < MAX_COMMAND_OPS; ++i)
+    {
+        if (name == COMMAND_OP_NAMES[i])
+            return static_cast<CommandOp>(i);
+    }
+    return MAX_COMMAND_OPS;
+}
+
+/// Parse a target name. Return MAX_COMMAND_TARGETS if unknown.
+inline CommandTarget ParseCommandTarget(const Urho3D::String& name)
+{
+    for (unsigned i = 0; i < MAX_COMMAND_TARGETS; ++i)
+    {
+        if (name == COMMAND_TARGET_NAMES[i])
+            return static_cast<CommandTarget>(i);
+    }
+    return MAX_COMMAND_TARGETS;
+}
+
+/// Return the current time for command timestamps.
+inline long long GetCommandTimeNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
@@ -0,0 +1,131 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#include "RoomFile.h"
+
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <Urho3D/DebugNew.h>
+
+constexpr char RoomFile::MAGIC[4];
+
+RoomFile::~RoomFile()
+{
+    Close();
+}
+
+bool RoomFile::Open(const std::string& path)
+{
+    Close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER fileSize;
+    HANDLE mapping = nullptr;
+    const void* view = nullptr;
+    if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping)
+        view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view)
+    {
+        if (mapping)
+            CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    fileHandle_ = file;
+    mappingHandle_ = mapping;
+    data_ = static_cast<const unsigned char*>(view);
+    size_ = (size_t)fileSize.QuadPart;
+#else
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat fileStat;
+    void* view = MAP_FAILED;
+    if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0)
+        view = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file alive
+    close(fd);
+    if (view == MAP_FAILED)
+        return false;
+    data_ = static_cast<const unsigned char*>(view);
+    size_ = (size_t)fileStat.st_size;
+#endif
+
+    if (!Validate())
+    {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void RoomFile::Close()
+{
+    if (data_)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(data_);
+        CloseHandle(mappingHandle_);
+        CloseHandle(fileHandle_);
+        mappingHandle_ = nullptr;
+        fileHandle_ = nullptr;
+#else
+        munmap(const_cast<unsigned char*>(data_), size_);
+#endif
+    }
+    data_ = nullptr;
+    size_ = 0;
+    header_ = nullptr;
+    nodes_ = nullptr;
+    instances_ = nullptr;
+    strings_ = nullptr;
+}
+
+bool RoomFile::Validate()
+{
+    if (size_ < sizeof(Header))
+        return false;
+    const auto* header = reinterpret_cast<const Header*>(data_);
+    if (memcmp(header->magic_, MAGIC, sizeof(MAGIC)) != 0 || header->version_ != VERSION)
+        return false;
+
+    // Sections follow the header in order; compute their sizes in 64 bits so that no count can overflow them
+    const uint64_t nodesSize = (uint64_t)header->numNodes_ * sizeof(NodeRecord);
+    const uint64_t instancesSize = (uint64_t)header->numInstances_ * sizeof(InstanceRecord);
+    if (sizeof(Header) + nodesSize + instancesSize + header->stringsSize_ != size_)
+        return false;
+    const char* strings = reinterpret_cast<const char*>(data_ + sizeof(Header) + nodesSize + instancesSize);
+    if (!header->stringsSize_ || strings[header->stringsSize_ - 1] != '\0')
+        return false;
+
+    header_ = header;
+    nodes_ = reinterpret_cast<const NodeRecord*>(data_ + sizeof(Header));
+    instances_ = reinterpret_cast<const InstanceRecord*>(data_ + sizeof(Header) + nodesSize);
+    strings_ = strings;
+
+    for (unsigned i = 0; i < header->numNodes_; ++i)
+    {
+        const NodeRecord& node = nodes_[i];
+        if (node.type_ >= MAX_NODE_TYPES || node.name_ >= header->stringsSize_ ||
+            node.model_ >= header->stringsSize_ || node.material_ >= header->stringsSize_)
+            return false;
+        if ((uint64_t)node.firstInstance_ + node.numInstances_ > header->numInstances_)
+            return false;
+    }
+    return true;
+}
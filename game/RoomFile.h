@@ -0,0 +1,116 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/// Read-only, memory-mapped binary room file. The file is a header, fixed-size node records, the instance transforms
+/// of prop nodes and a table of NUL-terminated strings. Records are read in place from the mapping, so opening a room
+/// costs a validation pass over the records, not a copy of the file. Open() validates every offset and count, so the
+/// accessors need no bounds checks.
+class RoomFile
+{
+public:
+    /// File header.
+    struct Header
+    {
+        char magic_[4];
+        uint32_t version_;
+        uint32_t numNodes_;
+        uint32_t numInstances_;
+        /// Size of the string table in bytes.
+        uint32_t stringsSize_;
+        uint32_t reserved_;
+    };
+    static_assert(sizeof(Header) == 24, "Room file header layout changed");
+
+    /// Kind of node a record describes.
+    enum NodeType : uint32_t
+    {
+        /// A StaticModel.
+        NODE_MODEL = 0,
+        /// A PropChunk drawing the record's instances.
+        NODE_PROPS,
+        MAX_NODE_TYPES
+    };
+
+    /// Record flags.
+    enum NodeFlags : uint32_t
+    {
+        NODE_CAST_SHADOWS = 1,
+    };
+
+    /// Node record. Strings are offsets into the string table.
+    struct NodeRecord
+    {
+        uint32_t type_;
+        uint32_t flags_;
+        uint32_t name_;
+        uint32_t model_;
+        uint32_t material_;
+        /// Instances of a NODE_PROPS record, relative to the node.
+        uint32_t firstInstance_;
+        uint32_t numInstances_;
+        /// Distance beyond which a NODE_PROPS record casts no shadows, 0 for no limit.
+        float shadowDistance_;
+        float position_[3];
+        /// Rotation quaternion as w, x, y, z.
+        float rotation_[4];
+        float scale_[3];
+        /// World-space centre of the drawn content, used to stream the nearest records first.
+        float center_[3];
+    };
+    static_assert(sizeof(NodeRecord) == 84, "Room file node record layout changed");
+
+    /// Instance transform: a row-major 3x4 matrix.
+    struct InstanceRecord
+    {
+        float matrix_[12];
+    };
+    static_assert(sizeof(InstanceRecord) == 48, "Room file instance record layout changed");
+
+    static constexpr char MAGIC[4] = {'M', 'Y', 'R', 'M'};
+    static constexpr uint32_t VERSION = 1;
+
+    RoomFile() = default;
+    /// Destruct. Unmaps the file.
+    ~RoomFile();
+    RoomFile(const RoomFile&) = delete;
+    RoomFile& operator=(const RoomFile&) = delete;
+
+    /// Map and validate a room file. Return false and leave the file closed if it can not be mapped or is malformed.
+    bool Open(const std::string& path);
+    /// Unmap the file.
+    void Close();
+
+    /// Return whether a file is open.
+    bool IsOpen() const { return data_ != nullptr; }
+    /// Return the number of node records.
+    unsigned GetNumNodes() const { return header_ ? header_->numNodes_ : 0; }
+    /// Return the number of instance records.
+    unsigned GetNumInstances() const { return header_ ? header_->numInstances_ : 0; }
+    /// Return a node record.
+    const NodeRecord& GetNode(unsigned index) const { return nodes_[index]; }
+    /// Return the first instance of a NODE_PROPS record.
+    const InstanceRecord* GetInstances(const NodeRecord& node) const { return instances_ + node.firstInstance_; }
+    /// Return a string of the string table.
+    const char* GetString(uint32_t offset) const { return strings_ + offset; }
+
+private:
+    /// Locate the sections and check the header and every record against the file size.
+    bool Validate();
+
+    const unsigned char* data_{nullptr};
+    size_t size_{0};
+    const Header* header_{nullptr};
+    const NodeRecord* nodes_{nullptr};
+    const InstanceRecord* instances_{nullptr};
+    const char* strings_{nullptr};
+#ifdef _WIN32
+    void* fileHandle_{nullptr};
+    void* mappingHandle_{nullptr};
+#endif
+};
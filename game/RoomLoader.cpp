@@ -0,0 +1,226 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#include <Urho3D/Graphics/Material.h>
+#include <Urho3D/Graphics/Model.h>
+#include <Urho3D/Graphics/StaticModel.h>
+#include <Urho3D/Resource/ResourceCache.h>
+#include <Urho3D/Scene/Node.h>
+
+#include "PropField.h"
+#include "ResourcePreloader.h"
+#include "RoomLoader.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
+
+#include <Urho3D/DebugNew.h>
+
+using namespace Urho3D;
+
+namespace
+{
+
+/// Time spent creating nodes per frame.
+const long long FRAME_BUDGET_US = 2000;
+/// Distance the camera moves before the pending nodes are sorted again.
+const float RESORT_DISTANCE = 5.0f;
+
+/// Room file contents collected by RoomLoader::Save().
+struct RoomWriter
+{
+    std::vector<RoomFile::NodeRecord> nodes_{};
+    std::vector<RoomFile::InstanceRecord> instances_{};
+    /// String table. Starts with the empty string, so that offset 0 means none.
+    std::string strings_{std::string(1, '\0')};
+    std::unordered_map<std::string, uint32_t> stringOffsets_{};
+
+    uint32_t AddString(const String& value)
+    {
+        if (value.Empty())
+            return 0;
+        const auto inserted = stringOffsets_.emplace(value.CString(), (uint32_t)strings_.size());
+        if (inserted.second)
+            strings_.append(value.CString(), value.Length() + 1);
+        return inserted.first->second;
+    }
+
+    void AddNode(Node* node, StaticModel* model, RoomFile::NodeType type)
+    {
+        RoomFile::NodeRecord record{};
+        record.type_ = type;
+        record.flags_ = model->GetCastShadows() ? RoomFile::NODE_CAST_SHADOWS : 0;
+        record.name_ = AddString(node->GetName());
+        record.model_ = AddString(model->GetModel() ? model->GetModel()->GetName() : String::EMPTY);
+        record.material_ = AddString(model->GetMaterial() ? model->GetMaterial()->GetName() : String::EMPTY);
+        record.shadowDistance_ = model->GetShadowDistance();
+
+        const Vector3 position = node->GetWorldPosition();
+        const Quaternion rotation = node->GetWorldRotation();
+        const Vector3 scale = node->GetWorldScale();
+        const Vector3 center = model->GetWorldBoundingBox().Center();
+        memcpy(record.position_, position.Data(), sizeof(record.position_));
+        memcpy(record.rotation_, rotation.Data(), sizeof(record.rotation_));
+        memcpy(record.scale_, scale.Data(), sizeof(record.scale_));
+        memcpy(record.center_, center.Data(), sizeof(record.center_));
+
+        if (type == RoomFile::NODE_PROPS)
+        {
+            const std::vector<Matrix3x4>& transforms = static_cast<PropChunk*>(model)->GetInstances();
+            record.firstInstance_ = (uint32_t)instances_.size();
+            record.numInstances_ = (uint32_t)transforms.size();
+            for (const Matrix3x4& transform : transforms)
+            {
+                RoomFile::InstanceRecord instance;
+                memcpy(instance.matrix_, transform.Data(), sizeof(instance.matrix_));
+                instances_.push_back(instance);
+            }
+        }
+        nodes_.push_back(record);
+    }
+};
+
+} // namespace
+
+RoomLoader::RoomLoader(Context* context)
+    : Object(context)
+{
+}
+
+void RoomLoader::Start(std::shared_ptr<RoomFile> file, Node* parent, const Vector3& viewPosition)
+{
+    file_ = std::move(file);
+    parent_ = parent;
+    elapsed_.Reset();
+
+    preloader_ = new ResourcePreloader(context_);
+    for (unsigned i = 0; i < file_->GetNumNodes(); ++i)
+    {
+        const RoomFile::NodeRecord& record = file_->GetNode(i);
+        if (record.model_)
+            preloader_->Add(Model::GetTypeStatic(), file_->GetString(record.model_));
+        if (record.material_)
+            preloader_->Add(Material::GetTypeStatic(), file_->GetString(record.material_));
+    }
+    preloader_->Start();
+
+    order_.resize(file_->GetNumNodes());
+    std::iota(order_.begin(), order_.end(), 0u);
+    next_ = 0;
+    SortPending(viewPosition);
+}
+
+bool RoomLoader::Update(const Vector3& viewPosition)
+{
+    if (!parent_)
+        return true;
+
+    if ((viewPosition - sortPosition_).LengthSquared() > RESORT_DISTANCE * RESORT_DISTANCE)
+        SortPending(viewPosition);
+
+    // At least one node per frame, then as many as fit the budget. Keep the order: when the nearest pending node waits
+    // for its resources, the ones behind it wait too
+    HiresTimer frameTimer;
+    while (next_ < order_.size() && CreateNode(file_->GetNode(order_[next_])))
+    {
+        ++next_;
+        if (frameTimer.GetUSec(false) >= FRAME_BUDGET_US)
+            break;
+    }
+
+    if (next_ < order_.size())
+        return false;
+    // Everything is copied out of the mapping
+    file_.reset();
+    return true;
+}
+
+bool RoomLoader::Save(Node* room, const std::string& path)
+{
+    if (!room)
+        return false;
+
+    RoomWriter writer;
+    PODVector<Node*> nodes;
+    room->GetChildren(nodes, true);
+    for (Node* node : nodes)
+    {
+        for (Component* component : node->GetComponents())
+        {
+            if (component->GetType() == StaticModel::GetTypeStatic())
+                writer.AddNode(node, static_cast<StaticModel*>(component), RoomFile::NODE_MODEL);
+            else if (component->GetType() == PropChunk::GetTypeStatic())
+                writer.AddNode(node, static_cast<StaticModel*>(component), RoomFile::NODE_PROPS);
+        }
+    }
+
+    RoomFile::Header header{};
+    memcpy(header.magic_, RoomFile::MAGIC, sizeof(header.magic_));
+    header.version_ = RoomFile::VERSION;
+    header.numNodes_ = (uint32_t)writer.nodes_.size();
+    header.numInstances_ = (uint32_t)writer.instances_.size();
+    header.stringsSize_ = (uint32_t)writer.strings_.size();
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+    bool success = fwrite(&header, sizeof(header), 1, file) == 1;
+    if (success && !writer.nodes_.empty())
+        success = fwrite(writer.nodes_.data(), sizeof(RoomFile::NodeRecord), writer.nodes_.size(), file) ==
+                  writer.nodes_.size();
+    if (success && !writer.instances_.empty())
+        success = fwrite(writer.instances_.data(), sizeof(RoomFile::InstanceRecord), writer.instances_.size(), file) ==
+                  writer.instances_.size();
+    success = success && fwrite(writer.strings_.data(), 1, writer.strings_.size(), file) == writer.strings_.size();
+    return fclose(file) == 0 && success;
+}
+
+void RoomLoader::SortPending(const Vector3& viewPosition)
+{
+    sortPosition_ = viewPosition;
+    auto distance = [this, &viewPosition](unsigned index)
+    {
+        const float* center = file_->GetNode(index).center_;
+        return (Vector3(center) - viewPosition).LengthSquared();
+    };
+    std::sort(order_.begin() + next_, order_.end(),
+              [&distance](unsigned lhs, unsigned rhs) { return distance(lhs) < distance(rhs); });
+}
+
+bool RoomLoader::CreateNode(const RoomFile::NodeRecord& record)
+{
+    const char* modelName = file_->GetString(record.model_);
+    const char* materialName = file_->GetString(record.material_);
+    if (!preloader_->IsLoaded(modelName) || !preloader_->IsLoaded(materialName))
+        return false;
+
+    Node* node = parent_->CreateChild(file_->GetString(record.name_), LOCAL);
+    node->SetWorldTransform(Vector3(record.position_), Quaternion(record.rotation_), Vector3(record.scale_));
+
+    auto* cache = GetSubsystem<ResourceCache>();
+    StaticModel* model = nullptr;
+    if (record.type_ == RoomFile::NODE_PROPS)
+    {
+        auto* propChunk = node->CreateComponent<PropChunk>(LOCAL);
+        std::vector<Matrix3x4> transforms(record.numInstances_);
+        const RoomFile::InstanceRecord* instances = file_->GetInstances(record);
+        for (unsigned i = 0; i < record.numInstances_; ++i)
+            transforms[i] = Matrix3x4(instances[i].matrix_);
+        propChunk->SetInstances(std::move(transforms));
+        propChunk->SetShadowDistance(record.shadowDistance_);
+        model = propChunk;
+    }
+    else
+    {
+        model = node->CreateComponent<StaticModel>(LOCAL);
+    }
+    if (record.model_)
+        model->SetModel(cache->GetResource<Model>(modelName));
+    if (record.material_)
+        model->SetMaterial(cache->GetResource<Material>(materialName));
+    model->SetCastShadows(record.flags_ & RoomFile::NODE_CAST_SHADOWS);
+    return true;
+}
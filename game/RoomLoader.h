@@ -0,0 +1,66 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#pragma once
+
+#include <Urho3D/Core/Object.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Math/Vector3.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "RoomFile.h"
+
+namespace Urho3D
+{
+class Node;
+}
+
+class ResourcePreloader;
+
+/// Streams the nodes of a room file into the scene over several frames, nearest to the camera first, so that the first
+/// frame is presented right away and the surroundings fill in from the viewer outwards. Models and materials load in
+/// background; a node waits until its own have loaded. Main thread only.
+class RoomLoader : public Urho3D::Object
+{
+    URHO3D_OBJECT(RoomLoader, Urho3D::Object);
+
+public:
+    /// Construct.
+    explicit RoomLoader(Urho3D::Context* context);
+
+    /// Start streaming an open room file under a parent node, and start loading its resources.
+    void Start(std::shared_ptr<RoomFile> file, Urho3D::Node* parent, const Urho3D::Vector3& viewPosition);
+    /// Create the nearest pending nodes until the frame budget is spent. Return true once every node is created or the
+    /// parent node is gone.
+    bool Update(const Urho3D::Vector3& viewPosition);
+
+    /// Return the number of nodes created so far.
+    unsigned GetNumCreated() const { return next_; }
+    /// Return the number of nodes in the room.
+    unsigned GetNumNodes() const { return (unsigned)order_.size(); }
+    /// Return the time since Start() in milliseconds.
+    float GetElapsedMs() { return elapsed_.GetUSec(false) / 1000.0f; }
+
+    /// Write the StaticModels and PropChunks under a node to a room file, flattened to world transforms. Return false
+    /// if the file can not be written.
+    static bool Save(Urho3D::Node* room, const std::string& path);
+
+private:
+    /// Order the pending nodes by distance to the view position.
+    void SortPending(const Urho3D::Vector3& viewPosition);
+    /// Create the node of a record unless its resources are still loading. Return whether it was created.
+    bool CreateNode(const RoomFile::NodeRecord& record);
+
+    std::shared_ptr<RoomFile> file_{};
+    Urho3D::WeakPtr<Urho3D::Node> parent_{};
+    Urho3D::SharedPtr<ResourcePreloader> preloader_{};
+    /// Record indices, created ones first, then pending ones nearest first as of the last sort.
+    std::vector<unsigned> order_{};
+    /// Index in order_ of the next record to create.
+    unsigned next_{0};
+    /// View position the pending records were last sorted for.
+    Urho3D::Vector3 sortPosition_{};
+    Urho3D::HiresTimer elapsed_{};
+};
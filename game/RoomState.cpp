@@ -0,0 +1,113 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#include <Urho3D/Graphics/Light.h>
+#include <Urho3D/Scene/Scene.h>
+
+#include "RoomState.h"
+
+#include <cstdio>
+
+#include <Urho3D/DebugNew.h>
+
+using namespace Urho3D;
+
+void RoomStatePublisher::Update(Scene* scene)
+{
+    if (!dirty_ || !scene)
+        return;
+
+    ++back_.version_;
+    for (unsigned i = 0; i < MAX_COMMAND_TARGETS; ++i)
+    {
+        if (!(dirty_ & (1u << i)))
+            continue;
+
+        TargetState& target = back_.targets_[i];
+        target = TargetState();
+        target.version_ = back_.version_;
+
+        PODVector<Node*> nodes;
+        scene->GetNodesWithTag(nodes, GetCommandTargetName(static_cast<CommandTarget>(i)));
+        target.on_ = !nodes.Empty();
+        target.nodes_ = nodes.Size();
+        for (Node* node : nodes)
+        {
+            PODVector<Light*> lights;
+            node->GetComponents<Light>(lights);
+            for (Light* light : lights)
+            {
+                if (!target.lights_)
+                {
+                    const Color& color = light->GetColor();
+                    target.color_[0] = color.r_;
+                    target.color_[1] = color.g_;
+                    target.color_[2] = color.b_;
+                    target.brightness_ = light->GetBrightness();
+                    target.range_ = light->GetRange();
+                }
+                ++target.lights_;
+                if (light->GetCastShadows())
+                    ++target.shadowLights_;
+            }
+        }
+    }
+    dirty_ = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        front_ = back_;
+    }
+    changed_.notify_all();
+}
+
+void RoomStatePublisher::Shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        shutdown_ = true;
+    }
+    changed_.notify_all();
+}
+
+RoomState RoomStatePublisher::GetState() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return front_;
+}
+
+bool RoomStatePublisher::WaitForChange(uint64_t sinceVersion, std::chrono::milliseconds timeout,
+                                       RoomState& state) const
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait_for(lock, timeout, [&]() { return shutdown_ || front_.version_ > sinceVersion; });
+    state = front_;
+    return !shutdown_;
+}
+
+std::string RoomStatePublisher::ToJSON(const RoomState& state, uint64_t sinceVersion)
+{
+    std::string out;
+    char buffer[320];
+    snprintf(buffer, sizeof(buffer), "{\"version\": %llu, \"delta\": %s, \"targets\": {",
+             (unsigned long long)state.version_, sinceVersion ? "true" : "false");
+    out += buffer;
+
+    bool first = true;
+    for (unsigned i = 0; i < MAX_COMMAND_TARGETS; ++i)
+    {
+        const TargetState& target = state.targets_[i];
+        if (sinceVersion && target.version_ <= sinceVersion)
+            continue;
+        snprintf(buffer, sizeof(buffer),
+                 "%s\"%s\": {\"on\": %s, \"nodes\": %u, \"lights\": %u, \"shadowLights\": %u, "
+                 "\"color\": [%.3f, %.3f, %.3f], \"brightness\": %.3f, \"range\": %.3f}",
+                 first ? "" : ", ", GetCommandTargetName(static_cast<CommandTarget>(i)),
+                 target.on_ ? "true" : "false", target.nodes_, target.lights_, target.shadowLights_, target.color_[0],
+                 target.color_[1], target.color_[2], target.brightness_, target.range_);
+        out += buffer;
+        first = false;
+    }
+    out += "}}\n";
+    return out;
+}
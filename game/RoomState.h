@@ -0,0 +1,73 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#pragma once
+
+#include "RoomCommand.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+namespace Urho3D
+{
+class Scene;
+}
+
+/// Observable state of one command target.
+struct TargetState
+{
+    /// Room state version in which this target last changed.
+    uint64_t version_{0};
+    bool on_{false};
+    unsigned nodes_{0};
+    unsigned lights_{0};
+    unsigned shadowLights_{0};
+    /// Parameters of the first light of the target.
+    float color_[3]{};
+    float brightness_{0.0f};
+    float range_{0.0f};
+};
+
+/// Observable state of the room.
+struct RoomState
+{
+    uint64_t version_{0};
+    TargetState targets_[MAX_COMMAND_TARGETS]{};
+};
+
+/// Publishes the room state to http workers without letting them touch the scene. The frame thread recomputes the
+/// targets marked dirty by commands into a back buffer and publishes it with a short copy under a mutex; workers copy
+/// the published buffer and serialize it on their own thread. Each target carries the version it last changed in, so
+/// an observer that remembers the last version it has seen gets only the targets changed since.
+class RoomStatePublisher
+{
+public:
+    /// Mark a target as changed. Frame thread only.
+    void MarkDirty(CommandTarget target) { dirty_ |= 1u << target; }
+    /// Recompute and publish the dirty targets. Frame thread only.
+    void Update(Urho3D::Scene* scene);
+    /// Wake up every waiting observer and make further waits return immediately.
+    void Shutdown();
+
+    /// Return a copy of the published state. Thread safe.
+    RoomState GetState() const;
+    /// Wait until the published version is newer than the given one or the timeout elapses, and return the published
+    /// state. Return false if shut down. Thread safe.
+    bool WaitForChange(uint64_t sinceVersion, std::chrono::milliseconds timeout, RoomState& state) const;
+
+    /// Serialize the targets changed after a version (0 for all of them) as a single line of JSON.
+    static std::string ToJSON(const RoomState& state, uint64_t sinceVersion = 0);
+
+private:
+    /// Dirty target bits. Frame thread only.
+    unsigned dirty_{0};
+    /// State being updated. Frame thread only.
+    RoomState back_{};
+
+    mutable std::mutex mutex_{};
+    mutable std::condition_variable changed_{};
+    RoomState front_{};
+    bool shutdown_{false};
+};
@@ -0,0 +1,61 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Core/WorkQueue.h>
+#include <Urho3D/Graphics/Material.h>
+#include <Urho3D/Graphics/Model.h>
+#include <Urho3D/Graphics/Octree.h>
+#include <Urho3D/Resource/ResourceCache.h>
+#include <Urho3D/Scene/Scene.h>
+
+#include "PropField.h"
+#include "PropGenerator.h"
+#include "SceneBenchmark.h"
+
+#include <cstdio>
+
+#include <Urho3D/DebugNew.h>
+
+using namespace Urho3D;
+
+SceneBenchmark::SceneBenchmark(Context* context)
+    : Object(context)
+{
+}
+
+std::string SceneBenchmark::Run(const std::vector<unsigned>& propCounts, unsigned seed)
+{
+    auto* cache = GetSubsystem<ResourceCache>();
+    auto* model = cache->GetResource<Model>("Models/Mushroom.mdl");
+    auto* material = cache->GetResource<Material>("Materials/Mushroom.xml");
+    auto* queue = GetSubsystem<WorkQueue>();
+
+    PropGenerator generator(context_);
+    generator.SetSeed(seed);
+
+    std::string report = "{\"seed\": " + std::to_string(seed) +
+                         ", \"threads\": " + std::to_string(queue ? queue->GetNumThreads() + 1 : 1) + ", \"results\": [";
+    for (unsigned i = 0; i < propCounts.size(); ++i)
+    {
+        SharedPtr<Scene> scene(new Scene(context_));
+        scene->CreateComponent<Octree>();
+        auto* propField = scene->CreateChild("Mushrooms")->CreateComponent<PropField>();
+        propField->SetModel(model, material);
+
+        HiresTimer timer;
+        const std::vector<Matrix3x4> transforms = generator.Generate(propCounts[i]);
+        const long long generateUs = timer.GetUSec(true);
+        propField->SetInstances(transforms);
+        const long long attachUs = timer.GetUSec(false);
+
+        char result[256];
+        snprintf(result, sizeof(result),
+                 "%s{\"props\": %u, \"chunks\": %u, \"generateMs\": %.2f, \"attachMs\": %.2f, \"totalMs\": %.2f}",
+                 i ? ", " : "", propCounts[i], propField->GetNumChunks(), generateUs / 1000.0, attachUs / 1000.0,
+                 (generateUs + attachUs) / 1000.0);
+        report += result;
+    }
+    report += "]}";
+    return report;
+}
@@ -0,0 +1,22 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#pragma once
+
+#include <Urho3D/Core/Object.h>
+#include <string>
+#include <vector>
+
+/// Measures the startup cost of the mushroom field at several prop counts: generating the transforms on the WorkQueue
+/// and attaching the chunks to a scene on the main thread. Used by the --headless --scene-benchmark mode.
+class SceneBenchmark : public Urho3D::Object
+{
+    URHO3D_OBJECT(SceneBenchmark, Urho3D::Object);
+
+public:
+    /// Construct.
+    explicit SceneBenchmark(Urho3D::Context* context);
+
+    /// Run the benchmark for each prop count with the given seed and return the report as JSON.
+    std::string Run(const std::vector<unsigned>& propCounts, unsigned seed);
+};
@@ -0,0 +1,120 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#include <Urho3D/Graphics/Light.h>
+#include <Urho3D/Scene/Scene.h>
+
+#include "SceneMirror.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include <Urho3D/DebugNew.h>
+
+using namespace Urho3D;
+
+namespace
+{
+
+void AppendJSONString(std::string& out, const std::string& value)
+{
+    out += '"';
+    for (char c : value)
+    {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        if ((unsigned char)c >= 0x20)
+            out += c;
+    }
+    out += '"';
+}
+
+} // namespace
+
+void SceneMirror::Publish(Scene* scene, unsigned frameNumber)
+{
+    if (!scene)
+        return;
+
+    // Refill a reclaimed snapshot: its vectors and strings keep their capacity, so steady state does not allocate
+    std::unique_ptr<SceneSnapshot> snapshot = publisher_.Acquire();
+    snapshot->version_ = ++version_;
+    snapshot->frameNumber_ = frameNumber;
+
+    nodes_.Clear();
+    scene->GetChildren(nodes_, true);
+    snapshot->nodes_.resize(nodes_.Size());
+    for (unsigned i = 0; i < nodes_.Size(); ++i)
+    {
+        const Node* node = nodes_[i];
+        SceneSnapshot::NodeInfo& info = snapshot->nodes_[i];
+        info.id_ = node->GetID();
+        info.name_.assign(node->GetName().CString(), node->GetName().Length());
+
+        const StringVector& tags = node->GetTags();
+        info.tags_.resize(tags.Size());
+        for (unsigned j = 0; j < tags.Size(); ++j)
+            info.tags_[j].assign(tags[j].CString(), tags[j].Length());
+
+        const Vector3 position = node->GetWorldPosition();
+        info.position_[0] = position.x_;
+        info.position_[1] = position.y_;
+        info.position_[2] = position.z_;
+
+        const auto* light = node->GetComponent<Light>();
+        info.hasLight_ = light != nullptr;
+        if (light)
+        {
+            const Color& color = light->GetEffectiveColor();
+            info.lightColor_[0] = color.r_;
+            info.lightColor_[1] = color.g_;
+            info.lightColor_[2] = color.b_;
+        }
+    }
+
+    publisher_.Publish(std::move(snapshot));
+}
+
+std::string SceneMirror::ToJSON(const std::string& tag) const
+{
+    return publisher_.Read(
+        [&tag](const SceneSnapshot& snapshot)
+        {
+            std::string out;
+            char buffer[160];
+            snprintf(buffer, sizeof(buffer), "{\"version\": %llu, \"frame\": %u, \"nodes\": [",
+                     (unsigned long long)snapshot.version_, snapshot.frameNumber_);
+            out += buffer;
+
+            bool first = true;
+            for (const SceneSnapshot::NodeInfo& info : snapshot.nodes_)
+            {
+                if (!tag.empty() && std::find(info.tags_.begin(), info.tags_.end(), tag) == info.tags_.end())
+                    continue;
+
+                snprintf(buffer, sizeof(buffer), "%s{\"id\": %u, \"name\": ", first ? "" : ", ", info.id_);
+                out += buffer;
+                first = false;
+                AppendJSONString(out, info.name_);
+                out += ", \"tags\": [";
+                for (size_t i = 0; i < info.tags_.size(); ++i)
+                {
+                    if (i)
+                        out += ", ";
+                    AppendJSONString(out, info.tags_[i]);
+                }
+                snprintf(buffer, sizeof(buffer), "], \"position\": [%.3f, %.3f, %.3f]", info.position_[0],
+                         info.position_[1], info.position_[2]);
+                out += buffer;
+                if (info.hasLight_)
+                {
+                    snprintf(buffer, sizeof(buffer), ", \"lightColor\": [%.3f, %.3f, %.3f]", info.lightColor_[0],
+                             info.lightColor_[1], info.lightColor_[2]);
+                    out += buffer;
+                }
+                out += "}";
+            }
+            out += "]}";
+            return out;
+        });
+}
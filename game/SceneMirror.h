@@ -0,0 +1,51 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#pragma once
+
+#include "RcuPublisher.h"
+#include <Urho3D/Container/Vector.h>
+#include <string>
+#include <vector>
+
+namespace Urho3D
+{
+class Node;
+class Scene;
+} // namespace Urho3D
+
+/// Immutable copy of the queryable scene data of one frame.
+struct SceneSnapshot
+{
+    struct NodeInfo
+    {
+        unsigned id_{0};
+        std::string name_{};
+        std::vector<std::string> tags_{};
+        float position_[3]{};
+        bool hasLight_{false};
+        float lightColor_[3]{};
+    };
+
+    uint64_t version_{0};
+    unsigned frameNumber_{0};
+    std::vector<NodeInfo> nodes_{};
+};
+
+/// Read-only mirror of the scene for http workers. The frame thread copies node names, tags, positions and light
+/// colours at the end of each update and publishes the copy RCU-style; workers answer queries from the latest copy
+/// without locks and without touching the scene, at most one frame behind it.
+class SceneMirror
+{
+public:
+    /// Copy the scene and publish the copy. Frame thread only.
+    void Publish(Urho3D::Scene* scene, unsigned frameNumber);
+    /// Return the nodes of the latest copy as JSON, only those with the tag if not empty. Thread safe, lock-free.
+    std::string ToJSON(const std::string& tag) const;
+
+private:
+    RcuPublisher<SceneSnapshot> publisher_{};
+    uint64_t version_{0};
+    /// Scratch buffer for collecting the scene nodes. Frame thread only.
+    Urho3D::PODVector<Urho3D::Node*> nodes_{};
+};
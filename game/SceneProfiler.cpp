@@ -0,0 +1,281 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#include <Urho3D/Core/CoreEvents.h>
+#include <Urho3D/Core/Profiler.h>
+#include <Urho3D/Graphics/Graphics.h>
+#include <Urho3D/Graphics/Light.h>
+#include <Urho3D/Graphics/Renderer.h>
+
+#include "BatchedAnimation.h"
+#include "SceneProfiler.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include <Urho3D/DebugNew.h>
+
+using namespace Urho3D;
+
+namespace
+{
+
+/// Append printf-formatted text to a string.
+template <typename... Args> void AppendFormat(std::string& out, const char* format, Args... args)
+{
+    char buffer[512];
+    const int length = snprintf(buffer, sizeof(buffer), format, args...);
+    if (length > 0)
+        out.append(buffer, Min((unsigned)length, (unsigned)sizeof(buffer) - 1));
+}
+
+/// Append a string as a JSON string literal.
+void AppendJSONString(std::string& out, const char* value)
+{
+    out += '"';
+    for (const char* c = value; *c; ++c)
+    {
+        if (*c == '"' || *c == '\\')
+            out += '\\';
+        if ((unsigned char)*c >= 0x20)
+            out += *c;
+    }
+    out += '"';
+}
+
+} // namespace
+
+SceneProfiler::SceneProfiler(Context* context)
+    : Object(context)
+{
+    window_.reserve(WINDOW_SIZE);
+    SubscribeToEvent(E_BEGINFRAME, URHO3D_HANDLER(SceneProfiler, HandleBeginFrame));
+    SubscribeToEvent(E_ENDFRAME, URHO3D_HANDLER(SceneProfiler, HandleEndFrame));
+}
+
+void SceneProfiler::AddMarker(const String& label)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    markers_.push_back(Marker{current_.frameNumber_, current_.startMs_, label.CString()});
+    // Markers are only meaningful while their frames are in the window
+    if (markers_.size() > WINDOW_SIZE)
+        markers_.erase(markers_.begin());
+}
+
+void SceneProfiler::HandleBeginFrame(StringHash eventType, VariantMap& eventData)
+{
+    using namespace BeginFrame;
+
+    current_ = FrameSample();
+    current_.frameNumber_ = eventData[P_FRAMENUMBER].GetUInt();
+    current_.timeStepMs_ = eventData[P_TIMESTEP].GetFloat() * 1000.0f;
+    current_.startMs_ = clock_.GetUSec(false) / 1000.0;
+}
+
+void SceneProfiler::HandleEndFrame(StringHash eventType, VariantMap& eventData)
+{
+    FrameSample& sample = current_;
+    sample.frameMs_ = (float)(clock_.GetUSec(false) / 1000.0 - sample.startMs_);
+
+    if (scene_)
+    {
+        // Walking the scene costs in proportion to its size, outside frameMs_ and so in the next frame: count only
+        // every few frames
+        if (!framesToCount_)
+        {
+            scene_->GetChildren(nodes_, true);
+            sceneNodes_ = nodes_.Size();
+            scene_->GetComponents<Light>(lights_, true);
+            sceneLights_ = lights_.Size();
+            framesToCount_ = SCENE_COUNT_INTERVAL;
+        }
+        --framesToCount_;
+        sample.sceneNodes_ = sceneNodes_;
+        sample.sceneLights_ = sceneLights_;
+        if (auto* animation = scene_->GetComponent<BatchedAnimation>())
+        {
+            sample.pausedNodes_ = animation->GetNumPaused();
+            sample.animatedNodes_ = animation->GetNumNodes() - sample.pausedNodes_;
+            sample.animationMs_ = animation->GetUpdateMs();
+        }
+    }
+
+    // Both are null in headless mode
+    if (auto* renderer = GetSubsystem<Renderer>())
+    {
+        sample.views_ = renderer->GetNumViews();
+        sample.visibleLights_ = renderer->GetNumLights(true);
+        sample.shadowMaps_ = renderer->GetNumShadowMaps(true);
+        sample.occluders_ = renderer->GetNumOccluders(true);
+        sample.geometries_ = renderer->GetNumGeometries(true);
+        sample.batches_ = renderer->GetNumBatches();
+    }
+    if (auto* graphics = GetSubsystem<Graphics>())
+    {
+        sample.drawCalls_ = graphics->GetNumBatches();
+        sample.primitives_ = graphics->GetNumPrimitives();
+    }
+
+    // The profiler finalizes block times after E_ENDFRAME, so these are the blocks of the previous frame
+    SampleProfilerBlocks(sample);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (window_.size() < WINDOW_SIZE)
+        window_.push_back(sample);
+    else
+        window_[next_] = sample;
+    next_ = (next_ + 1) % WINDOW_SIZE;
+}
+
+void SceneProfiler::SampleProfilerBlocks(FrameSample& sample) const
+{
+#ifdef URHO3D_PROFILING
+    auto* profiler = GetSubsystem<Profiler>();
+    if (!profiler)
+        return;
+
+    auto addBlock = [&sample](const ProfilerBlock* block, unsigned char depth)
+    {
+        if (sample.numBlocks_ >= MAX_BLOCKS)
+            return;
+        BlockSample& out = sample.blocks_[sample.numBlocks_++];
+        strncpy(out.name_, block->name_, sizeof(out.name_) - 1);
+        out.name_[sizeof(out.name_) - 1] = '\0';
+        out.depth_ = depth;
+        out.ms_ = block->frameTime_ / 1000.0f;
+    };
+
+    // Root -> RunFrame -> Update, Render, ...: keep the first two levels below the root
+    for (const ProfilerBlock* frameBlock : profiler->GetRootBlock()->children_)
+    {
+        addBlock(frameBlock, 0);
+        for (const ProfilerBlock* child : frameBlock->children_)
+            addBlock(child, 1);
+    }
+#endif
+}
+
+std::string SceneProfiler::ToJSON() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    const unsigned size = (unsigned)window_.size();
+    const unsigned first = size < WINDOW_SIZE ? 0 : next_;
+    auto at = [&](unsigned i) -> const FrameSample& { return window_[(first + i) % size]; };
+
+    std::string out;
+    out += "{\"frames\": [";
+    for (unsigned i = 0; i < size; ++i)
+    {
+        const FrameSample& s = at(i);
+        AppendFormat(out,
+                     "%s{\"frame\": %u, \"startMs\": %.3f, \"frameMs\": %.3f, \"timeStepMs\": %.3f, "
+                     "\"sceneNodes\": %u, \"sceneLights\": %u, \"views\": %u, \"visibleLights\": %u, "
+                     "\"shadowMaps\": %u, \"occluders\": %u, \"geometries\": %u, \"batches\": %u, "
+                     "\"drawCalls\": %u, \"primitives\": %u, \"animatedNodes\": %u, \"pausedNodes\": %u, "
+                     "\"animationMs\": %.3f, \"blocks\": {",
+                     i ? ", " : "", s.frameNumber_, s.startMs_, s.frameMs_, s.timeStepMs_, s.sceneNodes_,
+                     s.sceneLights_, s.views_, s.visibleLights_, s.shadowMaps_, s.occluders_, s.geometries_,
+                     s.batches_, s.drawCalls_, s.primitives_, s.animatedNodes_, s.pausedNodes_, s.animationMs_);
+        for (unsigned j = 0; j < s.numBlocks_; ++j)
+        {
+            if (j)
+                out += ", ";
+            AppendJSONString(out, s.blocks_[j].name_);
+            AppendFormat(out, ": %.3f", s.blocks_[j].ms_);
+        }
+        out += "}}";
+    }
+
+    out += "], \"markers\": [";
+    bool firstMarker = true;
+    for (const Marker& marker : markers_)
+    {
+        // Average frame time and light count over the frames on either side of the marker
+        float msBefore = 0.0f, msAfter = 0.0f;
+        unsigned lightsBefore = 0, lightsAfter = 0, numBefore = 0, numAfter = 0;
+        for (unsigned i = 0; i < size; ++i)
+        {
+            const FrameSample& s = at(i);
+            if (s.frameNumber_ < marker.frameNumber_ && s.frameNumber_ + MARKER_FRAMES >= marker.frameNumber_)
+            {
+                msBefore += s.frameMs_;
+                lightsBefore += s.visibleLights_;
+                ++numBefore;
+            }
+            else if (s.frameNumber_ > marker.frameNumber_ && s.frameNumber_ <= marker.frameNumber_ + MARKER_FRAMES)
+            {
+                msAfter += s.frameMs_;
+                lightsAfter += s.visibleLights_;
+                ++numAfter;
+            }
+        }
+        out += firstMarker ? "" : ", ";
+        firstMarker = false;
+        AppendFormat(out, "{\"frame\": %u, \"label\": ", marker.frameNumber_);
+        AppendJSONString(out, marker.label_.c_str());
+        AppendFormat(out,
+                     ", \"frameMsBefore\": %.3f, \"frameMsAfter\": %.3f, \"visibleLightsBefore\": %.1f, "
+                     "\"visibleLightsAfter\": %.1f}",
+                     numBefore ? msBefore / numBefore : 0.0f, numAfter ? msAfter / numAfter : 0.0f,
+                     numBefore ? (float)lightsBefore / numBefore : 0.0f,
+                     numAfter ? (float)lightsAfter / numAfter : 0.0f);
+    }
+    out += "]}";
+    return out;
+}
+
+std::string SceneProfiler::ToChromeTrace() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    const unsigned size = (unsigned)window_.size();
+    const unsigned first = size < WINDOW_SIZE ? 0 : next_;
+
+    // Timestamps are in microseconds. The profiler only provides block durations, so the blocks of a frame are laid
+    // out back to back from the frame start
+    std::string out;
+    out += "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    out += "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"MyRoom\"}}";
+    for (unsigned i = 0; i < size; ++i)
+    {
+        const FrameSample& s = window_[(first + i) % size];
+        const double start = s.startMs_ * 1000.0;
+        AppendFormat(out,
+                     ", {\"name\": \"Frame\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, \"ts\": %.1f, \"dur\": %.1f, "
+                     "\"args\": {\"frame\": %u}}",
+                     start, s.frameMs_ * 1000.0, s.frameNumber_);
+
+        double cursor[2] = {start, start};
+        for (unsigned j = 0; j < s.numBlocks_; ++j)
+        {
+            const BlockSample& block = s.blocks_[j];
+            const unsigned depth = Min((unsigned)block.depth_, 1u);
+            if (depth == 0)
+                cursor[1] = cursor[0];
+            out += ", {\"name\": ";
+            AppendJSONString(out, block.name_);
+            AppendFormat(out, ", \"ph\": \"X\", \"pid\": 1, \"tid\": 2, \"ts\": %.1f, \"dur\": %.1f}", cursor[depth],
+                         block.ms_ * 1000.0);
+            cursor[depth] += block.ms_ * 1000.0;
+        }
+
+        AppendFormat(out,
+                     ", {\"name\": \"Scene\", \"ph\": \"C\", \"pid\": 1, \"ts\": %.1f, \"args\": {\"visibleLights\": "
+                     "%u, \"shadowMaps\": %u, \"batches\": %u, \"drawCalls\": %u, \"sceneLights\": %u}}",
+                     start, s.visibleLights_, s.shadowMaps_, s.batches_, s.drawCalls_, s.sceneLights_);
+        AppendFormat(out,
+                     ", {\"name\": \"Animation\", \"ph\": \"C\", \"pid\": 1, \"ts\": %.1f, \"args\": "
+                     "{\"animatedNodes\": %u, \"pausedNodes\": %u, \"animationMs\": %.3f}}",
+                     start, s.animatedNodes_, s.pausedNodes_, s.animationMs_);
+    }
+    for (const Marker& marker : markers_)
+    {
+        out += ", {\"name\": ";
+        AppendJSONString(out, marker.label_.c_str());
+        AppendFormat(out, ", \"ph\": \"i\", \"s\": \"g\", \"pid\": 1, \"tid\": 1, \"ts\": %.1f}",
+                     marker.timeMs_ * 1000.0);
+    }
+    out += "]}";
+    return out;
+}
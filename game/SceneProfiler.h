@@ -0,0 +1,118 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#pragma once
+
+#include <Urho3D/Core/Object.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Scene/Scene.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Urho3D
+{
+class Light;
+}
+
+/// Samples frame time, renderer/graphics statistics and the top profiler blocks every frame into a rolling window, so
+/// the cost of each command on the renderer can be inspected while the game runs. Sampling runs on the main thread;
+/// the window is published under a mutex and can be serialized from any thread.
+class SceneProfiler : public Urho3D::Object
+{
+    URHO3D_OBJECT(SceneProfiler, Urho3D::Object);
+
+public:
+    /// Number of frames kept in the window.
+    static constexpr unsigned WINDOW_SIZE = 600;
+    /// Maximum number of profiler blocks kept per frame.
+    static constexpr unsigned MAX_BLOCKS = 16;
+    /// Number of frames averaged before and after a marker.
+    static constexpr unsigned MARKER_FRAMES = 30;
+    /// Interval in frames at which the scene nodes and lights are counted. Counting walks the whole scene.
+    static constexpr unsigned SCENE_COUNT_INTERVAL = 30;
+
+    /// One profiler block of a frame.
+    struct BlockSample
+    {
+        char name_[32];
+        unsigned char depth_;
+        float ms_;
+    };
+
+    /// Statistics of one frame.
+    struct FrameSample
+    {
+        unsigned frameNumber_;
+        /// Frame start, in milliseconds since the profiler was created.
+        double startMs_;
+        /// Wall time from begin to end of frame.
+        float frameMs_;
+        float timeStepMs_;
+        /// Nodes and lights in the scene as of the last count, at most SCENE_COUNT_INTERVAL frames ago.
+        unsigned sceneNodes_;
+        unsigned sceneLights_;
+        unsigned views_;
+        unsigned visibleLights_;
+        unsigned shadowMaps_;
+        unsigned occluders_;
+        unsigned geometries_;
+        unsigned batches_;
+        unsigned drawCalls_;
+        unsigned primitives_;
+        /// Nodes evaluated and paused by the batched animation, and the time it took.
+        unsigned animatedNodes_;
+        unsigned pausedNodes_;
+        float animationMs_;
+        unsigned numBlocks_;
+        BlockSample blocks_[MAX_BLOCKS];
+    };
+
+    /// Construct.
+    explicit SceneProfiler(Urho3D::Context* context);
+
+    /// Set the scene whose nodes and lights are counted.
+    void SetScene(Urho3D::Scene* scene)
+    {
+        scene_ = scene;
+        framesToCount_ = 0;
+    }
+    /// Mark the current frame, e.g. with the command applied in it.
+    void AddMarker(const Urho3D::String& label);
+
+    /// Return the window as JSON, with before/after frame time averages around each marker. Thread safe.
+    std::string ToJSON() const;
+    /// Return the window in Chrome trace event format (chrome://tracing, Perfetto). Thread safe.
+    std::string ToChromeTrace() const;
+
+private:
+    void HandleBeginFrame(Urho3D::StringHash eventType, Urho3D::VariantMap& eventData);
+    void HandleEndFrame(Urho3D::StringHash eventType, Urho3D::VariantMap& eventData);
+    /// Copy the profiler blocks of the last completed frame.
+    void SampleProfilerBlocks(FrameSample& sample) const;
+
+    struct Marker
+    {
+        unsigned frameNumber_;
+        double timeMs_;
+        std::string label_;
+    };
+
+    Urho3D::WeakPtr<Urho3D::Scene> scene_{};
+    Urho3D::HiresTimer clock_{};
+    /// Sample being filled in by the current frame. Main thread only.
+    FrameSample current_{};
+    /// Scene counts carried over between counts, the frames left until the next one, and the scratch the count fills.
+    /// Main thread only.
+    unsigned sceneNodes_{0};
+    unsigned sceneLights_{0};
+    unsigned framesToCount_{0};
+    Urho3D::PODVector<Urho3D::Node*> nodes_{};
+    Urho3D::PODVector<Urho3D::Light*> lights_{};
+
+    mutable std::mutex mutex_{};
+    /// Ring buffer of completed frames.
+    std::vector<FrameSample> window_{};
+    unsigned next_{0};
+    std::vector<Marker> markers_{};
+};
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <mutex>
 #include <queue>
 
@@ -10,6 +11,7 @@ public:
     {
         std::unique_lock<std::mutex> lck(mutex_);
         queue_.push(std::move(ele));
+        size_.store(queue_.size(), std::memory_order_relaxed);
     }
 
     bool Pop(T& out)
@@ -21,10 +23,15 @@ public:
         }
         out = std::move(queue_.front());
         queue_.pop();
+        size_.store(queue_.size(), std::memory_order_relaxed);
         return true;
     }
 
+    /// Return the number of queued elements without locking. Approximate when called concurrently.
+    size_t Size() const { return size_.load(std::memory_order_relaxed); }
+
 private:
     std::mutex mutex_{};
     std::queue<T> queue_{};
+    std::atomic<size_t> size_{0};
 };
\ No newline at end of file
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+/// Bounded lock-free ring for exactly one producer thread and one consumer thread. Each side caches the other side's
+/// index, so a push or pop only touches the shared cache line when the cached view says the ring is full or empty.
+template <typename T, size_t CAPACITY> class SpscRing
+{
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    /// Push an element. Producer only. Return false if the ring is full.
+    bool TryPush(const T& ele)
+    {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (head - tailCache_ == CAPACITY)
+        {
+            tailCache_ = tail_.load(std::memory_order_acquire);
+            if (head - tailCache_ == CAPACITY)
+            {
+                return false;
+            }
+        }
+        slots_[head & (CAPACITY - 1)] = ele;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Pop an element. Consumer only. Return false if the ring is empty.
+    bool TryPop(T& out)
+    {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == headCache_)
+        {
+            headCache_ = head_.load(std::memory_order_acquire);
+            if (tail == headCache_)
+            {
+                return false;
+            }
+        }
+        out = slots_[tail & (CAPACITY - 1)];
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Return the number of queued elements. Approximate when called concurrently.
+    size_t Size() const { return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire); }
+
+private:
+    alignas(64) std::atomic<size_t> head_{0};
+    /// Producer's view of tail_.
+    size_t tailCache_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+    /// Consumer's view of head_.
+    size_t headCache_{0};
+    alignas(64) T slots_[CAPACITY]{};
+};
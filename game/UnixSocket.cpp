@@ -0,0 +1,67 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#include "UnixSocket.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <Urho3D/DebugNew.h>
+
+std::string GetUnixSocketAddress(const std::string& endpoint)
+{
+    std::string address(endpoint);
+    if (!address.empty() && address[0] == '@')
+        address[0] = '\0';
+    return address;
+}
+
+#ifndef _WIN32
+
+bool GetUnixSocketAddress(const std::string& address, sockaddr_un& addr, socklen_t& length)
+{
+    if (address.empty() || address.size() >= sizeof(addr.sun_path))
+        return false;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, address.data(), address.size());
+    length = (socklen_t)(offsetof(sockaddr_un, sun_path) + address.size() + (address[0] ? 1 : 0));
+    return true;
+}
+
+bool RemoveStaleSocketFile(const std::string& address)
+{
+    // A name in the abstract namespace has no file, and is free once its last socket closes
+    struct stat info;
+    if (address.empty() || address[0] == '\0' || lstat(address.c_str(), &info) != 0)
+        return true;
+    if (!S_ISSOCK(info.st_mode))
+        return false;
+
+    // Stale only if nothing listens on it any more: a live instance accepts, or at worst has a full backlog
+    sockaddr_un addr;
+    socklen_t length;
+    if (!GetUnixSocketAddress(address, addr, length))
+        return false;
+    const int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        return false;
+    const bool stale = connect(sock, reinterpret_cast<sockaddr*>(&addr), length) != 0 && errno == ECONNREFUSED;
+    close(sock);
+    return stale && unlink(address.c_str()) == 0;
+}
+
+#else
+
+bool RemoveStaleSocketFile(const std::string& address)
+{
+    return true;
+}
+
+#endif
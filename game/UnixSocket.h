@@ -0,0 +1,25 @@
+// Copyright (c) 2008-2022 the Urho3D project
+// License: MIT
+
+#pragma once
+
+#include <string>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+/// Return the socket address of a unix domain socket endpoint given on the command line. A leading '@' names a socket
+/// in the abstract namespace, which has no file and goes away with the process.
+std::string GetUnixSocketAddress(const std::string& endpoint);
+
+/// Make a unix domain socket address free to bind. A socket file left by a process that did not exit cleanly is
+/// removed; one still listened on, or a file that is not a socket, is left alone and false is returned.
+bool RemoveStaleSocketFile(const std::string& address);
+
+#ifndef _WIN32
+/// Fill a unix domain socket address. A leading '\0' is the abstract namespace, in which the name is the rest of the
+/// address rather than up to the first '\0'. Return false if the address is empty or too long.
+bool GetUnixSocketAddress(const std::string& address, sockaddr_un& addr, socklen_t& length);
+#endif
@@ -19,7 +19,22 @@
 #endif
 
 #ifndef CPPHTTPLIB_KEEPALIVE_MAX_COUNT
-#define CPPHTTPLIB_KEEPALIVE_MAX_COUNT 5
+#define CPPHTTPLIB_KEEPALIVE_MAX_COUNT 1000
+#endif
+
+#ifndef CPPHTTPLIB_KEEPALIVE_MAX_PARKED
+#define CPPHTTPLIB_KEEPALIVE_MAX_PARKED 4096
+#endif
+
+#if defined(__linux__) && !defined(CPPHTTPLIB_NO_KEEPALIVE_PARKING)
+#define CPPHTTPLIB_KEEPALIVE_PARKING
+#endif
+
+#if defined(__linux__) && !defined(CPPHTTPLIB_NO_IO_URING) &&                  \
+    defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define CPPHTTPLIB_IO_URING
+#endif
 #endif
 
 #ifndef CPPHTTPLIB_CONNECTION_TIMEOUT_SECOND
@@ -58,6 +73,14 @@
 #endif
 #endif
 
+#ifndef CPPHTTPLIB_DRAIN_TIMEOUT_SECOND
+#define CPPHTTPLIB_DRAIN_TIMEOUT_SECOND 5
+#endif
+
+#ifndef CPPHTTPLIB_DRAIN_TIMEOUT_USECOND
+#define CPPHTTPLIB_DRAIN_TIMEOUT_USECOND 0
+#endif
+
 #ifndef CPPHTTPLIB_REQUEST_URI_MAX_LENGTH
 #define CPPHTTPLIB_REQUEST_URI_MAX_LENGTH 8192
 #endif
@@ -74,6 +97,14 @@
 #define CPPHTTPLIB_MULTIPART_FORM_DATA_FILE_MAX_COUNT 1024
 #endif
 
+#ifndef CPPHTTPLIB_RANGE_MAX_COUNT
+#define CPPHTTPLIB_RANGE_MAX_COUNT 1024
+#endif
+
+#ifndef CPPHTTPLIB_FILE_READ_BUFSIZ
+#define CPPHTTPLIB_FILE_READ_BUFSIZ size_t(65536u)
+#endif
+
 #ifndef CPPHTTPLIB_PAYLOAD_MAX_LENGTH
 #define CPPHTTPLIB_PAYLOAD_MAX_LENGTH ((std::numeric_limits<size_t>::max)())
 #endif
@@ -110,7 +141,7 @@
 #endif
 
 #ifndef CPPHTTPLIB_LISTEN_BACKLOG
-#define CPPHTTPLIB_LISTEN_BACKLOG 5
+#define CPPHTTPLIB_LISTEN_BACKLOG SOMAXCONN
 #endif
 
 /*
@@ -197,6 +228,20 @@ using socket_t = SOCKET;
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
+#ifdef CPPHTTPLIB_KEEPALIVE_PARKING
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+#ifdef CPPHTTPLIB_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+// Needs multishot accept and timeouts on io_uring_enter (Linux 5.19 headers)
+#if !defined(IORING_ACCEPT_MULTISHOT) || !defined(IORING_FEAT_EXT_ARG) ||      \
+    !defined(__NR_io_uring_setup)
+#undef CPPHTTPLIB_IO_URING
+#endif
+#endif
 
 using socket_t = int;
 #ifndef INVALID_SOCKET
@@ -212,6 +257,7 @@ using socket_t = int;
 #include <climits>
 #include <condition_variable>
 #include <cstring>
+#include <deque>
 #include <errno.h>
 #include <fcntl.h>
 #include <fstream>
@@ -229,8 +275,16 @@ using socket_t = int;
 #include <string>
 #include <sys/stat.h>
 #include <thread>
+#include <unordered_map>
 #include <utility>
 
+#if !defined(CPPHTTPLIB_NO_SIMD) &&                                            \
+    (defined(__SSE2__) || defined(_M_X64) ||                                   \
+     (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define CPPHTTPLIB_SSE2
+#include <emmintrin.h>
+#endif
+
 #ifdef CPPHTTPLIB_OPENSSL_SUPPORT
 #ifdef _WIN32
 #include <wincrypt.h>
@@ -353,7 +407,113 @@ private:
 
 using Headers = std::multimap<std::string, std::string, detail::ci>;
 
-using Params = std::multimap<std::string, std::string>;
+// Query and form parameters: a vector kept sorted by name, the values of a
+// name in the order they were added, as in the std::multimap it replaces.
+// Parsed parameters take one allocation rather than a node each, and are
+// looked up by binary search.
+class Params {
+public:
+    using key_type = std::string;
+    using mapped_type = std::string;
+    using value_type = std::pair<std::string, std::string>;
+    using iterator = std::vector<value_type>::iterator;
+    using const_iterator = std::vector<value_type>::const_iterator;
+    using size_type = std::vector<value_type>::size_type;
+
+    Params() = default;
+    Params(std::initializer_list<value_type> init) {
+        insert(init.begin(), init.end());
+    }
+    template <typename InputIt> Params(InputIt first, InputIt last) {
+        insert(first, last);
+    }
+
+    template <typename... Args> iterator emplace(Args &&...args) {
+        value_type value(std::forward<Args>(args)...);
+        return entries_.insert(upper_bound(value.first), std::move(value));
+    }
+    iterator insert(const value_type &value) { return emplace(value); }
+    iterator insert(value_type &&value) { return emplace(std::move(value)); }
+    // Appends, then merges the new parameters into place.
+    template <typename InputIt> void insert(InputIt first, InputIt last) {
+        auto size = entries_.size();
+        entries_.insert(entries_.end(), first, last);
+        auto mid = entries_.begin() + static_cast<std::ptrdiff_t>(size);
+        std::stable_sort(mid, entries_.end(), key_less());
+        std::inplace_merge(entries_.begin(), mid, entries_.end(), key_less());
+    }
+
+    iterator erase(const_iterator pos) { return entries_.erase(pos); }
+    size_type erase(const std::string &key) {
+        auto r = equal_range(key);
+        auto count = static_cast<size_type>(std::distance(r.first, r.second));
+        entries_.erase(r.first, r.second);
+        return count;
+    }
+    void clear() { entries_.clear(); }
+    void reserve(size_type n) { entries_.reserve(n); }
+
+    iterator find(const std::string &key) {
+        auto it = lower_bound(key);
+        return it != end() && it->first == key ? it : end();
+    }
+    const_iterator find(const std::string &key) const {
+        auto it = lower_bound(key);
+        return it != end() && it->first == key ? it : end();
+    }
+    size_type count(const std::string &key) const {
+        auto r = equal_range(key);
+        return static_cast<size_type>(std::distance(r.first, r.second));
+    }
+    iterator lower_bound(const std::string &key) {
+        return std::lower_bound(begin(), end(), key, key_less());
+    }
+    const_iterator lower_bound(const std::string &key) const {
+        return std::lower_bound(begin(), end(), key, key_less());
+    }
+    iterator upper_bound(const std::string &key) {
+        return std::upper_bound(begin(), end(), key, key_less());
+    }
+    const_iterator upper_bound(const std::string &key) const {
+        return std::upper_bound(begin(), end(), key, key_less());
+    }
+    std::pair<iterator, iterator> equal_range(const std::string &key) {
+        return std::equal_range(begin(), end(), key, key_less());
+    }
+    std::pair<const_iterator, const_iterator>
+    equal_range(const std::string &key) const {
+        return std::equal_range(begin(), end(), key, key_less());
+    }
+
+    iterator begin() { return entries_.begin(); }
+    iterator end() { return entries_.end(); }
+    const_iterator begin() const { return entries_.begin(); }
+    const_iterator end() const { return entries_.end(); }
+    const_iterator cbegin() const { return entries_.cbegin(); }
+    const_iterator cend() const { return entries_.cend(); }
+    size_type size() const { return entries_.size(); }
+    bool empty() const { return entries_.empty(); }
+
+    bool operator==(const Params &other) const {
+        return entries_ == other.entries_;
+    }
+    bool operator!=(const Params &other) const { return !(*this == other); }
+
+private:
+    struct key_less {
+        bool operator()(const value_type &a, const value_type &b) const {
+            return a.first < b.first;
+        }
+        bool operator()(const value_type &a, const std::string &key) const {
+            return a.first < key;
+        }
+        bool operator()(const std::string &key, const value_type &b) const {
+            return key < b.first;
+        }
+    };
+
+    std::vector<value_type> entries_;
+};
 using Match = std::smatch;
 
 using Progress = std::function<bool(uint64_t current, uint64_t total)>;
@@ -464,6 +624,10 @@ struct Request {
     int remote_port = -1;
     std::string local_addr;
     int local_port = -1;
+    // Credentials of the peer process on a unix domain socket, where
+    // remote_port is its pid. -1 if unknown.
+    int remote_uid = -1;
+    int remote_gid = -1;
 
     // for server
     std::string version;
@@ -567,6 +731,7 @@ public:
     virtual ssize_t write(const char *ptr, size_t size) = 0;
     virtual void get_remote_ip_and_port(std::string &ip, int &port) const = 0;
     virtual void get_local_ip_and_port(std::string &ip, int &port) const = 0;
+    virtual void get_peer_credentials(int & /*uid*/, int & /*gid*/) const {}
     virtual socket_t socket() const = 0;
 
     template <typename... Args>
@@ -665,6 +830,10 @@ using SocketOptions = std::function<void(socket_t sock)>;
 
 void default_socket_options(socket_t sock);
 
+namespace detail {
+class KeepAliveParking;
+} // namespace detail
+
 class Server {
 public:
     using Handler = std::function<void(const Request &, Response &)>;
@@ -728,6 +897,12 @@ public:
 
     Server &set_keep_alive_max_count(size_t count);
     Server &set_keep_alive_timeout(time_t sec);
+    Server &set_keep_alive_parking(bool on);
+    Server &set_keep_alive_max_parked(size_t count);
+    Server &set_io_uring(bool on);
+    // Count the socket system calls, for socket_syscall_count(). Off by
+    // default: the workers would all update one counter.
+    Server &set_count_syscalls(bool on);
 
     Server &set_read_timeout(time_t sec, time_t usec = 0);
     template <class Rep, class Period>
@@ -741,10 +916,19 @@ public:
     template <class Rep, class Period>
     Server &set_idle_interval(const std::chrono::duration<Rep, Period> &duration);
 
+    // How long stopping waits for the requests in flight before it shuts
+    // their connections down
+    Server &set_drain_timeout(time_t sec, time_t usec = 0);
+    template <class Rep, class Period>
+    Server &set_drain_timeout(const std::chrono::duration<Rep, Period> &duration);
+
     Server &set_payload_max_length(size_t length);
 
     bool bind_to_port(const std::string &host, int port, int socket_flags = 0);
     int bind_to_any_port(const std::string &host, int socket_flags = 0);
+    // Adopt a socket that is bound and listening already, such as one inherited
+    // from another process. The server owns it from then on.
+    bool bind_to_socket(socket_t sock);
     bool listen_after_bind();
 
     bool listen(const std::string &host, int port, int socket_flags = 0);
@@ -752,6 +936,19 @@ public:
     bool is_running() const;
     void wait_until_ready() const;
     void stop();
+    // Stop like stop(), but close the listening socket without shutting it
+    // down, so that it keeps listening for the other processes holding it and
+    // the connections waiting on it are left for them to accept. The accept
+    // loop notices within the idle interval, so set one.
+    void hand_off();
+
+    // The listening socket, INVALID_SOCKET when not bound. To be shared with
+    // another process, which may accept on it too.
+    socket_t listening_socket() const;
+
+    // Socket system calls made by the server so far, connections and requests
+    // alike. Always 0 unless set_count_syscalls() is on.
+    uint64_t socket_syscall_count() const;
 
     std::function<TaskQueue *(void)> new_task_queue;
 
@@ -763,12 +960,18 @@ protected:
     std::atomic<socket_t> svr_sock_{INVALID_SOCKET};
     size_t keep_alive_max_count_ = CPPHTTPLIB_KEEPALIVE_MAX_COUNT;
     time_t keep_alive_timeout_sec_ = CPPHTTPLIB_KEEPALIVE_TIMEOUT_SECOND;
+    bool keep_alive_parking_enabled_ = true;
+    size_t keep_alive_max_parked_ = CPPHTTPLIB_KEEPALIVE_MAX_PARKED;
+    bool io_uring_enabled_ = false;
+    bool count_syscalls_ = false;
     time_t read_timeout_sec_ = CPPHTTPLIB_READ_TIMEOUT_SECOND;
     time_t read_timeout_usec_ = CPPHTTPLIB_READ_TIMEOUT_USECOND;
     time_t write_timeout_sec_ = CPPHTTPLIB_WRITE_TIMEOUT_SECOND;
     time_t write_timeout_usec_ = CPPHTTPLIB_WRITE_TIMEOUT_USECOND;
     time_t idle_interval_sec_ = CPPHTTPLIB_IDLE_INTERVAL_SECOND;
     time_t idle_interval_usec_ = CPPHTTPLIB_IDLE_INTERVAL_USECOND;
+    time_t drain_timeout_sec_ = CPPHTTPLIB_DRAIN_TIMEOUT_SECOND;
+    time_t drain_timeout_usec_ = CPPHTTPLIB_DRAIN_TIMEOUT_USECOND;
     size_t payload_max_length_ = CPPHTTPLIB_PAYLOAD_MAX_LENGTH;
 
 private:
@@ -781,6 +984,8 @@ private:
                                   SocketOptions socket_options) const;
     int bind_internal(const std::string &host, int port, int socket_flags);
     bool listen_internal();
+    // socket_syscalls_ when counting, else nullptr
+    std::atomic<uint64_t> *enabled_syscall_counter();
 
     bool routing(Request &req, Response &res, Stream &strm);
     bool handle_file_request(const Request &req, Response &res,
@@ -792,7 +997,7 @@ private:
                                         const HandlersForContentReader &handlers);
 
     bool parse_request_line(const char *s, Request &req);
-    void apply_ranges(const Request &req, Response &res,
+    void apply_ranges(const Request &req, const Ranges &ranges, Response &res,
                       std::string &content_type, std::string &boundary);
     bool write_response(Stream &strm, bool close_connection, const Request &req,
                         Response &res);
@@ -802,7 +1007,8 @@ private:
                              const Request &req, Response &res,
                              bool need_apply_ranges);
     bool write_content_with_provider(Stream &strm, const Request &req,
-                                     Response &res, const std::string &boundary,
+                                     const Ranges &ranges, Response &res,
+                                     const std::string &boundary,
                                      const std::string &content_type);
     bool read_content(Stream &strm, Request &req, Response &res);
     bool
@@ -816,6 +1022,8 @@ private:
                            ContentReceiver multipart_receiver);
 
     virtual bool process_and_close_socket(socket_t sock);
+    bool process_socket(socket_t sock, size_t remaining_count);
+    void drain_connections();
 
     struct MountPointEntry {
         std::string mount_point;
@@ -826,6 +1034,17 @@ private:
 
     std::atomic<bool> is_running_{false};
     std::atomic<bool> done_{false};
+    std::atomic<bool> handing_off_{false};
+    // Set while listening. Idle keep-alive connections wait here instead of
+    // holding a worker thread.
+    detail::KeepAliveParking *keep_alive_parking_ = nullptr;
+    std::atomic<uint64_t> socket_syscalls_{0};
+    // Connections a worker is serving, shut down when they outlast the drain
+    // timeout. A worker removes its connection before closing it, so that a
+    // socket number here is never one reused by a later connection.
+    std::mutex connections_mutex_;
+    std::condition_variable connections_cv_;
+    std::set<socket_t> connections_;
     std::map<std::string, std::string> file_extension_and_mimetype_map_;
     Handler file_request_handler_;
     Handlers get_handlers_;
@@ -1711,6 +1930,14 @@ Server::set_idle_interval(const std::chrono::duration<Rep, Period> &duration) {
     return *this;
 }
 
+template <class Rep, class Period>
+inline Server &
+Server::set_drain_timeout(const std::chrono::duration<Rep, Period> &duration) {
+    detail::duration_to_sec_and_usec(
+        duration, [&](time_t sec, time_t usec) { set_drain_timeout(sec, usec); });
+    return *this;
+}
+
 inline std::string to_string(const Error error) {
     switch (error) {
     case Error::Success: return "Success (no error)";
@@ -1810,6 +2037,8 @@ std::string encode_query_param(const std::string &value);
 
 std::string decode_url(const std::string &s, bool convert_plus_to_space);
 
+void decode_url_in_place(std::string &s, bool convert_plus_to_space);
+
 void read_file(const std::string &path, std::string &out);
 
 std::string trim_copy(const std::string &s);
@@ -2003,15 +2232,14 @@ inline bool is_hex(char c, int &v) {
     return false;
 }
 
-inline bool from_hex_to_i(const std::string &s, size_t i, size_t cnt,
+inline bool from_hex_to_i(const char *p, const char *end, size_t cnt,
                           int &val) {
-    if (i >= s.size()) { return false; }
+    if (static_cast<size_t>(end - p) < cnt) { return false; }
 
     val = 0;
-    for (; cnt; i++, cnt--) {
-        if (!s[i]) { return false; }
+    for (; cnt; p++, cnt--) {
         int v = 0;
-        if (is_hex(s[i], v)) {
+        if (is_hex(*p, v)) {
             val = val * 16 + v;
         } else {
             return false;
@@ -2021,13 +2249,14 @@ inline bool from_hex_to_i(const std::string &s, size_t i, size_t cnt,
 }
 
 inline std::string from_i_to_hex(size_t n) {
-    const char *charset = "0123456789abcdef";
-    std::string ret;
+    static const char charset[] = "0123456789abcdef";
+    char buf[sizeof(size_t) * 2];
+    auto p = buf + sizeof(buf);
     do {
-        ret = charset[n & 15] + ret;
+        *--p = charset[n & 15];
         n >>= 4;
     } while (n > 0);
-    return ret;
+    return std::string(p, buf + sizeof(buf));
 }
 
 inline size_t to_utf8(int code, char *buff) {
@@ -2062,31 +2291,33 @@ inline size_t to_utf8(int code, char *buff) {
     return 0;
 }
 
-// NOTE: This code came up with the following stackoverflow post:
-// https://stackoverflow.com/questions/180947/base64-decode-snippet-in-c
+// Three bytes at a time into four characters, written into the padded
+// output sized up front.
 inline std::string base64_encode(const std::string &in) {
-    static const auto lookup =
+    static const char lookup[] =
         "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
-    std::string out;
-    out.reserve(in.size());
-
-    int val = 0;
-    int valb = -6;
+    std::string out((in.size() + 2) / 3 * 4, '=');
+    auto p = reinterpret_cast<const uint8_t *>(in.data());
+    auto n = in.size();
+    auto o = &out[0];
 
-    for (auto c : in) {
-        val = (val << 8) + static_cast<uint8_t>(c);
-        valb += 8;
-        while (valb >= 0) {
-            out.push_back(lookup[(val >> valb) & 0x3F]);
-            valb -= 6;
-        }
+    size_t i = 0;
+    for (; i + 3 <= n; i += 3) {
+        auto v = static_cast<uint32_t>(p[i]) << 16 |
+                 static_cast<uint32_t>(p[i + 1]) << 8 | p[i + 2];
+        *o++ = lookup[v >> 18];
+        *o++ = lookup[(v >> 12) & 0x3F];
+        *o++ = lookup[(v >> 6) & 0x3F];
+        *o++ = lookup[v & 0x3F];
     }
 
-    if (valb > -6) { out.push_back(lookup[((val << 8) >> (valb + 8)) & 0x3F]); }
-
-    while (out.size() % 4) {
-        out.push_back('=');
+    if (i < n) {
+        auto v = static_cast<uint32_t>(p[i]) << 16;
+        if (i + 1 < n) { v |= static_cast<uint32_t>(p[i + 1]) << 8; }
+        *o++ = lookup[v >> 18];
+        *o++ = lookup[(v >> 12) & 0x3F];
+        if (i + 1 < n) { *o++ = lookup[(v >> 6) & 0x3F]; }
     }
 
     return out;
@@ -2143,93 +2374,142 @@ inline bool is_valid_path(const std::string &path) {
     return true;
 }
 
-inline std::string encode_query_param(const std::string &value) {
-    std::ostringstream escaped;
-    escaped.fill('0');
-    escaped << std::hex;
-
-    for (auto c : value) {
-        if (std::isalnum(static_cast<uint8_t>(c)) || c == '-' || c == '_' ||
-            c == '.' || c == '!' || c == '~' || c == '*' || c == '\'' || c == '(' ||
-            c == ')') {
-            escaped << c;
-        } else {
-            escaped << std::uppercase;
-            escaped << '%' << std::setw(2)
-                    << static_cast<int>(static_cast<unsigned char>(c));
-            escaped << std::nouppercase;
+// Copies the runs of bytes that need no escaping whole, and escapes the
+// others as %XX.
+template <typename T>
+inline std::string percent_encode(const char *p, const char *end,
+                                  T needs_escape) {
+    static const char hex[] = "0123456789ABCDEF";
+    std::string result;
+    result.reserve(static_cast<size_t>(end - p));
+
+    while (p < end) {
+        auto run = p;
+        while (run < end && !needs_escape(static_cast<uint8_t>(*run))) {
+            run++;
         }
+        result.append(p, run);
+        if (run == end) { break; }
+        auto c = static_cast<uint8_t>(*run);
+        result += '%';
+        result += hex[c >> 4];
+        result += hex[c & 15];
+        p = run + 1;
     }
 
-    return escaped.str();
+    return result;
 }
 
-inline std::string encode_url(const std::string &s) {
-    std::string result;
-    result.reserve(s.size());
-
-    for (size_t i = 0; s[i]; i++) {
-        switch (s[i]) {
-        case ' ': result += "%20"; break;
-        case '+': result += "%2B"; break;
-        case '\r': result += "%0D"; break;
-        case '\n': result += "%0A"; break;
-        case '\'': result += "%27"; break;
-        case ',': result += "%2C"; break;
-        // case ':': result += "%3A"; break; // ok? probably...
-        case ';': result += "%3B"; break;
-        default:
-            auto c = static_cast<uint8_t>(s[i]);
-            if (c >= 0x80) {
-                result += '%';
-                char hex[4];
-                auto len = snprintf(hex, sizeof(hex) - 1, "%02X", c);
-                assert(len == 2);
-                result.append(hex, static_cast<size_t>(len));
-            } else {
-                result += s[i];
-            }
-            break;
+inline std::string encode_query_param(const std::string &value) {
+    static const auto unreserved = [] {
+        std::array<bool, 256> table{};
+        for (int c = 0; c < 256; c++) {
+            table[c] = std::isalnum(c) || c == '-' || c == '_' || c == '.' ||
+                       c == '!' || c == '~' || c == '*' || c == '\'' ||
+                       c == '(' || c == ')';
         }
-    }
+        return table;
+    }();
 
-    return result;
+    return percent_encode(value.data(), value.data() + value.size(),
+                          [](uint8_t c) { return !unreserved[c]; });
 }
 
-inline std::string decode_url(const std::string &s,
-                              bool convert_plus_to_space) {
-    std::string result;
-
-    for (size_t i = 0; i < s.size(); i++) {
-        if (s[i] == '%' && i + 1 < s.size()) {
-            if (s[i + 1] == 'u') {
-                int val = 0;
-                if (from_hex_to_i(s, i + 2, 4, val)) {
-                    // 4 digits Unicode codes
-                    char buff[4];
-                    size_t len = to_utf8(val, buff);
-                    if (len > 0) { result.append(buff, len); }
-                    i += 5; // 'u0000'
-                } else {
-                    result += s[i];
-                }
-            } else {
-                int val = 0;
-                if (from_hex_to_i(s, i + 1, 2, val)) {
-                    // 2 digits hex codes
-                    result += static_cast<char>(val);
-                    i += 2; // '00'
-                } else {
-                    result += s[i];
-                }
-            }
-        } else if (convert_plus_to_space && s[i] == '+') {
-            result += ' ';
+inline std::string encode_url(const std::string &s) {
+    static const auto escaped = [] {
+        std::array<bool, 256> table{};
+        // ':' is probably fine left as is
+        for (auto c : {' ', '+', '\r', '\n', '\'', ',', ';'}) {
+            table[static_cast<uint8_t>(c)] = true;
+        }
+        for (int c = 0x80; c < 256; c++) {
+            table[c] = true;
+        }
+        return table;
+    }();
+
+    // Up to a NUL, if there is one
+    auto end = static_cast<const char *>(memchr(s.data(), '\0', s.size()));
+    return percent_encode(s.data(), end ? end : s.data() + s.size(),
+                          [](uint8_t c) { return escaped[c]; });
+}
+
+// The first '%' in [b, e), or '+' when plus is set. Most of a URL or a header
+// value has neither, so runs are skipped 16 bytes at a time with SSE2, and 8
+// at a time as a word elsewhere.
+inline const char *find_url_escape(const char *b, const char *e, bool plus) {
+#ifdef CPPHTTPLIB_SSE2
+    const auto percent = _mm_set1_epi8('%');
+    const auto plus_sign = _mm_set1_epi8(plus ? '+' : '%');
+    while (e - b >= 16) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b));
+        auto m = _mm_or_si128(_mm_cmpeq_epi8(v, percent),
+                              _mm_cmpeq_epi8(v, plus_sign));
+        if (_mm_movemask_epi8(m)) { break; }
+        b += 16;
+    }
+#else
+    const uint64_t ones = 0x0101010101010101ull;
+    const uint64_t highs = 0x8080808080808080ull;
+    const auto percent = ones * '%';
+    const auto plus_sign = ones * static_cast<uint8_t>(plus ? '+' : '%');
+    while (e - b >= 8) {
+        uint64_t w;
+        memcpy(&w, b, sizeof(w));
+        // A byte of x or y is zero where w has one of them
+        auto x = w ^ percent;
+        auto y = w ^ plus_sign;
+        if (((x - ones) & ~x & highs) | ((y - ones) & ~y & highs)) { break; }
+        b += 8;
+    }
+#endif
+    while (b < e && *b != '%' && !(plus && *b == '+')) {
+        b++;
+    }
+    return b;
+}
+
+// Decoding never lengthens the string: %XX is one byte and %uXXXX at most
+// three, so it is decoded where it is, and left untouched when it has
+// nothing to decode.
+inline void decode_url_in_place(std::string &s, bool convert_plus_to_space) {
+    const auto begin = &s[0];
+    const auto end = begin + s.size();
+    auto in = find_url_escape(begin, end, convert_plus_to_space);
+    if (in == end) { return; }
+
+    auto out = begin + (in - begin);
+    while (in < end) {
+        int val = 0;
+        if (*in == '+') {
+            *out++ = ' ';
+            in++;
+        } else if (in + 1 < end && in[1] == 'u' &&
+                   from_hex_to_i(in + 2, end, 4, val)) {
+            // 4 digits Unicode codes
+            out += to_utf8(val, out);
+            in += 6; // '%u0000'
+        } else if (in + 1 < end && in[1] != 'u' &&
+                   from_hex_to_i(in + 1, end, 2, val)) {
+            // 2 digits hex codes
+            *out++ = static_cast<char>(val);
+            in += 3; // '%00'
         } else {
-            result += s[i];
+            *out++ = *in++;
         }
+
+        auto run = find_url_escape(in, end, convert_plus_to_space);
+        memmove(out, in, static_cast<size_t>(run - in));
+        out += run - in;
+        in = run;
     }
+    s.resize(static_cast<size_t>(out - begin));
+}
 
+inline std::string decode_url(const std::string &s,
+                              bool convert_plus_to_space) {
+    auto result = s;
+    decode_url_in_place(result, convert_plus_to_space);
     return result;
 }
 
@@ -2242,6 +2522,46 @@ inline void read_file(const std::string &path, std::string &out) {
     fs.read(&out[0], static_cast<std::streamsize>(size));
 }
 
+// Serves a file from its descriptor a buffer at a time, so that neither the
+// file nor the ranges asked for are held in memory. Returns false where that
+// is not possible, for read_file to be used instead.
+inline bool set_file_content_provider(const std::string &path,
+                                      const std::string &content_type,
+                                      Response &res) {
+#ifdef _WIN32
+    (void)path;
+    (void)content_type;
+    (void)res;
+    return false;
+#else
+    auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { return false; }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+
+    auto size = static_cast<size_t>(st.st_size);
+    auto buf = std::make_shared<std::vector<char>>(
+        (std::min)(size, CPPHTTPLIB_FILE_READ_BUFSIZ));
+    res.set_content_provider(
+        size, content_type,
+        [fd, buf](size_t offset, size_t length, DataSink &sink) {
+            auto n = (std::min)(length, buf->size());
+            ssize_t r;
+            do {
+                r = pread(fd, buf->data(), n, static_cast<off_t>(offset));
+            } while (r < 0 && errno == EINTR);
+            // Truncated while being sent
+            if (r <= 0) { return false; }
+            return sink.write(buf->data(), static_cast<size_t>(r));
+        },
+        [fd](bool /*success*/) { close(fd); });
+    return true;
+#endif
+}
+
 inline std::string file_extension(const std::string &path) {
     std::smatch m;
     static auto re = std::regex("\\.([a-zA-Z0-9]+)$");
@@ -2352,7 +2672,34 @@ inline void stream_line_reader::append(char c) {
     }
 }
 
+// Socket system calls made on the current thread are counted here when it is
+// set, so that a server can report how many it makes per request.
+inline std::atomic<uint64_t> *&syscall_counter() {
+    static thread_local std::atomic<uint64_t> *counter = nullptr;
+    return counter;
+}
+
+inline void count_syscall() {
+    auto counter = syscall_counter();
+    if (counter) { counter->fetch_add(1, std::memory_order_relaxed); }
+}
+
+// Counts the socket system calls of the current thread while in scope.
+class scoped_syscall_counter {
+public:
+    explicit scoped_syscall_counter(std::atomic<uint64_t> *counter)
+        : prev_(syscall_counter()) {
+        syscall_counter() = counter;
+    }
+    scoped_syscall_counter(const scoped_syscall_counter &) = delete;
+    ~scoped_syscall_counter() { syscall_counter() = prev_; }
+
+private:
+    std::atomic<uint64_t> *prev_;
+};
+
 inline int close_socket(socket_t sock) {
+    count_syscall();
 #ifdef _WIN32
     return closesocket(sock);
 #else
@@ -2371,6 +2718,7 @@ template <typename T> inline ssize_t handle_EINTR(T fn) {
 }
 
 inline ssize_t read_socket(socket_t sock, void *ptr, size_t size, int flags) {
+    count_syscall();
     return handle_EINTR([&]() {
                             return recv(sock,
 #ifdef _WIN32
@@ -2384,6 +2732,7 @@ inline ssize_t read_socket(socket_t sock, void *ptr, size_t size, int flags) {
 
 inline ssize_t send_socket(socket_t sock, const void *ptr, size_t size,
                            int flags) {
+    count_syscall();
     return handle_EINTR([&]() {
                             return send(sock,
 #ifdef _WIN32
@@ -2396,6 +2745,7 @@ inline ssize_t send_socket(socket_t sock, const void *ptr, size_t size,
 }
 
 inline ssize_t select_read(socket_t sock, time_t sec, time_t usec) {
+    count_syscall();
 #ifdef CPPHTTPLIB_USE_POLL
     struct pollfd pfd_read;
     pfd_read.fd = sock;
@@ -2424,6 +2774,7 @@ inline ssize_t select_read(socket_t sock, time_t sec, time_t usec) {
 }
 
 inline ssize_t select_write(socket_t sock, time_t sec, time_t usec) {
+    count_syscall();
 #ifdef CPPHTTPLIB_USE_POLL
     struct pollfd pfd_read;
     pfd_read.fd = sock;
@@ -2519,10 +2870,363 @@ inline bool is_socket_alive(socket_t sock) {
     return detail::read_socket(sock, &buf[0], sizeof(buf), MSG_PEEK) > 0;
 }
 
+// An io_uring set up and driven with raw system calls. Each send or receive
+// of a stream is one io_uring_enter, with the timeout linked to the operation
+// instead of a poll ahead of it, and a connection is shut down and closed by
+// one pair of linked operations. A listener accepts through one multishot
+// accept, which keeps delivering connections without being submitted again.
+// A ring is not valid when the kernel does not support io_uring or one of the
+// operations, in which case the plain socket calls are used instead.
+class IoUring {
+public:
+    explicit IoUring(unsigned entries) {
+#ifdef CPPHTTPLIB_IO_URING
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (fd_ < 0) { return; }
+        if (!(params.features & IORING_FEAT_EXT_ARG) || !map(params) ||
+            !probe()) {
+            unmap();
+            close(fd_);
+            fd_ = -1;
+        }
+#else
+        (void)entries;
+#endif
+    }
+
+    IoUring(const IoUring &) = delete;
+
+    ~IoUring() {
+#ifdef CPPHTTPLIB_IO_URING
+        if (fd_ >= 0) {
+            unmap();
+            close(fd_);
+        }
+#endif
+    }
+
+    bool is_valid() const { return fd_ >= 0; }
+
+    // The ring of the calling thread, set up on first use. nullptr when it is
+    // not valid.
+    static IoUring *thread_ring() {
+        static thread_local std::unique_ptr<IoUring> ring(new IoUring(8));
+        return ring->is_valid() ? ring.get() : nullptr;
+    }
+
+    // Like recv() and send() on a socket with SO_RCVTIMEO or SO_SNDTIMEO set.
+    ssize_t recv(socket_t sock, void *ptr, size_t size, int flags, time_t sec,
+                 time_t usec) {
+#ifdef CPPHTTPLIB_IO_URING
+        return transfer(IORING_OP_RECV, sock, ptr, size, flags, sec, usec);
+#else
+        (void)sock;
+        (void)ptr;
+        (void)size;
+        (void)flags;
+        (void)sec;
+        (void)usec;
+        return -1;
+#endif
+    }
+
+    ssize_t send(socket_t sock, const void *ptr, size_t size, int flags,
+                 time_t sec, time_t usec) {
+#ifdef CPPHTTPLIB_IO_URING
+        return transfer(IORING_OP_SEND, sock, const_cast<void *>(ptr), size,
+                        flags, sec, usec);
+#else
+        (void)sock;
+        (void)ptr;
+        (void)size;
+        (void)flags;
+        (void)sec;
+        (void)usec;
+        return -1;
+#endif
+    }
+
+    // Shut down and close a socket. Returns false when it was left to the
+    // caller.
+    bool shutdown_and_close(socket_t sock) {
+#ifdef CPPHTTPLIB_IO_URING
+        auto shutdown_sqe = get_sqe();
+        auto close_sqe = get_sqe();
+        if (!shutdown_sqe || !close_sqe) { return false; }
+        // Hard link: close even when the peer is gone already
+        shutdown_sqe->opcode = IORING_OP_SHUTDOWN;
+        shutdown_sqe->fd = sock;
+        shutdown_sqe->len = SHUT_RDWR;
+        shutdown_sqe->flags = IOSQE_IO_HARDLINK;
+        close_sqe->opcode = IORING_OP_CLOSE;
+        close_sqe->fd = sock;
+        return complete(2, [](const io_uring_cqe &) {});
+#else
+        (void)sock;
+        return false;
+#endif
+    }
+
+    // Wait for connections on a listening socket, for at most the given time
+    // unless it is 0, and append them to socks. Returns 0, or the error of a
+    // failed accept, after which the caller is expected to accept without the
+    // ring.
+    int accept(socket_t svr_sock, time_t sec, time_t usec,
+               std::vector<socket_t> &socks) {
+#ifdef CPPHTTPLIB_IO_URING
+        if (!accepting_) {
+            auto sqe = get_sqe();
+            if (!sqe) { return EBUSY; }
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->fd = svr_sock;
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            sqe->user_data = accept_user_data;
+            accepting_ = true;
+        }
+
+        __kernel_timespec ts;
+        ts.tv_sec = sec;
+        ts.tv_nsec = usec * 1000;
+        if (enter(1, sec > 0 || usec > 0 ? &ts : nullptr) < 0 &&
+            errno != EINTR && errno != ETIME) {
+            return errno;
+        }
+
+        auto error = 0;
+        reap([&](const io_uring_cqe &cqe) { reap_accept(cqe, socks, error); });
+        return error;
+#else
+        (void)svr_sock;
+        (void)sec;
+        (void)usec;
+        (void)socks;
+        return ENOSYS;
+#endif
+    }
+
+    // Cancel the armed accept and append the connections it took meanwhile to
+    // socks, which would be lost otherwise.
+    void cancel_accept(std::vector<socket_t> &socks) {
+#ifdef CPPHTTPLIB_IO_URING
+        if (!accepting_) { return; }
+        auto sqe = get_sqe();
+        if (!sqe) { return; }
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = accept_user_data;
+
+        auto error = 0;
+        while (accepting_) {
+            if (enter(1, nullptr) < 0 && errno != EINTR && errno != EAGAIN &&
+                errno != EBUSY) {
+                return;
+            }
+            reap([&](const io_uring_cqe &cqe) {
+                if (cqe.user_data == accept_user_data) {
+                    reap_accept(cqe, socks, error);
+                }
+            });
+        }
+#else
+        (void)socks;
+#endif
+    }
+
+private:
+#ifdef CPPHTTPLIB_IO_URING
+    static const uint64_t accept_user_data = 2;
+
+    void reap_accept(const io_uring_cqe &cqe, std::vector<socket_t> &socks,
+                     int &error) {
+        if (cqe.res >= 0) {
+            socks.push_back(cqe.res);
+        } else if (cqe.res != -ECANCELED) {
+            error = -cqe.res;
+        }
+        // Stopped delivering, for instance on an error
+        if (!(cqe.flags & IORING_CQE_F_MORE)) { accepting_ = false; }
+    }
+
+    bool map(const io_uring_params &params) {
+        sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        auto single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap) { sq_size_ = cq_size_ = (std::max)(sq_size_, cq_size_); }
+
+        auto sq = mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        if (sq == MAP_FAILED) { return false; }
+        sq_ptr_ = static_cast<char *>(sq);
+        if (single_mmap) {
+            cq_ptr_ = sq_ptr_;
+        } else {
+            auto cq = mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+            if (cq == MAP_FAILED) { return false; }
+            cq_ptr_ = static_cast<char *>(cq);
+        }
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        auto sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) { return false; }
+        sqes_ = static_cast<io_uring_sqe *>(sqes);
+
+        sq_head_ = reinterpret_cast<unsigned *>(sq_ptr_ + params.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned *>(sq_ptr_ + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned *>(sq_ptr_ + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned *>(sq_ptr_ + params.sq_off.array);
+        sq_entries_ = params.sq_entries;
+        cq_head_ = reinterpret_cast<unsigned *>(cq_ptr_ + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned *>(cq_ptr_ + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned *>(cq_ptr_ + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe *>(cq_ptr_ + params.cq_off.cqes);
+        sqe_tail_ = *sq_tail_;
+        return true;
+    }
+
+    void unmap() {
+        if (sqes_) { munmap(sqes_, sqes_size_); }
+        if (cq_ptr_ && cq_ptr_ != sq_ptr_) { munmap(cq_ptr_, cq_size_); }
+        if (sq_ptr_) { munmap(sq_ptr_, sq_size_); }
+    }
+
+    bool probe() {
+        const unsigned max_ops = 256;
+        std::vector<char> buf(sizeof(io_uring_probe) +
+                              max_ops * sizeof(io_uring_probe_op));
+        auto p = reinterpret_cast<io_uring_probe *>(buf.data());
+        if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PROBE, p,
+                    max_ops) < 0) {
+            return false;
+        }
+        for (auto op : {IORING_OP_RECV, IORING_OP_SEND, IORING_OP_LINK_TIMEOUT,
+                        IORING_OP_SHUTDOWN, IORING_OP_CLOSE, IORING_OP_ACCEPT,
+                        IORING_OP_ASYNC_CANCEL}) {
+            if (op > p->last_op || !(p->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    io_uring_sqe *get_sqe() {
+        auto head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if (sqe_tail_ - head >= sq_entries_) { return nullptr; }
+        auto index = sqe_tail_ & sq_mask_;
+        auto sqe = &sqes_[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sq_array_[index] = index;
+        sqe_tail_++;
+        return sqe;
+    }
+
+    // Submit the prepared entries and wait for wait_nr completions or the
+    // timeout.
+    int enter(unsigned wait_nr, const __kernel_timespec *ts) {
+        __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+        auto to_submit = sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = reinterpret_cast<uint64_t>(ts);
+        count_syscall();
+        return static_cast<int>(
+            syscall(__NR_io_uring_enter, fd_, to_submit, wait_nr,
+                    IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg,
+                    sizeof(arg)));
+    }
+
+    template <typename T> unsigned reap(T callback) {
+        auto head = *cq_head_;
+        auto tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        unsigned count = 0;
+        for (; head != tail; head++, count++) {
+            callback(cqes_[head & cq_mask_]);
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+        return count;
+    }
+
+    // Submit the prepared entries and wait until count of them completed. The
+    // kernel may still write to their buffers until then, so only a broken
+    // ring gives up earlier.
+    template <typename T> bool complete(unsigned count, T callback) {
+        while (count > 0) {
+            if (enter(count, nullptr) < 0 && errno != EINTR && errno != EAGAIN &&
+                errno != EBUSY) {
+                return false;
+            }
+            count -= reap(callback);
+        }
+        return true;
+    }
+
+    ssize_t transfer(uint8_t opcode, socket_t sock, void *ptr, size_t size,
+                     int flags, time_t sec, time_t usec) {
+        auto sqe = get_sqe();
+        auto timeout_sqe = get_sqe();
+        if (!sqe || !timeout_sqe) {
+            errno = EBUSY;
+            return -1;
+        }
+
+        __kernel_timespec ts;
+        ts.tv_sec = sec;
+        ts.tv_nsec = usec * 1000;
+        sqe->opcode = opcode;
+        sqe->fd = sock;
+        sqe->addr = reinterpret_cast<uint64_t>(ptr);
+        sqe->len = static_cast<uint32_t>(
+            (std::min)(size, static_cast<size_t>(INT_MAX)));
+        sqe->msg_flags = static_cast<uint32_t>(flags);
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = 1;
+        timeout_sqe->opcode = IORING_OP_LINK_TIMEOUT;
+        timeout_sqe->fd = -1;
+        timeout_sqe->addr = reinterpret_cast<uint64_t>(&ts);
+        timeout_sqe->len = 1;
+
+        auto res = 0;
+        if (!complete(2, [&](const io_uring_cqe &cqe) {
+            if (cqe.user_data == 1) { res = cqe.res; }
+        })) {
+            return -1;
+        }
+        if (res < 0) {
+            // Canceled by the timeout
+            errno = res == -ECANCELED ? EAGAIN : -res;
+            return -1;
+        }
+        return res;
+    }
+
+    char *sq_ptr_ = nullptr;
+    char *cq_ptr_ = nullptr;
+    size_t sq_size_ = 0;
+    size_t cq_size_ = 0;
+    io_uring_sqe *sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+    unsigned *sq_head_ = nullptr;
+    unsigned *sq_tail_ = nullptr;
+    unsigned *sq_array_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+    unsigned sqe_tail_ = 0;
+    unsigned *cq_head_ = nullptr;
+    unsigned *cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe *cqes_ = nullptr;
+    bool accepting_ = false;
+#endif
+
+    int fd_ = -1;
+};
+
 class SocketStream : public Stream {
 public:
     SocketStream(socket_t sock, time_t read_timeout_sec, time_t read_timeout_usec,
-                 time_t write_timeout_sec, time_t write_timeout_usec);
+                 time_t write_timeout_sec, time_t write_timeout_usec,
+                 IoUring *ring = nullptr);
     ~SocketStream() override;
 
     bool is_readable() const override;
@@ -2531,6 +3235,7 @@ public:
     ssize_t write(const char *ptr, size_t size) override;
     void get_remote_ip_and_port(std::string &ip, int &port) const override;
     void get_local_ip_and_port(std::string &ip, int &port) const override;
+    void get_peer_credentials(int &uid, int &gid) const override;
     socket_t socket() const override;
 
 private:
@@ -2539,6 +3244,8 @@ private:
     time_t read_timeout_usec_;
     time_t write_timeout_sec_;
     time_t write_timeout_usec_;
+    // Sends and receives through the ring when set
+    IoUring *ring_;
 
     std::vector<char> read_buff_;
     size_t read_buff_off_ = 0;
@@ -2573,10 +3280,13 @@ private:
 };
 #endif
 
-inline bool keep_alive(socket_t sock, time_t keep_alive_timeout_sec) {
+// Wait for the next request of a connection. Gives up early once the server
+// stops.
+inline bool keep_alive(const std::atomic<socket_t> &svr_sock, socket_t sock,
+                       time_t keep_alive_timeout_sec) {
     using namespace std::chrono;
     auto start = steady_clock::now();
-    while (true) {
+    while (svr_sock != INVALID_SOCKET) {
         auto val = select_read(sock, 0, 10000);
         if (val < 0) {
             return false;
@@ -2590,6 +3300,7 @@ inline bool keep_alive(socket_t sock, time_t keep_alive_timeout_sec) {
             return true;
         }
     }
+    return false;
 }
 
 template <typename T>
@@ -2601,7 +3312,7 @@ process_server_socket_core(const std::atomic<socket_t> &svr_sock, socket_t sock,
     auto ret = false;
     auto count = keep_alive_max_count;
     while (svr_sock != INVALID_SOCKET && count > 0 &&
-           keep_alive(sock, keep_alive_timeout_sec)) {
+           keep_alive(svr_sock, sock, keep_alive_timeout_sec)) {
         auto close_connection = count == 1;
         auto connection_closed = false;
         ret = callback(close_connection, connection_closed);
@@ -2638,6 +3349,7 @@ inline bool process_client_socket(socket_t sock, time_t read_timeout_sec,
 }
 
 inline int shutdown_socket(socket_t sock) {
+    count_syscall();
 #ifdef _WIN32
     return shutdown(sock, SD_BOTH);
 #else
@@ -2645,6 +3357,227 @@ inline int shutdown_socket(socket_t sock) {
 #endif
 }
 
+// Idle keep-alive connections, watched by one thread. A connection is parked
+// between requests and handed back to the task queue as soon as its next
+// request arrives, so that waiting for it does not take up a worker thread.
+// Connections idle for longer than the keep-alive timeout are closed.
+class KeepAliveParking {
+public:
+    using Resume = std::function<void(socket_t sock, size_t remaining_count)>;
+
+    KeepAliveParking(time_t timeout_sec, size_t max_parked, Resume resume,
+                     std::atomic<uint64_t> *syscalls = nullptr)
+        : timeout_(std::chrono::seconds(timeout_sec)), max_parked_(max_parked),
+        resume_(std::move(resume)), syscalls_(syscalls) {
+#ifdef CPPHTTPLIB_KEEPALIVE_PARKING
+        epfd_ = epoll_create1(EPOLL_CLOEXEC);
+        wakefd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (epfd_ < 0 || wakefd_ < 0) { return; }
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = wakefd_;
+        if (epoll_ctl(epfd_, EPOLL_CTL_ADD, wakefd_, &ev) < 0) { return; }
+        thread_ = std::thread([this]() { run(); });
+#endif
+    }
+
+    KeepAliveParking(const KeepAliveParking &) = delete;
+
+    ~KeepAliveParking() {
+        stop();
+#ifdef CPPHTTPLIB_KEEPALIVE_PARKING
+        if (epfd_ >= 0) { close(epfd_); }
+        if (wakefd_ >= 0) { close(wakefd_); }
+#endif
+    }
+
+    // Take over an idle connection until its next request arrives or it times
+    // out. Returns false when the connection is not taken, in which case the
+    // caller keeps it. A connection that was never answered is resumed rather
+    // than closed on stop().
+    bool park(socket_t sock, size_t remaining_count, bool answered = true) {
+#ifdef CPPHTTPLIB_KEEPALIVE_PARKING
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (!thread_.joinable() || stopped_ || parked_.size() >= max_parked_) {
+            return false;
+        }
+
+        // One-shot, so that a connection is resumed once however much arrives
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        ev.data.fd = sock;
+        count_syscall();
+        if (epoll_ctl(epfd_, EPOLL_CTL_ADD, sock, &ev) < 0) { return false; }
+
+        auto seq = ++next_seq_;
+        parked_[sock] = Parked{remaining_count, seq, answered};
+        auto wake = deadlines_.empty();
+        deadlines_.push_back(
+            Deadline{std::chrono::steady_clock::now() + timeout_, sock, seq});
+        if (wake) { notify(); }
+        return true;
+#else
+        (void)sock;
+        (void)remaining_count;
+        (void)answered;
+        return false;
+#endif
+    }
+
+    // Close the parked connections, resume the ones never answered, and stop
+    // taking new ones.
+    void stop() {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            if (stopped_) { return; }
+            stopped_ = true;
+#ifdef CPPHTTPLIB_KEEPALIVE_PARKING
+            notify();
+#endif
+        }
+        if (thread_.joinable()) { thread_.join(); }
+    }
+
+    size_t parked_count() const {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return parked_.size();
+    }
+
+private:
+    struct Parked {
+        size_t remaining_count;
+        uint64_t seq;
+        bool answered;
+    };
+
+    // The timeout is the same for every connection, so deadlines are in the
+    // order connections were parked. Entries of connections that were resumed
+    // meanwhile stay in the queue and are recognized by their sequence number.
+    struct Deadline {
+        std::chrono::steady_clock::time_point time;
+        socket_t sock;
+        uint64_t seq;
+    };
+
+#ifdef CPPHTTPLIB_KEEPALIVE_PARKING
+    void notify() {
+        count_syscall();
+        uint64_t one = 1;
+        auto ret = ::write(wakefd_, &one, sizeof(one));
+        (void)ret;
+    }
+
+    // Called with mutex_ held.
+    void unpark(socket_t sock) {
+        count_syscall();
+        epoll_ctl(epfd_, EPOLL_CTL_DEL, sock, nullptr);
+        parked_.erase(sock);
+    }
+
+    void run() {
+        scoped_syscall_counter counter(syscalls_);
+        const int max_events = 64;
+        epoll_event events[max_events];
+        std::vector<std::pair<socket_t, size_t>> ready;
+        std::vector<socket_t> expired;
+
+        for (;;) {
+            int timeout_ms = -1;
+            {
+                std::lock_guard<std::mutex> guard(mutex_);
+                if (stopped_) { break; }
+                if (!deadlines_.empty()) {
+                    using namespace std::chrono;
+                    auto left = duration_cast<milliseconds>(deadlines_.front().time -
+                                                            steady_clock::now());
+                    auto ms = left.count() + 1;
+                    timeout_ms = ms > 0 ? static_cast<int>(ms) : 0;
+                }
+            }
+
+            count_syscall();
+            auto n = epoll_wait(epfd_, events, max_events, timeout_ms);
+            if (n < 0 && errno != EINTR) { break; }
+
+            {
+                std::lock_guard<std::mutex> guard(mutex_);
+                for (int i = 0; i < n; i++) {
+                    auto fd = events[i].data.fd;
+                    if (fd == wakefd_) {
+                        count_syscall();
+                        uint64_t count;
+                        auto ret = ::read(wakefd_, &count, sizeof(count));
+                        (void)ret;
+                        continue;
+                    }
+                    auto it = parked_.find(fd);
+                    if (it == parked_.end()) { continue; }
+                    ready.emplace_back(fd, it->second.remaining_count);
+                    unpark(fd);
+                }
+
+                auto now = std::chrono::steady_clock::now();
+                while (!deadlines_.empty() && deadlines_.front().time <= now) {
+                    auto deadline = deadlines_.front();
+                    deadlines_.pop_front();
+                    auto it = parked_.find(deadline.sock);
+                    if (it == parked_.end() || it->second.seq != deadline.seq) {
+                        continue;
+                    }
+                    expired.push_back(deadline.sock);
+                    unpark(deadline.sock);
+                }
+            }
+
+            // Outside the lock: resuming may run the connection right away
+            for (const auto &entry : ready) {
+                resume_(entry.first, entry.second);
+            }
+            ready.clear();
+            for (auto sock : expired) {
+                shutdown_socket(sock);
+                close_socket(sock);
+            }
+            expired.clear();
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            for (const auto &entry : parked_) {
+                epoll_ctl(epfd_, EPOLL_CTL_DEL, entry.first, nullptr);
+                if (entry.second.answered) {
+                    shutdown_socket(entry.first);
+                    close_socket(entry.first);
+                } else {
+                    ready.emplace_back(entry.first, entry.second.remaining_count);
+                }
+            }
+            parked_.clear();
+            deadlines_.clear();
+        }
+        // Its first request is still owed an answer
+        for (const auto &entry : ready) {
+            resume_(entry.first, entry.second);
+        }
+    }
+
+    int epfd_ = -1;
+    int wakefd_ = -1;
+#endif
+
+    std::chrono::steady_clock::duration timeout_;
+    size_t max_parked_;
+    Resume resume_;
+    std::atomic<uint64_t> *syscalls_;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<socket_t, Parked> parked_;
+    std::deque<Deadline> deadlines_;
+    uint64_t next_seq_ = 0;
+    bool stopped_ = false;
+    std::thread thread_;
+};
+
 template <typename BindOrConnect>
 socket_t create_socket(const std::string &host, const std::string &ip, int port,
                        int address_family, int socket_flags, bool tcp_nodelay,
@@ -2957,6 +3890,7 @@ inline bool get_ip_and_port(const struct sockaddr_storage &addr,
 inline void get_local_ip_and_port(socket_t sock, std::string &ip, int &port) {
     struct sockaddr_storage addr;
     socklen_t addr_len = sizeof(addr);
+    count_syscall();
     if (!getsockname(sock, reinterpret_cast<struct sockaddr *>(&addr),
                      &addr_len)) {
         get_ip_and_port(addr, addr_len, ip, port);
@@ -2967,6 +3901,7 @@ inline void get_remote_ip_and_port(socket_t sock, std::string &ip, int &port) {
     struct sockaddr_storage addr;
     socklen_t addr_len = sizeof(addr);
 
+    count_syscall();
     if (!getpeername(sock, reinterpret_cast<struct sockaddr *>(&addr),
                      &addr_len)) {
 #ifndef _WIN32
@@ -2991,9 +3926,32 @@ inline void get_remote_ip_and_port(socket_t sock, std::string &ip, int &port) {
     }
 }
 
-inline constexpr unsigned int str2tag_core(const char *s, size_t l,
-                                           unsigned int h) {
-    return (l == 0)
+inline void get_peer_credentials(socket_t sock, int &uid, int &gid) {
+#if defined(__linux__)
+    struct ucred ucred;
+    socklen_t len = sizeof(ucred);
+    count_syscall();
+    if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &ucred, &len) == 0) {
+        uid = static_cast<int>(ucred.uid);
+        gid = static_cast<int>(ucred.gid);
+    }
+#elif !defined(_WIN32) && (defined(__APPLE__) || defined(__FreeBSD__))
+    uid_t euid;
+    gid_t egid;
+    if (getpeereid(sock, &euid, &egid) == 0) {
+        uid = static_cast<int>(euid);
+        gid = static_cast<int>(egid);
+    }
+#else
+    (void)sock;
+    (void)uid;
+    (void)gid;
+#endif
+}
+
+inline constexpr unsigned int str2tag_core(const char *s, size_t l,
+                                           unsigned int h) {
+    return (l == 0)
                ? h
                : str2tag_core(
                      s + 1, l - 1,
@@ -3445,9 +4403,10 @@ inline bool parse_header(const char *beg, const char *end, T fn) {
 
     if (p < end) {
         auto key = std::string(beg, key_end);
-        auto val = compare_case_ignore(key, "Location")
-                       ? std::string(p, end)
-                       : decode_url(std::string(p, end), false);
+        auto val = std::string(p, end);
+        if (!compare_case_ignore(key, "Location")) {
+            decode_url_in_place(val, false);
+        }
         fn(std::move(key), std::move(val));
         return true;
     }
@@ -3934,27 +4893,90 @@ inline std::string params_to_query_str(const Params &params) {
     return query;
 }
 
+// Calls fn with each piece of [b, e) between delimiters, trimmed, skipping
+// empty ones, like split() without the std::function.
+template <typename T>
+inline void for_each_piece(const char *b, const char *e, char d, T fn) {
+    while (b < e) {
+        auto piece_end = static_cast<const char *>(memchr(b, d, e - b));
+        if (!piece_end) { piece_end = e; }
+        auto r = trim(b, piece_end, 0, static_cast<size_t>(piece_end - b));
+        if (r.first < r.second) { fn(b + r.first, b + r.second); }
+        b = piece_end + 1;
+    }
+}
+
+// The parameters are collected unsorted, with the pieces of the query they
+// came from, and merged into params in one go. A piece repeated as is adds
+// one parameter.
 inline void parse_query_text(const std::string &s, Params &params) {
-    std::set<std::string> cache;
-    split(s.data(), s.data() + s.size(), '&', [&](const char *b, const char *e) {
-              std::string kv(b, e);
-              if (cache.find(kv) != cache.end()) { return; }
-              cache.insert(kv);
-
-              std::string key;
-              std::string val;
-              split(b, e, '=', [&](const char *b2, const char *e2) {
-                        if (key.empty()) {
-                            key.assign(b2, e2);
-                        } else {
-                            val.assign(b2, e2);
-                        }
-                    });
+    struct Piece {
+        const char *b;
+        size_t len;
+    };
+    std::vector<Piece> pieces;
+    std::vector<Params::value_type> entries;
+
+    for_each_piece(s.data(), s.data() + s.size(), '&',
+                   [&](const char *b, const char *e) {
+                       // The first part before '=' is the key, the last one
+                       // after it the value
+                       const char *key_b = nullptr;
+                       const char *key_e = nullptr;
+                       const char *val_b = nullptr;
+                       const char *val_e = nullptr;
+                       for_each_piece(b, e, '=', [&](const char *b2, const char *e2) {
+                           if (!key_b) {
+                               key_b = b2;
+                               key_e = e2;
+                           } else {
+                               val_b = b2;
+                               val_e = e2;
+                           }
+                       });
+                       if (!key_b) { return; }
+
+                       pieces.push_back(Piece{b, static_cast<size_t>(e - b)});
+                       entries.emplace_back(std::string(key_b, key_e),
+                                            val_b ? std::string(val_b, val_e)
+                                                  : std::string());
+                   });
+
+    if (entries.size() > 1) {
+        std::vector<size_t> order(entries.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            order[i] = i;
+        }
+        auto compare = [&](size_t a, size_t b) {
+            auto &x = pieces[a];
+            auto &y = pieces[b];
+            auto c = memcmp(x.b, y.b, (std::min)(x.len, y.len));
+            if (c) { return c < 0; }
+            if (x.len != y.len) { return x.len < y.len; }
+            return a < b;
+        };
+        std::sort(order.begin(), order.end(), compare);
+        std::vector<bool> repeated(entries.size());
+        for (size_t i = 1; i < order.size(); i++) {
+            auto &x = pieces[order[i - 1]];
+            auto &y = pieces[order[i]];
+            repeated[order[i]] = x.len == y.len && !memcmp(x.b, y.b, x.len);
+        }
+        size_t count = 0;
+        for (size_t i = 0; i < entries.size(); i++) {
+            if (repeated[i]) { continue; }
+            if (count != i) { entries[count] = std::move(entries[i]); }
+            count++;
+        }
+        entries.resize(count);
+    }
 
-              if (!key.empty()) {
-                  params.emplace(decode_url(key, true), decode_url(val, true));
-              }
-          });
+    for (auto &entry : entries) {
+        decode_url_in_place(entry.first, true);
+        decode_url_in_place(entry.second, true);
+    }
+    params.insert(std::make_move_iterator(entries.begin()),
+                  std::make_move_iterator(entries.end()));
 }
 
 inline bool parse_multipart_boundary(const std::string &content_type,
@@ -3972,259 +4994,384 @@ inline bool parse_multipart_boundary(const std::string &content_type,
     return !boundary.empty();
 }
 
-#ifdef CPPHTTPLIB_NO_EXCEPTIONS
+// bytes=<first>-<last>, with either position left out, then more of them
+// after commas and optional whitespace. A position that does not fit in
+// ssize_t is an error, as are more than CPPHTTPLIB_RANGE_MAX_COUNT ranges.
 inline bool parse_range_header(const std::string &s, Ranges &ranges) {
-#else
-inline bool parse_range_header(const std::string &s, Ranges &ranges) try {
-#endif
-    static auto re_first_range = std::regex(R"(bytes=(\d*-\d*(?:,\s*\d*-\d*)*))");
-    std::smatch m;
-    if (std::regex_match(s, m, re_first_range)) {
-        auto pos = static_cast<size_t>(m.position(1));
-        auto len = static_cast<size_t>(m.length(1));
-        bool all_valid_ranges = true;
-        split(&s[pos], &s[pos + len], ',', [&](const char *b, const char *e) {
-                  if (!all_valid_ranges) return;
-                  static auto re_another_range = std::regex(R"(\s*(\d*)-(\d*))");
-                  std::cmatch cm;
-                  if (std::regex_match(b, e, cm, re_another_range)) {
-                      ssize_t first = -1;
-                      if (!cm.str(1).empty()) {
-                          first = static_cast<ssize_t>(std::stoll(cm.str(1)));
-                      }
-
-                      ssize_t last = -1;
-                      if (!cm.str(2).empty()) {
-                          last = static_cast<ssize_t>(std::stoll(cm.str(2)));
-                      }
-
-                      if (first != -1 && last != -1 && first > last) {
-                          all_valid_ranges = false;
-                          return;
-                      }
-                      ranges.emplace_back(std::make_pair(first, last));
-                  }
-              });
-        return all_valid_ranges;
+    static const char prefix[] = "bytes=";
+    const auto prefix_len = sizeof(prefix) - 1;
+    if (s.compare(0, prefix_len, prefix) != 0) { return false; }
+
+    auto p = s.data() + prefix_len;
+    const auto end = s.data() + s.size();
+
+    // -1 when there are no digits
+    auto parse_position = [&](ssize_t &value) {
+        const auto max = (std::numeric_limits<ssize_t>::max)();
+        value = -1;
+        while (p < end && '0' <= *p && *p <= '9') {
+            auto digit = static_cast<ssize_t>(*p++ - '0');
+            if (value == -1) {
+                value = 0;
+            } else if (value > (max - digit) / 10) {
+                return false;
+            }
+            value = value * 10 + digit;
+        }
+        return true;
+    };
+
+    for (;;) {
+        ssize_t first = -1;
+        ssize_t last = -1;
+        if (!parse_position(first) || p == end || *p++ != '-' ||
+            !parse_position(last)) {
+            return false;
+        }
+        if (first != -1 && last != -1 && first > last) { return false; }
+        if (ranges.size() == CPPHTTPLIB_RANGE_MAX_COUNT) { return false; }
+        ranges.emplace_back(first, last);
+
+        if (p == end) { return true; }
+        if (*p++ != ',') { return false; }
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
     }
-    return false;
-#ifdef CPPHTTPLIB_NO_EXCEPTIONS
 }
-#else
-} catch (...) { return false; }
-#endif
 
+// Boyer-Moore-Horspool search for a fixed needle, such as a multipart
+// delimiter. On a mismatch the window moves by the distance from the last
+// occurrence of its final byte in the needle, so for a long boundary most of
+// the bytes of a part body are never looked at.
+class horspool_searcher {
+public:
+    void set_needle(const std::string &needle) {
+        needle_ = needle;
+        skip_.fill(needle_.size());
+        for (size_t i = 0; i + 1 < needle_.size(); i++) {
+            skip_[static_cast<unsigned char>(needle_[i])] = needle_.size() - 1 - i;
+        }
+    }
+
+    const std::string &needle() const { return needle_; }
+
+    // The position of the first match in [p, p + n), or n.
+    size_t find(const char *p, size_t n) const {
+        const auto m = needle_.size();
+        if (m == 0 || n < m) { return n; }
+        const auto last = needle_[m - 1];
+        size_t pos = 0;
+        while (pos <= n - m) {
+            auto c = p[pos + m - 1];
+            if (c == last && !memcmp(p + pos, needle_.data(), m - 1)) {
+                return pos;
+            }
+            pos += skip_[static_cast<unsigned char>(c)];
+        }
+        return n;
+    }
+
+    // The position from which the end of [p, p + n) could be the start of a
+    // match that continues past it, or n.
+    size_t find_partial(const char *p, size_t n) const {
+        const auto m = needle_.size();
+        auto pos = n >= m ? n - m + 1 : 0;
+        for (; pos < n; pos++) {
+            if (p[pos] == needle_[0] && !memcmp(p + pos, needle_.data(), n - pos)) {
+                return pos;
+            }
+        }
+        return n;
+    }
+
+private:
+    std::string needle_;
+    std::array<size_t, 256> skip_{};
+};
+
+// Parses a multipart/form-data body as it arrives. Part bodies are passed to
+// the content receiver as pointers into the buffer given to parse(), so they
+// are not copied. Only what straddles two buffers is kept: the start of a
+// header line, or the bytes at the end of a body that may be the start of
+// the next delimiter. Memory use is bounded whatever the size of the parts.
 class MultipartFormDataParser {
 public:
     MultipartFormDataParser() = default;
 
     void set_boundary(std::string &&boundary) {
         boundary_ = boundary;
-        dash_boundary_crlf_ = dash_ + boundary_ + crlf_;
-        crlf_dash_boundary_ = crlf_ + dash_ + boundary_;
+        dash_boundary_crlf_.set_needle(dash_ + boundary_ + crlf_);
+        crlf_dash_boundary_.set_needle(crlf_ + dash_ + boundary_);
     }
 
     bool is_valid() const { return is_valid_; }
 
     bool parse(const char *buf, size_t n, const ContentReceiver &content_callback,
                const MultipartContentHeader &header_callback) {
-
-        // TODO: support 'filename*'
-        static const std::regex re_content_disposition(
-            R"~(^Content-Disposition:\s*form-data;\s*name="(.*?)"(?:;\s*filename="(.*?)")?(?:;\s*filename\*=\S+)?\s*$)~",
-            std::regex_constants::icase);
-
-        buf_append(buf, n);
-
-        while (buf_size() > 0) {
-            switch (state_) {
-            case 0: { // Initial boundary
-                buf_erase(buf_find(dash_boundary_crlf_));
-                if (dash_boundary_crlf_.size() > buf_size()) { return true; }
-                if (!buf_start_with(dash_boundary_crlf_)) { return false; }
-                buf_erase(dash_boundary_crlf_.size());
-                state_ = 1;
-                break;
+        // Complete what was kept from the previous buffer, a piece of this one
+        // at a time, until parsing moves past it
+        while (!carry_.empty() && n > 0) {
+            auto carried = carry_.size();
+            auto take = (std::min)(n, carry_piece_size());
+            carry_.append(buf, take);
+            size_t consumed = 0;
+            if (!process(carry_.data(), carry_.size(), consumed, content_callback,
+                         header_callback)) {
+                return false;
             }
-            case 1: { // New entry
-                clear_file_info();
-                state_ = 2;
-                break;
+            if (consumed >= carried) {
+                buf += consumed - carried;
+                n -= consumed - carried;
+                carry_.clear();
+            } else {
+                carry_.erase(0, consumed);
+                buf += take;
+                n -= take;
             }
-            case 2: { // Headers
-                auto pos = buf_find(crlf_);
-                if (pos > CPPHTTPLIB_HEADER_MAX_LENGTH) { return false; }
-                while (pos < buf_size()) {
-                    // Empty line
-                    if (pos == 0) {
-                        if (!header_callback(file_)) {
-                            is_valid_ = false;
-                            return false;
-                        }
-                        buf_erase(crlf_.size());
-                        state_ = 3;
-                        break;
-                    }
+        }
+        if (n == 0) { return true; }
 
-                    static const std::string header_name = "content-type:";
-                    const auto header = buf_head(pos);
-                    if (start_with_case_ignore(header, header_name)) {
-                        file_.content_type = trim_copy(header.substr(header_name.size()));
-                    } else {
-                        std::smatch m;
-                        if (std::regex_match(header, m, re_content_disposition)) {
-                            file_.name = m[1];
-                            file_.filename = m[2];
-                        } else {
-                            is_valid_ = false;
-                            return false;
-                        }
-                    }
-                    buf_erase(pos + crlf_.size());
-                    pos = buf_find(crlf_);
-                }
-                if (state_ != 3) { return true; }
+        size_t consumed = 0;
+        if (!process(buf, n, consumed, content_callback, header_callback)) {
+            return false;
+        }
+        carry_.assign(buf + consumed, n - consumed);
+        return true;
+    }
+
+private:
+    enum class State { InitialBoundary, NewEntry, Headers, Body, Boundary, Done };
+
+    // Parse as far as possible, setting how much of [p, p + n) is done with.
+    // The rest is kept for the next buffer.
+    bool process(const char *p, size_t n, size_t &consumed,
+                 const ContentReceiver &content_callback,
+                 const MultipartContentHeader &header_callback) {
+        size_t pos = 0;
+        auto ret = true;
+        while (pos < n && ret) {
+            if (!process_state(p + pos, n - pos, pos, content_callback,
+                               header_callback, ret)) {
                 break;
             }
-            case 3: { // Body
-                if (crlf_dash_boundary_.size() > buf_size()) { return true; }
-                auto pos = buf_find(crlf_dash_boundary_);
-                if (pos < buf_size()) {
-                    if (!content_callback(buf_data(), pos)) {
-                        is_valid_ = false;
-                        return false;
-                    }
-                    buf_erase(pos + crlf_dash_boundary_.size());
-                    state_ = 4;
-                } else {
-                    auto len = buf_size() - crlf_dash_boundary_.size();
-                    if (len > 0) {
-                        if (!content_callback(buf_data(), len)) {
-                            is_valid_ = false;
-                            return false;
-                        }
-                        buf_erase(len);
-                    }
-                    return true;
-                }
-                break;
+        }
+        consumed = pos;
+        if (!ret) { is_valid_ = false; }
+        return ret;
+    }
+
+    // Run the current state on [p, p + n), advancing pos by what it took.
+    // Returns false when it needs more data.
+    bool process_state(const char *p, size_t n, size_t &pos,
+                       const ContentReceiver &content_callback,
+                       const MultipartContentHeader &header_callback,
+                       bool &ret) {
+        switch (state_) {
+        case State::InitialBoundary: {
+            // Skip the preamble
+            auto found = dash_boundary_crlf_.find(p, n);
+            if (found == n) {
+                pos += dash_boundary_crlf_.find_partial(p, n);
+                return false;
             }
-            case 4: { // Boundary
-                if (crlf_.size() > buf_size()) { return true; }
-                if (buf_start_with(crlf_)) {
-                    buf_erase(crlf_.size());
-                    state_ = 1;
-                } else {
-                    if (dash_crlf_.size() > buf_size()) { return true; }
-                    if (buf_start_with(dash_crlf_)) {
-                        buf_erase(dash_crlf_.size());
-                        is_valid_ = true;
-                        buf_erase(buf_size()); // Remove epilogue
-                    } else {
-                        return true;
-                    }
+            pos += found + dash_boundary_crlf_.needle().size();
+            state_ = State::NewEntry;
+            return true;
+        }
+        case State::NewEntry: {
+            clear_file_info();
+            state_ = State::Headers;
+            return true;
+        }
+        case State::Headers: {
+            auto eol = find_crlf(p, n);
+            if (eol == n) {
+                ret = n <= CPPHTTPLIB_HEADER_MAX_LENGTH;
+                return false;
+            }
+            if (eol > CPPHTTPLIB_HEADER_MAX_LENGTH) {
+                ret = false;
+                return false;
+            }
+            // Empty line
+            if (eol == 0) {
+                if (!header_callback(file_)) {
+                    ret = false;
+                    return false;
                 }
-                break;
+                state_ = State::Body;
+            } else if (!parse_header(p, p + eol)) {
+                ret = false;
+                return false;
             }
+            pos += eol + crlf_.size();
+            return true;
+        }
+        case State::Body: {
+            auto found = crlf_dash_boundary_.find(p, n);
+            auto len = found < n ? found : crlf_dash_boundary_.find_partial(p, n);
+            if (len > 0 && !content_callback(p, len)) {
+                ret = false;
+                return false;
+            }
+            if (found == n) {
+                pos += len;
+                return false;
             }
+            pos += found + crlf_dash_boundary_.needle().size();
+            state_ = State::Boundary;
+            return true;
         }
-
-        return true;
+        case State::Boundary: {
+            if (n < crlf_.size()) { return false; }
+            if (!memcmp(p, crlf_.data(), crlf_.size())) {
+                pos += crlf_.size();
+                state_ = State::NewEntry;
+                return true;
+            }
+            if (n < dash_crlf_.size()) { return false; }
+            if (memcmp(p, dash_crlf_.data(), dash_crlf_.size())) {
+                ret = false;
+                return false;
+            }
+            pos += dash_crlf_.size();
+            is_valid_ = true;
+            state_ = State::Done;
+            return true;
+        }
+        case State::Done: {
+            // Epilogue
+            pos += n;
+            return false;
+        }
+        }
+        return false;
     }
 
-private:
-    void clear_file_info() {
-        file_.name.clear();
-        file_.filename.clear();
-        file_.content_type.clear();
+    // Enough for any header line, which is all that waits for more data.
+    size_t carry_piece_size() const {
+        return CPPHTTPLIB_HEADER_MAX_LENGTH + crlf_dash_boundary_.needle().size();
     }
 
-    bool start_with_case_ignore(const std::string &a,
-                                const std::string &b) const {
-        if (a.size() < b.size()) { return false; }
-        for (size_t i = 0; i < b.size(); i++) {
-            if (::tolower(a[i]) != ::tolower(b[i])) { return false; }
+    static size_t find_crlf(const char *p, size_t n) {
+        auto q = p;
+        const auto end = p + n;
+        while ((q = static_cast<const char *>(memchr(q, '\r', end - q)))) {
+            if (q + 1 == end) { break; }
+            if (q[1] == '\n') { return q - p; }
+            q++;
         }
-        return true;
+        return n;
     }
 
-    const std::string dash_ = "--";
-    const std::string crlf_ = "\r\n";
-    const std::string dash_crlf_ = "--\r\n";
-    std::string boundary_;
-    std::string dash_boundary_crlf_;
-    std::string crlf_dash_boundary_;
-
-    size_t state_ = 0;
-    bool is_valid_ = false;
-    MultipartFormData file_;
-
-    // Buffer
-    bool start_with(const std::string &a, size_t spos, size_t epos,
-                    const std::string &b) const {
-        if (epos - spos < b.size()) { return false; }
-        for (size_t i = 0; i < b.size(); i++) {
-            if (a[i + spos] != b[i]) { return false; }
+    // Content-Type or Content-Disposition, which must be form-data with a
+    // name and may have a filename.
+    bool parse_header(const char *b, const char *e) {
+        if (consume_case_ignore(b, e, "content-type:")) {
+            file_.content_type = trim_copy(std::string(b, e));
+            return true;
         }
-        return true;
+        if (!consume_case_ignore(b, e, "content-disposition:")) { return false; }
+        skip_spaces(b, e);
+        if (!consume_case_ignore(b, e, "form-data;")) { return false; }
+        skip_spaces(b, e);
+        if (!consume_case_ignore(b, e, "name=") || b == e || *b != '"') {
+            return false;
+        }
+        // A quoted value ends at the first quote that the rest of the line
+        // can follow
+        b++;
+        for (auto q = b; (q = find_quote(q, e)); q++) {
+            if (parse_filename(q + 1, e)) {
+                file_.name.assign(b, q);
+                return true;
+            }
+        }
+        return false;
     }
 
-    size_t buf_size() const { return buf_epos_ - buf_spos_; }
-
-    const char *buf_data() const { return &buf_[buf_spos_]; }
-
-    std::string buf_head(size_t l) const { return buf_.substr(buf_spos_, l); }
-
-    bool buf_start_with(const std::string &s) const {
-        return start_with(buf_, buf_spos_, buf_epos_, s);
+    bool parse_filename(const char *b, const char *e) {
+        auto p = b;
+        if (consume_param(p, e, "filename=") && p < e && *p == '"') {
+            p++;
+            for (auto q = p; (q = find_quote(q, e)); q++) {
+                if (parse_filename_ext(q + 1, e)) {
+                    file_.filename.assign(p, q);
+                    return true;
+                }
+            }
+        }
+        file_.filename.clear();
+        return parse_filename_ext(b, e);
     }
 
-    size_t buf_find(const std::string &s) const {
-        auto c = s.front();
-
-        size_t off = buf_spos_;
-        while (off < buf_epos_) {
-            auto pos = off;
-            while (true) {
-                if (pos == buf_epos_) { return buf_size(); }
-                if (buf_[pos] == c) { break; }
-                pos++;
+    // TODO: support 'filename*'
+    static bool parse_filename_ext(const char *b, const char *e) {
+        auto p = b;
+        if (consume_param(p, e, "filename*=") && p < e && !is_space_or_tab(*p)) {
+            while (p < e && !is_space_or_tab(*p)) {
+                p++;
             }
+            skip_spaces(p, e);
+            if (p == e) { return true; }
+        }
+        skip_spaces(b, e);
+        return b == e;
+    }
 
-            auto remaining_size = buf_epos_ - pos;
-            if (s.size() > remaining_size) { return buf_size(); }
+    static const char *find_quote(const char *b, const char *e) {
+        return static_cast<const char *>(memchr(b, '"', e - b));
+    }
 
-            if (start_with(buf_, pos, buf_epos_, s)) { return pos - buf_spos_; }
+    static bool is_space_or_tab(char c) { return c == ' ' || c == '\t'; }
 
-            off = pos + 1;
+    static void skip_spaces(const char *&b, const char *e) {
+        while (b < e && is_space_or_tab(*b)) {
+            b++;
         }
-
-        return buf_size();
     }
 
-    void buf_append(const char *data, size_t n) {
-        auto remaining_size = buf_size();
-        if (remaining_size > 0 && buf_spos_ > 0) {
-            for (size_t i = 0; i < remaining_size; i++) {
-                buf_[i] = buf_[buf_spos_ + i];
+    // A literal, given in lower case, compared ignoring case.
+    static bool consume_case_ignore(const char *&b, const char *e,
+                                    const char *literal) {
+        auto p = b;
+        for (; *literal; literal++, p++) {
+            if (p == e || ::tolower(static_cast<unsigned char>(*p)) != *literal) {
+                return false;
             }
         }
-        buf_spos_ = 0;
-        buf_epos_ = remaining_size;
+        b = p;
+        return true;
+    }
 
-        if (remaining_size + n > buf_.size()) { buf_.resize(remaining_size + n); }
+    // ; then the name of a parameter
+    static bool consume_param(const char *&b, const char *e, const char *name) {
+        if (b == e || *b != ';') { return false; }
+        b++;
+        skip_spaces(b, e);
+        return consume_case_ignore(b, e, name);
+    }
 
-        for (size_t i = 0; i < n; i++) {
-            buf_[buf_epos_ + i] = data[i];
-        }
-        buf_epos_ += n;
+    void clear_file_info() {
+        file_.name.clear();
+        file_.filename.clear();
+        file_.content_type.clear();
     }
 
-    void buf_erase(size_t size) { buf_spos_ += size; }
+    const std::string dash_ = "--";
+    const std::string crlf_ = "\r\n";
+    const std::string dash_crlf_ = "--\r\n";
+    std::string boundary_;
+    horspool_searcher dash_boundary_crlf_;
+    horspool_searcher crlf_dash_boundary_;
+
+    State state_ = State::InitialBoundary;
+    bool is_valid_ = false;
+    MultipartFormData file_;
 
-    std::string buf_;
-    size_t buf_spos_ = 0;
-    size_t buf_epos_ = 0;
+    // The end of the previous buffer, not parsed yet
+    std::string carry_;
 };
 
 inline std::string to_lower(const char *beg, const char *end) {
@@ -4316,24 +5463,48 @@ serialize_multipart_formdata(const MultipartFormDataItems &items,
     return body;
 }
 
-inline std::pair<size_t, size_t>
-get_range_offset_and_length(const Request &req, size_t content_length,
-                            size_t index) {
-    auto r = req.ranges[index];
-
-    if (r.first == -1 && r.second == -1) {
-        return std::make_pair(0, content_length);
-    }
-
-    auto slen = static_cast<ssize_t>(content_length);
-
-    if (r.first == -1) {
-        r.first = (std::max)(static_cast<ssize_t>(0), slen - r.second);
-        r.second = slen - 1;
+// Resolve ranges against the length of the content: a suffix range or an
+// open-ended one becomes first-last, one starting past the end is dropped and
+// one ending past it is cut. The rest are sorted and the ones that overlap or
+// touch merged, which RFC 9110 allows in any order, so that repeated or
+// overlapping ranges can not multiply the response. Returns false when no
+// range is left, in which case the request gets 416.
+inline bool resolve_ranges(Ranges &ranges, size_t content_length) {
+    auto len = static_cast<ssize_t>(content_length);
+    size_t count = 0;
+    for (auto r : ranges) {
+        if (r.first == -1 && r.second == -1) {
+            r = Range(0, len - 1);
+        } else if (r.first == -1) {
+            if (r.second == 0) { continue; }
+            r = Range((std::max)(static_cast<ssize_t>(0), len - r.second), len - 1);
+        } else if (r.second == -1 || r.second >= len) {
+            r.second = len - 1;
+        }
+        if (r.first >= len) { continue; }
+        ranges[count++] = r;
+    }
+    ranges.resize(count);
+
+    if (!std::is_sorted(ranges.begin(), ranges.end())) {
+        std::sort(ranges.begin(), ranges.end());
+    }
+    count = 0;
+    for (const auto &r : ranges) {
+        if (count > 0 && r.first <= ranges[count - 1].second + 1) {
+            ranges[count - 1].second = (std::max)(ranges[count - 1].second, r.second);
+        } else {
+            ranges[count++] = r;
+        }
     }
+    ranges.resize(count);
+    return !ranges.empty();
+}
 
-    if (r.second == -1) { r.second = slen - 1; }
-    return std::make_pair(r.first, static_cast<size_t>(r.second - r.first) + 1);
+// The offset and length of a resolved range.
+inline std::pair<size_t, size_t> get_range_offset_and_length(const Range &r) {
+    return std::make_pair(static_cast<size_t>(r.first),
+                          static_cast<size_t>(r.second - r.first) + 1);
 }
 
 inline std::string make_content_range_header_field(size_t offset, size_t length,
@@ -4347,102 +5518,88 @@ inline std::string make_content_range_header_field(size_t offset, size_t length,
     return field;
 }
 
-template <typename SToken, typename CToken, typename Content>
-bool process_multipart_ranges_data(const Request &req, Response &res,
-                                   const std::string &boundary,
-                                   const std::string &content_type,
-                                   SToken stoken, CToken ctoken,
-                                   Content content) {
-    for (size_t i = 0; i < req.ranges.size(); i++) {
-        ctoken("--");
-        stoken(boundary);
-        ctoken("\r\n");
-        if (!content_type.empty()) {
-            ctoken("Content-Type: ");
-            stoken(content_type);
-            ctoken("\r\n");
-        }
-
-        auto offsets = get_range_offset_and_length(req, res.body.size(), i);
-        auto offset = offsets.first;
-        auto length = offsets.second;
-
-        ctoken("Content-Range: ");
-        stoken(make_content_range_header_field(offset, length, res.body.size()));
-        ctoken("\r\n");
-        ctoken("\r\n");
-        if (!content(offset, length)) { return false; }
-        ctoken("\r\n");
+inline size_t count_digits(size_t n) {
+    size_t count = 1;
+    while (n >= 10) {
+        n /= 10;
+        count++;
     }
-
-    ctoken("--");
-    stoken(boundary);
-    ctoken("--\r\n");
-
-    return true;
+    return count;
 }
 
-inline bool make_multipart_ranges_data(const Request &req, Response &res,
-                                       const std::string &boundary,
-                                       const std::string &content_type,
-                                       std::string &data) {
-    return process_multipart_ranges_data(
-        req, res, boundary, content_type,
-        [&](const std::string &token) { data += token; },
-        [&](const std::string &token) { data += token; },
-        [&](size_t offset, size_t length) {
-            if (offset < res.body.size()) {
-                data += res.body.substr(offset, length);
-                return true;
-            }
-            return false;
-        });
-}
+// The part header ahead of a range of a multipart/byteranges body, which
+// starts with the line break ending the previous part. Kept in step with
+// get_multipart_ranges_data_length().
+inline void make_multipart_range_header(std::string &header, size_t index,
+                                        const std::string &boundary,
+                                        const std::string &content_type,
+                                        size_t offset, size_t length,
+                                        size_t content_length) {
+    header.clear();
+    if (index > 0) { header += "\r\n"; }
+    header += "--";
+    header += boundary;
+    header += "\r\n";
+    if (!content_type.empty()) {
+        header += "Content-Type: ";
+        header += content_type;
+        header += "\r\n";
+    }
+    header += "Content-Range: ";
+    header += make_content_range_header_field(offset, length, content_length);
+    header += "\r\n\r\n";
+}
+
+// Computed rather than by formatting the body, which may be a large file.
+inline size_t get_multipart_ranges_data_length(const Ranges &ranges,
+                                               size_t content_length,
+                                               const std::string &boundary,
+                                               const std::string &content_type) {
+    const auto content_type_line =
+        content_type.empty() ? 0 : sizeof("Content-Type: \r\n") - 1 +
+                                       content_type.size();
+    const auto fixed = sizeof("--\r\nContent-Range: bytes -/\r\n\r\n") - 1 +
+                       boundary.size() + content_type_line;
 
-inline size_t
-get_multipart_ranges_data_length(const Request &req, Response &res,
-                                 const std::string &boundary,
-                                 const std::string &content_type) {
     size_t data_length = 0;
-
-    process_multipart_ranges_data(
-        req, res, boundary, content_type,
-        [&](const std::string &token) { data_length += token.size(); },
-        [&](const std::string &token) { data_length += token.size(); },
-        [&](size_t /*offset*/, size_t length) {
-            data_length += length;
-            return true;
-        });
-
-    return data_length;
+    for (size_t i = 0; i < ranges.size(); i++) {
+        auto offsets = get_range_offset_and_length(ranges[i]);
+        data_length += (i > 0 ? 2 : 0) + fixed + count_digits(offsets.first) +
+                       count_digits(offsets.first + offsets.second - 1) +
+                       count_digits(content_length) + offsets.second;
+    }
+    return data_length + sizeof("\r\n----\r\n") - 1 + boundary.size();
 }
 
+// Write resolved ranges of the content, as is for one range and as a
+// multipart/byteranges body for more, reading each range from the provider
+// as it goes. A part header goes out in one write.
 template <typename T>
-inline bool write_multipart_ranges_data(Stream &strm, const Request &req,
-                                        Response &res,
-                                        const std::string &boundary,
-                                        const std::string &content_type,
-                                        const T &is_shutting_down) {
-    return process_multipart_ranges_data(
-        req, res, boundary, content_type,
-        [&](const std::string &token) { strm.write(token); },
-        [&](const std::string &token) { strm.write(token); },
-        [&](size_t offset, size_t length) {
-            return write_content(strm, res.content_provider_, offset, length,
-                                 is_shutting_down);
-        });
-}
-
-inline std::pair<size_t, size_t>
-get_range_offset_and_length(const Request &req, const Response &res,
-                            size_t index) {
-    auto r = req.ranges[index];
-
-    if (r.second == -1) {
-        r.second = static_cast<ssize_t>(res.content_length_) - 1;
+inline bool write_ranges(Stream &strm, const Ranges &ranges,
+                         const ContentProvider &content_provider,
+                         size_t content_length, const std::string &boundary,
+                         const std::string &content_type,
+                         const T &is_shutting_down) {
+    if (ranges.size() == 1) {
+        auto offsets = get_range_offset_and_length(ranges[0]);
+        return write_content(strm, content_provider, offsets.first,
+                             offsets.second, is_shutting_down);
+    }
+
+    std::string header;
+    for (size_t i = 0; i < ranges.size(); i++) {
+        auto offsets = get_range_offset_and_length(ranges[i]);
+        make_multipart_range_header(header, i, boundary, content_type,
+                                    offsets.first, offsets.second,
+                                    content_length);
+        if (!write_data(strm, header.data(), header.size()) ||
+            !write_content(strm, content_provider, offsets.first, offsets.second,
+                           is_shutting_down)) {
+            return false;
+        }
     }
-
-    return std::make_pair(r.first, r.second - r.first + 1);
+    header = "\r\n--" + boundary + "--\r\n";
+    return write_data(strm, header.data(), header.size());
 }
 
 inline bool expect_content(const Request &req) {
@@ -5011,11 +6168,12 @@ namespace detail {
 inline SocketStream::SocketStream(socket_t sock, time_t read_timeout_sec,
                                   time_t read_timeout_usec,
                                   time_t write_timeout_sec,
-                                  time_t write_timeout_usec)
+                                  time_t write_timeout_usec, IoUring *ring)
     : sock_(sock), read_timeout_sec_(read_timeout_sec),
     read_timeout_usec_(read_timeout_usec),
     write_timeout_sec_(write_timeout_sec),
-    write_timeout_usec_(write_timeout_usec), read_buff_(read_buff_size_, 0) {}
+    write_timeout_usec_(write_timeout_usec), ring_(ring),
+    read_buff_(read_buff_size_, 0) {}
 
 inline SocketStream::~SocketStream() {}
 
@@ -5050,14 +6208,20 @@ inline ssize_t SocketStream::read(char *ptr, size_t size) {
         }
     }
 
-    if (!is_readable()) { return -1; }
+    // The ring times the receive out by itself
+    if (!ring_ && !is_readable()) { return -1; }
 
     read_buff_off_ = 0;
     read_buff_content_size_ = 0;
 
+    auto recv = [&](char *buf, size_t len) {
+        return ring_ ? ring_->recv(sock_, buf, len, CPPHTTPLIB_RECV_FLAGS,
+                                   read_timeout_sec_, read_timeout_usec_)
+               : read_socket(sock_, buf, len, CPPHTTPLIB_RECV_FLAGS);
+    };
+
     if (size < read_buff_size_) {
-        auto n = read_socket(sock_, read_buff_.data(), read_buff_size_,
-                             CPPHTTPLIB_RECV_FLAGS);
+        auto n = recv(read_buff_.data(), read_buff_size_);
         if (n <= 0) {
             return n;
         } else if (n <= static_cast<ssize_t>(size)) {
@@ -5070,11 +6234,16 @@ inline ssize_t SocketStream::read(char *ptr, size_t size) {
             return static_cast<ssize_t>(size);
         }
     } else {
-        return read_socket(sock_, ptr, size, CPPHTTPLIB_RECV_FLAGS);
+        return recv(ptr, size);
     }
 }
 
 inline ssize_t SocketStream::write(const char *ptr, size_t size) {
+    if (ring_) {
+        return ring_->send(sock_, ptr, size, CPPHTTPLIB_SEND_FLAGS,
+                           write_timeout_sec_, write_timeout_usec_);
+    }
+
     if (!is_writable()) { return -1; }
 
 #if defined(_WIN32) && !defined(_WIN64)
@@ -5095,6 +6264,10 @@ inline void SocketStream::get_local_ip_and_port(std::string &ip,
     return detail::get_local_ip_and_port(sock_, ip, port);
 }
 
+inline void SocketStream::get_peer_credentials(int &uid, int &gid) const {
+    detail::get_peer_credentials(sock_, uid, gid);
+}
+
 inline socket_t SocketStream::socket() const { return sock_; }
 
 // Buffer stream implementation
@@ -5312,6 +6485,26 @@ inline Server &Server::set_keep_alive_timeout(time_t sec) {
     return *this;
 }
 
+inline Server &Server::set_keep_alive_parking(bool on) {
+    keep_alive_parking_enabled_ = on;
+    return *this;
+}
+
+inline Server &Server::set_keep_alive_max_parked(size_t count) {
+    keep_alive_max_parked_ = count;
+    return *this;
+}
+
+inline Server &Server::set_io_uring(bool on) {
+    io_uring_enabled_ = on;
+    return *this;
+}
+
+inline Server &Server::set_count_syscalls(bool on) {
+    count_syscalls_ = on;
+    return *this;
+}
+
 inline Server &Server::set_read_timeout(time_t sec, time_t usec) {
     read_timeout_sec_ = sec;
     read_timeout_usec_ = usec;
@@ -5330,6 +6523,12 @@ inline Server &Server::set_idle_interval(time_t sec, time_t usec) {
     return *this;
 }
 
+inline Server &Server::set_drain_timeout(time_t sec, time_t usec) {
+    drain_timeout_sec_ = sec;
+    drain_timeout_usec_ = usec;
+    return *this;
+}
+
 inline Server &Server::set_payload_max_length(size_t length) {
     payload_max_length_ = length;
     return *this;
@@ -5344,6 +6543,12 @@ inline int Server::bind_to_any_port(const std::string &host, int socket_flags) {
     return bind_internal(host, 0, socket_flags);
 }
 
+inline bool Server::bind_to_socket(socket_t sock) {
+    if (!is_valid() || sock == INVALID_SOCKET) { return false; }
+    svr_sock_ = sock;
+    return true;
+}
+
 inline bool Server::listen_after_bind() {
     auto se = detail::scope_exit([&]() { done_ = true; });
     return listen_internal();
@@ -5363,15 +6568,49 @@ inline void Server::wait_until_ready() const {
     }
 }
 
+// Also stops a server that is bound but not listening yet, which then returns
+// from listening right away.
 inline void Server::stop() {
-    if (is_running_) {
-        assert(svr_sock_ != INVALID_SOCKET);
-        std::atomic<socket_t> sock(svr_sock_.exchange(INVALID_SOCKET));
+    auto sock = svr_sock_.exchange(INVALID_SOCKET);
+    if (sock != INVALID_SOCKET) {
         detail::shutdown_socket(sock);
         detail::close_socket(sock);
     }
 }
 
+inline void Server::hand_off() {
+    handing_off_ = true;
+    // Not listening, so the accept loop will not close it
+    if (!is_running_) {
+        auto sock = svr_sock_.exchange(INVALID_SOCKET);
+        if (sock != INVALID_SOCKET) { detail::close_socket(sock); }
+    }
+}
+
+inline socket_t Server::listening_socket() const { return svr_sock_; }
+
+inline void Server::drain_connections() {
+    auto timeout = std::chrono::seconds(drain_timeout_sec_) +
+                   std::chrono::microseconds(drain_timeout_usec_);
+    std::unique_lock<std::mutex> lock(connections_mutex_);
+    if (connections_cv_.wait_for(lock, timeout,
+                                 [&]() { return connections_.empty(); })) {
+        return;
+    }
+    // Wakes the workers blocked on them. They close them as usual.
+    for (auto sock : connections_) {
+        detail::shutdown_socket(sock);
+    }
+}
+
+inline std::atomic<uint64_t> *Server::enabled_syscall_counter() {
+    return count_syscalls_ ? &socket_syscalls_ : nullptr;
+}
+
+inline uint64_t Server::socket_syscall_count() const {
+    return socket_syscalls_.load(std::memory_order_relaxed);
+}
+
 inline bool Server::parse_request_line(const char *s, Request &req) {
     auto len = strlen(s);
     if (len < 2 || s[len - 2] != '\r' || s[len - 1] != '\n') { return false; }
@@ -5416,7 +6655,8 @@ inline bool Server::parse_request_line(const char *s, Request &req) {
                       [&](const char *b, const char *e) {
                           switch (count) {
                           case 0:
-                              req.path = detail::decode_url(std::string(b, e), false);
+                              req.path.assign(b, e);
+                              detail::decode_url_in_place(req.path, false);
                               break;
                           case 1: {
                               if (e - b > 0) {
@@ -5452,6 +6692,32 @@ inline bool Server::write_response_core(Stream &strm, bool close_connection,
                                         bool need_apply_ranges) {
     assert(res.status != -1);
 
+    // The ranges apply to the content of a successful response, once its
+    // length is known. Never to an error page.
+    Ranges ranges;
+    if (need_apply_ranges && !req.ranges.empty() && 200 <= res.status &&
+        res.status < 300) {
+        if (res.body.empty() && res.content_provider_ && !res.content_length_) {
+            // Streamed without a length, so sent whole
+            res.status = 200;
+        } else {
+            auto content_length =
+                res.body.empty() ? res.content_length_ : res.body.size();
+            ranges = req.ranges;
+            if (detail::resolve_ranges(ranges, content_length)) {
+                res.status = 206;
+            } else {
+                res.status = 416;
+                res.set_header("Content-Range",
+                               "bytes */" + std::to_string(content_length));
+                res.body.clear();
+                res.content_length_ = 0;
+                res.content_provider_ = nullptr;
+                res.is_chunked_content_provider_ = false;
+            }
+        }
+    }
+
     if (400 <= res.status && error_handler_ &&
         error_handler_(req, res) == HandlerResponse::Handled) {
         need_apply_ranges = true;
@@ -5459,7 +6725,9 @@ inline bool Server::write_response_core(Stream &strm, bool close_connection,
 
     std::string content_type;
     std::string boundary;
-    if (need_apply_ranges) { apply_ranges(req, res, content_type, boundary); }
+    if (need_apply_ranges) {
+        apply_ranges(req, ranges, res, content_type, boundary);
+    }
 
     // Prepare additional headers
     if (close_connection || req.get_header_value("Connection") == "close") {
@@ -5506,12 +6774,25 @@ inline bool Server::write_response_core(Stream &strm, bool close_connection,
     // Body
     auto ret = true;
     if (req.method != "HEAD") {
-        if (!res.body.empty()) {
+        if (!res.body.empty() && !ranges.empty()) {
+            // Slices of the body, which stays as the handler set it
+            ContentProvider body = [&](size_t offset, size_t length,
+                                       DataSink &sink) {
+                sink.write(res.body.data() + offset, length);
+                return true;
+            };
+            if (!detail::write_ranges(strm, ranges, body, res.body.size(),
+                                      boundary, content_type,
+                                      []() { return false; })) {
+                ret = false;
+            }
+        } else if (!res.body.empty()) {
             if (!detail::write_data(strm, res.body.data(), res.body.size())) {
                 ret = false;
             }
         } else if (res.content_provider_) {
-            if (write_content_with_provider(strm, req, res, boundary, content_type)) {
+            if (write_content_with_provider(strm, req, ranges, res, boundary,
+                                            content_type)) {
                 res.content_provider_success_ = true;
             } else {
                 res.content_provider_success_ = false;
@@ -5526,28 +6807,21 @@ inline bool Server::write_response_core(Stream &strm, bool close_connection,
     return ret;
 }
 
-inline bool
-Server::write_content_with_provider(Stream &strm, const Request &req,
-                                    Response &res, const std::string &boundary,
-                                    const std::string &content_type) {
+inline bool Server::write_content_with_provider(
+    Stream &strm, const Request &req, const Ranges &ranges, Response &res,
+    const std::string &boundary, const std::string &content_type) {
     auto is_shutting_down = [this]() {
         return this->svr_sock_ == INVALID_SOCKET;
     };
 
     if (res.content_length_ > 0) {
-        if (req.ranges.empty()) {
+        if (ranges.empty()) {
             return detail::write_content(strm, res.content_provider_, 0,
                                          res.content_length_, is_shutting_down);
-        } else if (req.ranges.size() == 1) {
-            auto offsets =
-                detail::get_range_offset_and_length(req, res.content_length_, 0);
-            auto offset = offsets.first;
-            auto length = offsets.second;
-            return detail::write_content(strm, res.content_provider_, offset, length,
-                                         is_shutting_down);
         } else {
-            return detail::write_multipart_ranges_data(
-                strm, req, res, boundary, content_type, is_shutting_down);
+            return detail::write_ranges(strm, ranges, res.content_provider_,
+                                        res.content_length_, boundary,
+                                        content_type, is_shutting_down);
         }
     } else {
         if (res.is_chunked_content_provider_) {
@@ -5689,10 +6963,13 @@ inline bool Server::handle_file_request(const Request &req, Response &res,
                 if (path.back() == '/') { path += "index.html"; }
 
                 if (detail::is_file(path)) {
-                    detail::read_file(path, res.body);
                     auto type =
                         detail::find_content_type(path, file_extension_and_mimetype_map_);
-                    if (type) { res.set_header("Content-Type", type); }
+                    if (!detail::set_file_content_provider(
+                            path, type ? type : "text/plain", res)) {
+                        detail::read_file(path, res.body);
+                        if (type) { res.set_header("Content-Type", type); }
+                    }
                     for (const auto &kv : entry.headers) {
                         res.set_header(kv.first.c_str(), kv.second);
                     }
@@ -5754,11 +7031,89 @@ inline bool Server::listen_internal() {
     auto ret = true;
     is_running_ = true;
     auto se = detail::scope_exit([&]() { is_running_ = false; });
+    detail::scoped_syscall_counter counter(enabled_syscall_counter());
 
     {
         std::unique_ptr<TaskQueue> task_queue(new_task_queue());
 
-        while (svr_sock_ != INVALID_SOCKET) {
+        // Stopped before the task queue shuts down, by which time the workers
+        // close their connections instead of parking them
+        std::unique_ptr<detail::KeepAliveParking> parking;
+#ifdef CPPHTTPLIB_KEEPALIVE_PARKING
+        if (keep_alive_parking_enabled_ && keep_alive_max_parked_ > 0) {
+            parking.reset(new detail::KeepAliveParking(
+                keep_alive_timeout_sec_, keep_alive_max_parked_,
+                [this, &task_queue](socket_t sock, size_t remaining_count) {
+                    task_queue->enqueue([this, sock, remaining_count]() {
+                        process_socket(sock, remaining_count);
+                    });
+                },
+                enabled_syscall_counter()));
+        }
+#endif
+        keep_alive_parking_ = parking.get();
+
+        // Connections are accepted without the ring from the first failed
+        // accept on, which includes kernels without multishot accept
+        std::unique_ptr<detail::IoUring> accept_ring;
+        if (io_uring_enabled_) {
+            accept_ring.reset(new detail::IoUring(8));
+            if (!accept_ring->is_valid()) { accept_ring.reset(); }
+        }
+        std::vector<socket_t> accepted;
+
+        auto enqueue_socket = [&](socket_t sock) {
+            {
+#ifdef _WIN32
+                auto timeout = static_cast<uint32_t>(read_timeout_sec_ * 1000 +
+                                                     read_timeout_usec_ / 1000);
+                setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout,
+                           sizeof(timeout));
+#else
+                timeval tv;
+                tv.tv_sec = static_cast<long>(read_timeout_sec_);
+                tv.tv_usec = static_cast<decltype(tv.tv_usec)>(read_timeout_usec_);
+                setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv, sizeof(tv));
+#endif
+            }
+            {
+
+#ifdef _WIN32
+                auto timeout = static_cast<uint32_t>(write_timeout_sec_ * 1000 +
+                                                     write_timeout_usec_ / 1000);
+                setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (char *)&timeout,
+                           sizeof(timeout));
+#else
+                timeval tv;
+                tv.tv_sec = static_cast<long>(write_timeout_sec_);
+                tv.tv_usec = static_cast<decltype(tv.tv_usec)>(write_timeout_usec_);
+                setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (char *)&tv, sizeof(tv));
+#endif
+            }
+            // The two setsockopt calls
+            detail::count_syscall();
+            detail::count_syscall();
+
+            task_queue->enqueue([this, sock]() { process_and_close_socket(sock); });
+        };
+
+        while (svr_sock_ != INVALID_SOCKET && !handing_off_) {
+            if (accept_ring) {
+                accepted.clear();
+                auto error = accept_ring->accept(svr_sock_, idle_interval_sec_,
+                                                 idle_interval_usec_, accepted);
+                for (auto sock : accepted) {
+                    enqueue_socket(sock);
+                }
+                if (error) {
+                    accept_ring.reset();
+                } else if (accepted.empty() &&
+                           (idle_interval_sec_ > 0 || idle_interval_usec_ > 0)) {
+                    task_queue->on_idle();
+                }
+                continue;
+            }
+
 #ifndef _WIN32
             if (idle_interval_sec_ > 0 || idle_interval_usec_ > 0) {
 #endif
@@ -5771,6 +7126,7 @@ inline bool Server::listen_internal() {
 #ifndef _WIN32
             }
 #endif
+            detail::count_syscall();
             socket_t sock = accept(svr_sock_, nullptr, nullptr);
 
             if (sock == INVALID_SOCKET) {
@@ -5791,38 +7147,32 @@ inline bool Server::listen_internal() {
                 break;
             }
 
-            {
-#ifdef _WIN32
-                auto timeout = static_cast<uint32_t>(read_timeout_sec_ * 1000 +
-                                                     read_timeout_usec_ / 1000);
-                setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout,
-                           sizeof(timeout));
-#else
-                timeval tv;
-                tv.tv_sec = static_cast<long>(read_timeout_sec_);
-                tv.tv_usec = static_cast<decltype(tv.tv_usec)>(read_timeout_usec_);
-                setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv, sizeof(tv));
-#endif
-            }
-            {
+            enqueue_socket(sock);
+        }
 
-#ifdef _WIN32
-                auto timeout = static_cast<uint32_t>(write_timeout_sec_ * 1000 +
-                                                     write_timeout_usec_ / 1000);
-                setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (char *)&timeout,
-                           sizeof(timeout));
-#else
-                timeval tv;
-                tv.tv_sec = static_cast<long>(write_timeout_sec_);
-                tv.tv_usec = static_cast<decltype(tv.tv_usec)>(write_timeout_usec_);
-                setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (char *)&tv, sizeof(tv));
-#endif
+        // Serve the connections the armed accept took before it stopped. The
+        // ring holds on to the server socket until then.
+        if (accept_ring) {
+            accepted.clear();
+            accept_ring->cancel_accept(accepted);
+            for (auto sock : accepted) {
+                enqueue_socket(sock);
             }
+            accept_ring.reset();
+        }
 
-            task_queue->enqueue([this, sock]() { process_and_close_socket(sock); });
+        // Handed off: close it without shutting it down, which would stop it
+        // listening for every process holding it
+        if (handing_off_) {
+            auto sock = svr_sock_.exchange(INVALID_SOCKET);
+            if (sock != INVALID_SOCKET) { detail::close_socket(sock); }
         }
 
+        // Close the idle connections before waiting for the busy ones
+        if (parking) { parking->stop(); }
+        drain_connections();
         task_queue->shutdown();
+        keep_alive_parking_ = nullptr;
     }
 
     return ret;
@@ -5919,10 +7269,10 @@ inline bool Server::dispatch_request(Request &req, Response &res,
     return false;
 }
 
-inline void Server::apply_ranges(const Request &req, Response &res,
-                                 std::string &content_type,
+inline void Server::apply_ranges(const Request &req, const Ranges &ranges,
+                                 Response &res, std::string &content_type,
                                  std::string &boundary) {
-    if (req.ranges.size() > 1) {
+    if (ranges.size() > 1) {
         boundary = detail::make_multipart_data_boundary();
 
         auto it = res.headers.find("Content-Type");
@@ -5935,98 +7285,72 @@ inline void Server::apply_ranges(const Request &req, Response &res,
                        "multipart/byteranges; boundary=" + boundary);
     }
 
-    auto type = detail::encoding_type(req, res);
+    // Ranges count bytes of the content as it is, so it is not compressed
+    auto type = ranges.empty() ? detail::encoding_type(req, res)
+                               : detail::EncodingType::None;
+    auto content_length =
+        res.body.empty() ? res.content_length_ : res.body.size();
+
+    if (ranges.size() == 1) {
+        auto offsets = detail::get_range_offset_and_length(ranges[0]);
+        res.set_header("Content-Range",
+                       detail::make_content_range_header_field(
+                           offsets.first, offsets.second, content_length));
+        res.set_header("Content-Length", std::to_string(offsets.second));
+        return;
+    }
+    if (ranges.size() > 1) {
+        res.set_header("Content-Length",
+                       std::to_string(detail::get_multipart_ranges_data_length(
+                           ranges, content_length, boundary, content_type)));
+        return;
+    }
 
     if (res.body.empty()) {
         if (res.content_length_ > 0) {
-            size_t length = 0;
-            if (req.ranges.empty()) {
-                length = res.content_length_;
-            } else if (req.ranges.size() == 1) {
-                auto offsets =
-                    detail::get_range_offset_and_length(req, res.content_length_, 0);
-                auto offset = offsets.first;
-                length = offsets.second;
-                auto content_range = detail::make_content_range_header_field(
-                    offset, length, res.content_length_);
-                res.set_header("Content-Range", content_range);
-            } else {
-                length = detail::get_multipart_ranges_data_length(req, res, boundary,
-                                                                  content_type);
-            }
-            res.set_header("Content-Length", std::to_string(length));
-        } else {
-            if (res.content_provider_) {
-                if (res.is_chunked_content_provider_) {
-                    res.set_header("Transfer-Encoding", "chunked");
-                    if (type == detail::EncodingType::Gzip) {
-                        res.set_header("Content-Encoding", "gzip");
-                    } else if (type == detail::EncodingType::Brotli) {
-                        res.set_header("Content-Encoding", "br");
-                    }
-                }
-            }
-        }
-    } else {
-        if (req.ranges.empty()) {
-            ;
-        } else if (req.ranges.size() == 1) {
-            auto offsets =
-                detail::get_range_offset_and_length(req, res.body.size(), 0);
-            auto offset = offsets.first;
-            auto length = offsets.second;
-            auto content_range = detail::make_content_range_header_field(
-                offset, length, res.body.size());
-            res.set_header("Content-Range", content_range);
-            if (offset < res.body.size()) {
-                res.body = res.body.substr(offset, length);
-            } else {
-                res.body.clear();
-                res.status = 416;
-            }
-        } else {
-            std::string data;
-            if (detail::make_multipart_ranges_data(req, res, boundary, content_type,
-                                                   data)) {
-                res.body.swap(data);
-            } else {
-                res.body.clear();
-                res.status = 416;
+            res.set_header("Content-Length", std::to_string(res.content_length_));
+        } else if (res.content_provider_ && res.is_chunked_content_provider_) {
+            res.set_header("Transfer-Encoding", "chunked");
+            if (type == detail::EncodingType::Gzip) {
+                res.set_header("Content-Encoding", "gzip");
+            } else if (type == detail::EncodingType::Brotli) {
+                res.set_header("Content-Encoding", "br");
             }
         }
+        return;
+    }
 
-        if (type != detail::EncodingType::None) {
-            std::unique_ptr<detail::compressor> compressor;
-            std::string content_encoding;
+    if (type != detail::EncodingType::None) {
+        std::unique_ptr<detail::compressor> compressor;
+        std::string content_encoding;
 
-            if (type == detail::EncodingType::Gzip) {
+        if (type == detail::EncodingType::Gzip) {
 #ifdef CPPHTTPLIB_ZLIB_SUPPORT
-                compressor = detail::make_unique<detail::gzip_compressor>();
-                content_encoding = "gzip";
+            compressor = detail::make_unique<detail::gzip_compressor>();
+            content_encoding = "gzip";
 #endif
-            } else if (type == detail::EncodingType::Brotli) {
+        } else if (type == detail::EncodingType::Brotli) {
 #ifdef CPPHTTPLIB_BROTLI_SUPPORT
-                compressor = detail::make_unique<detail::brotli_compressor>();
-                content_encoding = "br";
+            compressor = detail::make_unique<detail::brotli_compressor>();
+            content_encoding = "br";
 #endif
-            }
+        }
 
-            if (compressor) {
-                std::string compressed;
-                if (compressor->compress(res.body.data(), res.body.size(), true,
-                                         [&](const char *data, size_t data_len) {
-                                             compressed.append(data, data_len);
-                                             return true;
-                                         })) {
-                    res.body.swap(compressed);
-                    res.set_header("Content-Encoding", content_encoding);
-                }
+        if (compressor) {
+            std::string compressed;
+            if (compressor->compress(res.body.data(), res.body.size(), true,
+                                     [&](const char *data, size_t data_len) {
+                                         compressed.append(data, data_len);
+                                         return true;
+                                     })) {
+                res.body.swap(compressed);
+                res.set_header("Content-Encoding", content_encoding);
             }
         }
-
-        auto length = std::to_string(res.body.size());
-        res.set_header("Content-Length", length);
     }
+
+    auto length = std::to_string(res.body.size());
+    res.set_header("Content-Length", length);
 }
 
 inline bool Server::dispatch_request_for_content_reader(
@@ -6108,6 +7432,11 @@ Server::process_request(Stream &strm, bool close_connection,
     req.set_header("REMOTE_ADDR", req.remote_addr);
     req.set_header("REMOTE_PORT", std::to_string(req.remote_port));
 
+    // Only unix domain socket peers have no address
+    if (req.remote_addr.empty()) {
+        strm.get_peer_credentials(req.remote_uid, req.remote_gid);
+    }
+
     strm.get_local_ip_and_port(req.local_addr, req.local_port);
     req.set_header("LOCAL_ADDR", req.local_addr);
     req.set_header("LOCAL_PORT", std::to_string(req.local_port));
@@ -6174,6 +7503,13 @@ Server::process_request(Stream &strm, bool close_connection,
     }
 #endif
 
+    // A handler may close the connection, for instance after answering
+    // without reading the body
+    if (res.get_header_value("Connection") == "close") {
+        close_connection = true;
+        connection_closed = true;
+    }
+
     if (routed) {
         if (res.status == -1) { res.status = req.ranges.empty() ? 200 : 206; }
         return write_response_with_content(strm, close_connection, req, res);
@@ -6186,17 +7522,78 @@ Server::process_request(Stream &strm, bool close_connection,
 inline bool Server::is_valid() const { return true; }
 
 inline bool Server::process_and_close_socket(socket_t sock) {
-    auto ret = detail::process_server_socket(
-        svr_sock_, sock, keep_alive_max_count_, keep_alive_timeout_sec_,
-        read_timeout_sec_, read_timeout_usec_, write_timeout_sec_,
-        write_timeout_usec_,
-        [this](Stream &strm, bool close_connection, bool &connection_closed) {
-            return process_request(strm, close_connection, connection_closed,
-                                   nullptr);
-        });
+    return process_socket(sock, keep_alive_max_count_);
+}
 
-    detail::shutdown_socket(sock);
-    detail::close_socket(sock);
+inline bool Server::process_socket(socket_t sock, size_t remaining_count) {
+    assert(remaining_count > 0);
+    detail::scoped_syscall_counter counter(enabled_syscall_counter());
+    auto ring = io_uring_enabled_ ? detail::IoUring::thread_ring() : nullptr;
+    auto ret = false;
+
+    auto track = [&]() {
+        std::lock_guard<std::mutex> guard(connections_mutex_);
+        connections_.insert(sock);
+    };
+    auto untrack = [&]() {
+        std::lock_guard<std::mutex> guard(connections_mutex_);
+        connections_.erase(sock);
+        if (connections_.empty()) { connections_cv_.notify_all(); }
+    };
+    track();
+
+    // A connection accepted before the server stopped gets its first request
+    // answered, like the ones waiting on a handed off socket will be by the
+    // process taking it over. Only further requests are refused.
+    auto answered = remaining_count < keep_alive_max_count_;
+    while ((svr_sock_ != INVALID_SOCKET || !answered) && remaining_count > 0) {
+        auto stopping = svr_sock_ == INVALID_SOCKET;
+        auto val = detail::select_read(sock, 0, 0);
+        if (val < 0) { break; }
+        if (val == 0 && stopping) {
+            // The first request of a connection accepted or resumed before
+            // stopping is on its way: wait for it here rather than give up on
+            // it
+            if (detail::select_read(sock, read_timeout_sec_, read_timeout_usec_) <=
+                0) {
+                break;
+            }
+        } else if (val == 0) {
+            // Nothing to read yet. Hand the connection over instead of
+            // waiting for its next request on this worker, fresh connections
+            // included, so that idle clients can not hold every worker.
+            // Untracked first, as the worker it is resumed on tracks it again.
+            if (keep_alive_parking_) {
+                untrack();
+                if (keep_alive_parking_->park(sock, remaining_count, answered)) {
+                    return ret;
+                }
+                track();
+            }
+            if (!detail::keep_alive(svr_sock_, sock, keep_alive_timeout_sec_)) {
+                // Stopped while waiting: the first request is still owed an
+                // answer
+                if (answered || svr_sock_ != INVALID_SOCKET) { break; }
+                continue;
+            }
+        }
+
+        // Tell the client not to send another request when stopping
+        auto close_connection = remaining_count == 1 || stopping;
+        auto connection_closed = false;
+        detail::SocketStream strm(sock, read_timeout_sec_, read_timeout_usec_,
+                                  write_timeout_sec_, write_timeout_usec_, ring);
+        ret = process_request(strm, close_connection, connection_closed, nullptr);
+        answered = true;
+        if (!ret || connection_closed) { break; }
+        remaining_count--;
+    }
+
+    untrack();
+    if (!ring || !ring->shutdown_and_close(sock)) {
+        detail::shutdown_socket(sock);
+        detail::close_socket(sock);
+    }
     return ret;
 }
 